@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+class AssetManager;
+class Model;
+class Shader;
+class Texture;
+
+// Counted reference to an asset owned by an AssetManager, the asset is unloaded when the last handle goes away.
+// Handles must not outlive their manager.
+template<typename T>
+class AssetHandle
+{
+public:
+	AssetHandle() : manager(nullptr), id(0), asset(nullptr) {}
+	AssetHandle(const AssetHandle& other);
+	AssetHandle(AssetHandle&& other) noexcept;
+	~AssetHandle();
+
+	AssetHandle& operator=(AssetHandle other);
+
+	T* get() const { return asset; }
+	T* operator->() const { return asset; }
+	T& operator*() const { return *asset; }
+	explicit operator bool() const { return asset != nullptr; }
+
+	uint64_t key() const { return id; }
+
+	// Drop this reference
+	void reset();
+
+private:
+	friend class AssetManager;
+
+	// Adopts a reference the manager already counted
+	AssetHandle(AssetManager* manager, uint64_t id, T* asset) : manager(manager), id(id), asset(asset) {}
+
+	AssetManager* manager;
+	uint64_t id;
+	T* asset;
+};
+
+typedef AssetHandle<Model> ModelHandle;
+typedef AssetHandle<Texture> TextureHandle;
+typedef AssetHandle<Shader> ShaderHandle;
+
+// Instantiated in AssetManager.cpp, so headers can hold handles without pulling in the manager
+extern template class AssetHandle<Model>;
+extern template class AssetHandle<Texture>;
+extern template class AssetHandle<Shader>;
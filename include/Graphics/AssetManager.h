@@ -0,0 +1,172 @@
+#pragma once
+
+#include "Graphics/AssetHandle.h"
+#include "Graphics/Model.h"
+#include "Graphics/Shader.h"
+#include "Graphics/Texture.h"
+#include "Graphics/TextureStreamer.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Engine-wide cache of models, textures and shaders keyed by hashed path.
+// Loading the same asset twice returns the resident copy, so it costs RAM and VRAM once. GL thread only.
+class AssetManager
+{
+public:
+	explicit AssetManager(TextureStreamer* streamer = nullptr);
+	~AssetManager();
+
+	AssetManager(const AssetManager&) = delete;
+	AssetManager& operator=(const AssetManager&) = delete;
+
+	ModelHandle loadModel(const std::string& path, bool gamma = false, VertexLayout layout = VertexLayout::Static);
+	// Keyed on path and gamma, one image used in several material slots is loaded once. The cached texture
+	// has no type, callers keep it on their own Texture reference; textureType only picks the streaming placeholder.
+	TextureHandle loadTexture(const std::string& path, const std::string& textureType = "texture_diffuse", bool gamma = false);
+	ShaderHandle loadShader(const std::string& vertexPath, const std::string& fragmentPath);
+
+	// Number of resident assets of each type
+	size_t modelCount() const { return models.size(); }
+	size_t textureCount() const { return textures.size(); }
+	size_t shaderCount() const { return shaders.size(); }
+
+	TextureStreamer* textureStreamer() const { return streamer; }
+
+	// Forward slashes, no "./" segments, so different spellings of a path share one key
+	static std::string NormalizePath(const std::string& path);
+
+private:
+	template<typename T> friend class AssetHandle;
+
+	template<typename T>
+	struct Entry
+	{
+		std::unique_ptr<T> asset;
+		unsigned int refCount;
+		std::string name;
+	};
+
+	template<typename T>
+	using Table = std::unordered_map<uint64_t, Entry<T>>;
+
+	TextureStreamer* streamer;
+	Table<Model> models;
+	Table<Texture> textures;
+	Table<Shader> shaders;
+
+	Table<Model>& table(Model*) { return models; }
+	Table<Texture>& table(Texture*) { return textures; }
+	Table<Shader>& table(Shader*) { return shaders; }
+
+	template<typename T>
+	void addRef(uint64_t id);
+
+	template<typename T>
+	void release(uint64_t id);
+
+	// Returns a counted handle if the asset is resident
+	template<typename T>
+	AssetHandle<T> find(uint64_t id);
+
+	template<typename T>
+	AssetHandle<T> insert(uint64_t id, const std::string& name, std::unique_ptr<T> asset);
+
+	void unload(Model& model);
+	void unload(Texture& texture);
+	void unload(Shader& shader);
+};
+
+
+// AssetManager templates
+//-----------------------------------------------------------
+template<typename T>
+void AssetManager::addRef(uint64_t id)
+{
+	table((T*)nullptr).at(id).refCount++;
+}
+
+template<typename T>
+void AssetManager::release(uint64_t id)
+{
+	Table<T>& entries = table((T*)nullptr);
+	auto it = entries.find(id);
+	if (it == entries.end() || --it->second.refCount > 0)
+		return;
+
+	// Take the asset out first, unloading a model releases its textures which touches the tables again
+	std::unique_ptr<T> asset = std::move(it->second.asset);
+	entries.erase(it);
+	unload(*asset);
+}
+
+template<typename T>
+AssetHandle<T> AssetManager::find(uint64_t id)
+{
+	Table<T>& entries = table((T*)nullptr);
+	auto it = entries.find(id);
+	if (it == entries.end())
+		return AssetHandle<T>();
+
+	it->second.refCount++;
+	return AssetHandle<T>(this, id, it->second.asset.get());
+}
+
+template<typename T>
+AssetHandle<T> AssetManager::insert(uint64_t id, const std::string& name, std::unique_ptr<T> asset)
+{
+	T* raw = asset.get();
+	Entry<T>& entry = table((T*)nullptr)[id];
+	entry.asset = std::move(asset);
+	entry.refCount = 1;
+	entry.name = name;
+	return AssetHandle<T>(this, id, raw);
+}
+
+
+// AssetHandle
+//-----------------------------------------------------------
+template<typename T>
+AssetHandle<T>::AssetHandle(const AssetHandle& other)
+	: manager(other.manager), id(other.id), asset(other.asset)
+{
+	if (asset)
+		manager->template addRef<T>(id);
+}
+
+template<typename T>
+AssetHandle<T>::AssetHandle(AssetHandle&& other) noexcept
+	: manager(other.manager), id(other.id), asset(other.asset)
+{
+	other.manager = nullptr;
+	other.id = 0;
+	other.asset = nullptr;
+}
+
+template<typename T>
+AssetHandle<T>::~AssetHandle()
+{
+	reset();
+}
+
+template<typename T>
+AssetHandle<T>& AssetHandle<T>::operator=(AssetHandle other)
+{
+	std::swap(manager, other.manager);
+	std::swap(id, other.id);
+	std::swap(asset, other.asset);
+	return *this;
+}
+
+template<typename T>
+void AssetHandle<T>::reset()
+{
+	if (asset)
+		manager->template release<T>(id);
+
+	manager = nullptr;
+	id = 0;
+	asset = nullptr;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "Graphics/GpuPassTimers.h"
+#include "Graphics/InstanceBuffer.h"
+#include "Graphics/RenderView.h"
+#include "Graphics/Shader.h"
+#include "Graphics/ShadowCasters.h"
+
+#include <memory>
+
+// Must match SHADOW_CASCADE_COUNT in shadow_depth.vert, default.frag and deferred_lighting.frag
+const unsigned int SHADOW_CASCADE_COUNT = 4;
+
+// Uniform buffer binding of the ShadowConstants block, texture unit of the cascade array
+const GLuint SHADOW_CONSTANTS_BINDING = 2;
+const unsigned int SHADOW_MAP_UNIT = 12;
+
+// std140 layout of the ShadowConstants block
+struct ShadowConstants
+{
+	glm::mat4 cascadeViewProjection[SHADOW_CASCADE_COUNT];	// World to the cascade's light clip space
+	glm::vec4 cascadeSplits;		// View depth each cascade ends at
+	glm::vec4 cascadeTexelSize;		// World size of one shadow texel per cascade
+	glm::vec4 params;				// x = depth bias, y = normal offset in texels, z = 1 / resolution
+};
+
+// GPU time of a frame a few frames back, read without waiting
+struct ShadowStats
+{
+	float cascadeMs[SHADOW_CASCADE_COUNT] = {};	// Per cascade with profileCascades, otherwise zero
+	float totalMs = 0.0f;
+	unsigned int renderedCascades = 0;			// Bit per cascade that frame drew
+};
+
+// Cascaded shadow maps of one directional light. Cascades split the view depth between a uniform and a
+// logarithmic distribution and are fit to bounding spheres snapped to whole texels, so they do not shimmer
+// when the camera moves or turns. All cascades due this frame are drawn in one instanced pass through the
+// position-only vertex stream, layered with GL_ARB_shader_viewport_layer_array and one pass per cascade
+// without it. Cascades from firstCachedCascade on cover more than their slice and are only drawn again
+// when the light turns, a static caster moves, the view leaves them or a dynamic caster is inside them.
+class CascadedShadowMaps
+{
+public:
+	float splitLambda = 0.8f;			// 0 = uniform splits, 1 = logarithmic
+	float shadowDistance = 120.0f;		// View depth the last cascade ends at, at most the far plane
+	unsigned int firstCachedCascade = 2;
+	float cacheMargin = 1.25f;			// Cached cascades cover this much more than their slice
+	float depthBias = 0.0005f;
+	float normalOffset = 1.5f;			// Receiver offset along the normal, in texels of its cascade
+	bool profileCascades = false;		// One pass and timer query per cascade, for the per-cascade breakdown
+
+	CascadedShadowMaps(int resolution = 2048, const char* vertexPath = "shaders/shadow_depth.vert", const char* fragmentPath = "shaders/depth_only.frag");
+	~CascadedShadowMaps();
+
+	CascadedShadowMaps(const CascadedShadowMaps&) = delete;
+	CascadedShadowMaps& operator=(const CascadedShadowMaps&) = delete;
+
+	// Fits the cascades to the view, draws the ones that are due, then binds the constants to
+	// SHADOW_CONSTANTS_BINDING and the array to SHADOW_MAP_UNIT. Restores the framebuffer and viewport.
+	// The static casters are compared with the last call's to detect movement.
+	void render(const ShadowCasters& casters, const RenderView& view, const glm::vec3& lightDirection, GLuint framebuffer, int viewportWidth, int viewportHeight);
+
+	// Draw the cached cascades again next frame
+	void invalidate() { cacheValid = 0; }
+
+	// Cascades drawn by the last render()
+	unsigned int lastRenderedCascades() const { return renderedMask; }
+
+	const ShadowStats& stats() const { return shadowStats; }
+	bool layered() const { return layeredShader != nullptr; }
+
+	// Delete the programs, the array, the buffer and the queries
+	void Delete();
+
+private:
+	int resolution;
+	Shader cascadeShader;		// One cascade per pass
+	std::unique_ptr<Shader> layeredShader;	// Every cascade in one pass, null if the extension is missing
+	GLuint depthArray = 0;
+	GLuint framebuffer = 0;
+	GLuint constantsBuffer = 0;
+	ShadowConstants constants;
+
+	uint64_t lastStaticHash = 0;
+	glm::vec3 lastLightDirection = glm::vec3(0.0f);
+
+	// Sphere each cascade was last drawn for, in world space
+	glm::vec3 cascadeCenter[SHADOW_CASCADE_COUNT];
+	float cascadeRadius[SHADOW_CASCADE_COUNT] = {};
+	unsigned int cacheValid = 0;		// Bit per cached cascade that is still usable
+	unsigned int hadDynamic = 0;		// Bit per cascade that held a dynamic caster when last drawn
+	unsigned int renderedMask = 0;
+
+	// One timer per cascade, timer SHADOW_CASCADE_COUNT times the layered pass. Tagged with renderedMask.
+	GpuPassTimers timers{SHADOW_CASCADE_COUNT + 1};
+	ShadowStats shadowStats;
+
+	void fitCascade(const ShadowCasters& casters, unsigned int cascade, const RenderView& view, float nearDepth, float farDepth, const glm::vec3& lightDirection, bool cached);
+	bool dynamicCasterInside(const ShadowCasters& casters, unsigned int cascade) const;
+	void drawCasters(const ShadowCasters& casters, Shader& shader, const int* cascades, int count);
+	void readStats();
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "Graphics/ComputeShader.h"
+#include "Graphics/FrameConstants.h"
+#include "Graphics/Light.h"
+#include "Graphics/RenderView.h"
+
+#include <vector>
+
+class ShaderHotReload;
+
+// Froxel grid over the view frustum, slices are exponential in view depth. Must match default.frag and light_clusters.comp
+const unsigned int CLUSTER_GRID_X = 16;
+const unsigned int CLUSTER_GRID_Y = 9;
+const unsigned int CLUSTER_GRID_Z = 24;
+const unsigned int CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+
+// Lights kept per cluster, further lights touching it are dropped
+const unsigned int MAX_LIGHTS_PER_CLUSTER = 128;
+
+// SSBO bindings of the per-cluster (offset, count) grid and the light indices read by default.frag
+const GLuint CLUSTER_LIGHT_GRID_BINDING = 7;
+const GLuint CLUSTER_LIGHT_INDEX_BINDING = 8;
+
+// Forward+ light culling: assigns the point and spot lights of the LightManager buffer to froxels once per
+// frame, so a fragment only shades the lights whose range reaches its cluster. Directional lights are
+// not clustered. Assignment runs in a compute pass, the CPU fallback fills the same buffers.
+class ClusteredLighting
+{
+public:
+	// false, or a compute shader that failed to build, assigns on the CPU
+	bool gpuAssignment = true;
+
+	ClusteredLighting(const char* computePath = "shaders/light_clusters.comp");
+
+	ClusteredLighting(const ClusteredLighting&) = delete;
+	ClusteredLighting& operator=(const ClusteredLighting&) = delete;
+
+	// Grid constants of the view for the FrameConstants block, the viewport in framebuffer pixels
+	static glm::vec4 ClusterScale(const RenderView& view, float viewportWidth, float viewportHeight);
+
+	// Assigns the lights of the last LightManager::upload and binds the cluster buffers; call after the upload
+	void update(const LightManager& lights, const RenderView& view);
+
+	// Recompile the assignment shader when its file changes
+	void watch(ShaderHotReload& hotReload);
+
+	// Whether the last update ran on the GPU
+	bool assignedOnGpu() const { return lastOnGpu; }
+
+	// Delete the program and the buffers
+	void Delete();
+
+private:
+	ComputeShader assignShader;
+	GLuint gridBuffer = 0;
+	GLuint indexBuffer = 0;
+	bool lastOnGpu = false;
+
+	// The compute pass gives every cluster MAX_LIGHTS_PER_CLUSTER slots, the CPU packs the lists back to back
+	std::vector<glm::uvec2> grid;
+	std::vector<GLuint> indices;
+	std::vector<glm::uvec2> hits;	// (cluster, light) in light order
+	std::vector<glm::vec3> clusterMin;
+	std::vector<glm::vec3> clusterMax;
+
+	void assignOnCpu(const LightManager& lights, const RenderView& view);
+
+	// View space bounds of every cluster
+	void computeClusterBounds(const RenderView& view);
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Graphics/Shader.h"
+
+// Single stage compute program. Built, reflected, cached and hot reloaded like any other Shader,
+// uniforms are set through UniformHandles.
+class ComputeShader : public Shader
+{
+public:
+	// defines are #define lines inserted after the #version line.
+	// ID stays 0 if the program does not build, callers check it before dispatching.
+	ComputeShader(const char* computePath, const std::string& defines = "");
+
+	ComputeShader(const ComputeShader&) = delete;
+	ComputeShader& operator=(const ComputeShader&) = delete;
+
+	// Work groups of the local size declared in the shader, the program must be in use
+	void dispatch(GLuint groupsX, GLuint groupsY = 1, GLuint groupsZ = 1) const;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+struct RenderView;
+
+// View frustum planes, xyz = inward normal, w = distance; a point p is inside if dot(xyz, p) + w >= 0 for all planes
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	// Gribb/Hartmann plane extraction from projection * view
+	static Frustum FromMatrix(const glm::mat4& viewProjection);
+
+	// Conservative, a box outside a plane is rejected; FrustumCuller tests many boxes at once
+	bool intersects(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const;
+};
+
+// Box enclosing a local box under an affine transform
+void TransformBounds(const glm::vec3& localMin, const glm::vec3& localMax, const glm::mat4& transform, glm::vec3& worldMin, glm::vec3& worldMax);
+
+// Counters of the last FrustumCuller::cull
+struct CullStats
+{
+	unsigned int tested = 0;
+	unsigned int frustumCulled = 0;
+	unsigned int smallCulled = 0;	// Inside the frustum but below minPixelSize
+	unsigned int drawn = 0;
+};
+
+// Tests world-space boxes against a view, 8 per iteration with AVX, 4 with SSE.
+// Boxes are kept as structure of arrays and are re-added every frame.
+class FrustumCuller
+{
+public:
+	// Boxes whose bounding sphere projects to fewer pixels than this are culled, 0 disables it
+	float minPixelSize = 0.0f;
+
+	void clear();
+
+	// Returns the index of the box, its visibility is visible(index) after cull()
+	unsigned int add(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	// Local box under an affine transform, the result encloses the transformed box
+	unsigned int add(const glm::vec3& localMin, const glm::vec3& localMax, const glm::mat4& transform);
+
+	void cull(const RenderView& view);
+
+	bool visible(unsigned int index) const { return visibility[index] != 0; }
+	const unsigned char* visibleFlags() const { return visibility.data(); }
+	size_t size() const { return count; }
+	const CullStats& stats() const { return cullStats; }
+
+private:
+	// Padded to a multiple of 8 so the SIMD loops never need a tail
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<unsigned char> visibility;
+	size_t count = 0;
+	CullStats cullStats;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "Graphics/RenderView.h"
+#include "Graphics/Shader.h"
+
+// Texture units the lighting pass samples the G-buffer from, above the material arrays and the depth pyramid.
+// Must match the bindings in deferred_lighting.frag
+const unsigned int GBUFFER_ALBEDO_UNIT = 9;
+const unsigned int GBUFFER_NORMAL_UNIT = 10;
+const unsigned int GBUFFER_DEPTH_UNIT = 11;
+
+// Deferred shading: the opaque pass writes a compact G-buffer (ShaderPermutation::gbuffer) and one
+// fullscreen pass shades every pixel once with the directional lights and the light clusters.
+//   RT0 GL_RGBA8:   albedo, ambient occlusion
+//   RT1 GL_RGBA16:  octahedral normal, specular intensity, shininess / 256
+//   depth GL_DEPTH24_STENCIL8, positions are rebuilt from it
+// Translucent and sky draws go to the target framebuffer afterwards, its depth is copied from the G-buffer.
+class DeferredRenderer
+{
+public:
+	DeferredRenderer(const char* vertexPath = "shaders/deferred_lighting.vert", const char* fragmentPath = "shaders/deferred_lighting.frag");
+	~DeferredRenderer();
+
+	DeferredRenderer(const DeferredRenderer&) = delete;
+	DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+	// Resizes the G-buffer if needed, binds and clears it. The opaque pass is drawn next.
+	void beginGeometry(int width, int height);
+
+	// Shades the G-buffer into framebuffer and copies the depth there, the light buffer and clusters must be bound.
+	// With shadows the first directional light reads the cascades bound by CascadedShadowMaps::render,
+	// with localShadows the point and spot lights read the atlas bound by ShadowAtlas::render.
+	void light(GLuint framebuffer, const RenderView& view, unsigned int dirLightCount, bool shadows = false, bool localShadows = false);
+
+	Shader& lightingShader() { return shader; }
+
+	void Delete();
+
+private:
+	Shader shader;
+	GLuint framebuffer = 0;
+	GLuint albedoTexture = 0;
+	GLuint normalTexture = 0;
+	GLuint depthTexture = 0;
+	GLuint emptyVertexArray = 0;	// The fullscreen triangle comes from gl_VertexID
+	int width = 0;
+	int height = 0;
+
+	void resize(int width, int height);
+	void deleteTargets();
+};
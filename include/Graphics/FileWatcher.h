@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Reports files of one directory (not its subdirectories) that were written.
+// inotify on Linux, modification times polled every POLL_INTERVAL elsewhere.
+class FileWatcher
+{
+public:
+	explicit FileWatcher(const std::string& directory);
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	// Files written since the last call as directory/name, never blocks
+	std::vector<std::string> poll();
+
+	const std::string& path() const { return directory; }
+
+private:
+	std::string directory;
+#ifdef __linux__
+	int inotifyDescriptor;
+#else
+	static constexpr double POLL_INTERVAL = 0.5;	// Seconds
+	std::unordered_map<std::string, long long> modifiedTimes;
+	std::chrono::steady_clock::time_point lastPoll;
+
+	// Current modification time of every file in the directory
+	std::unordered_map<std::string, long long> scan() const;
+#endif
+};
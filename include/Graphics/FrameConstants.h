@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+// Uniform buffer binding point of the FrameConstants block
+const GLuint FRAME_CONSTANTS_BINDING = 0;
+
+// std140 layout of the FrameConstants block in default.vert, default.frag and skybox.vert
+struct FrameConstants
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::mat4 viewRotation;	// View without translation, for the skybox
+	glm::vec4 viewPos;		// xyz = camera position
+	glm::vec4 ambient;		// rgb = global ambient color, a = strength
+	glm::vec4 clusterScale;	// Light clusters: xy = clusters per pixel, z/w = slice scale/bias applied to log(view depth)
+};
+
+// Camera and global state shared by every shader, uploaded once per frame
+class FrameConstantsBuffer
+{
+public:
+	FrameConstantsBuffer();
+	~FrameConstantsBuffer();
+
+	FrameConstantsBuffer(const FrameConstantsBuffer&) = delete;
+	FrameConstantsBuffer& operator=(const FrameConstantsBuffer&) = delete;
+
+	// Uploads the constants and binds the buffer to FRAME_CONSTANTS_BINDING
+	void update(const FrameConstants& constants);
+
+	void Delete();
+
+private:
+	GLuint UBO;
+};
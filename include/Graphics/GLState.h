@@ -0,0 +1,54 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Calls issued to the driver and calls skipped because the state was already set
+struct GLStateStats
+{
+	unsigned int issued = 0;
+	unsigned int skipped = 0;
+};
+
+// Shadow copy of the bind state so redundant binds never reach the driver. GL thread only.
+// Every bind of the tracked state has to go through here, and objects have to be deleted through here
+// because GL reuses names. Call invalidate() after code that changes the state behind its back.
+class GLState
+{
+public:
+	static const unsigned int MAX_TEXTURE_UNITS = 32;
+	static const unsigned int MAX_BUFFER_BINDINGS = 16;	// Indexed uniform/storage buffer bindings
+
+	static void useProgram(GLuint program);
+	static void bindVertexArray(GLuint vertexArray);
+
+	// Binds to a texture unit, the active unit only changes if a bind is needed
+	static void bindTexture(unsigned int unit, GLenum target, GLuint texture);
+
+	// Binds to the active unit, for uploads that do not care about the unit
+	static void bindTexture(GLenum target, GLuint texture);
+
+	// GL_ELEMENT_ARRAY_BUFFER belongs to the bound vertex array and is always issued
+	static void bindBuffer(GLenum target, GLuint buffer);
+	static void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+
+	// Ranges are always issued, the index is tracked as unknown afterwards
+	static void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+	static void depthFunc(GLenum func);
+	static void depthMask(GLboolean write);
+	static void colorMask(GLboolean write);	// All channels of every draw buffer
+	static void polygonMode(GLenum mode);	// GL_FRONT_AND_BACK
+
+	static void deleteProgram(GLuint program);
+	static void deleteVertexArray(GLuint vertexArray);
+	static void deleteTexture(GLuint texture);
+	static void deleteBuffer(GLuint buffer);
+
+	// Forget everything, the next call of each kind is issued
+	static void invalidate();
+
+	static const GLStateStats& stats();
+
+	// Once per frame, so stats() covers a single frame
+	static void resetStats();
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "Graphics/VertexFormat.h"
+
+#include <memory>
+#include <vector>
+
+// Layout of one glMultiDrawElementsIndirect command
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// One vertex buffer, index buffer and vertex array shared by every static mesh of a vertex layout and index type.
+// Meshes are sub-allocated and drawn with a base vertex and first index, so a run of them can be drawn
+// with a single multi-draw. Buffers grow geometrically, the vertex array name never changes. GL thread only.
+// Positions are also kept in a separate tightly packed stream for depth-only passes, which fetch 12 bytes
+// per vertex instead of the whole vertex.
+class GeometryPool
+{
+public:
+	// Pool of a layout and index type, created on first use
+	static GeometryPool& Get(VertexLayout layout, GLenum indexType);
+
+	// Deletes every pool, before the context goes away
+	static void DeleteAll();
+
+	GeometryPool(VertexLayout layout, GLenum indexType);
+
+	GeometryPool(const GeometryPool&) = delete;
+	GeometryPool& operator=(const GeometryPool&) = delete;
+
+	// Copies a mesh in, indices stay relative to the mesh's first vertex
+	void allocate(const void* vertexData, unsigned int vertexCount, const void* indexData, unsigned int indexCount, GLint& baseVertex, GLuint& firstIndex);
+	void free(GLint baseVertex, unsigned int vertexCount, GLuint firstIndex, unsigned int indexCount);
+
+	GLuint vertexArray() const { return VAO; }
+
+	// Same indices and base vertices, attribute 0 only, read from the position stream
+	GLuint positionVertexArray() const { return positionVAO; }
+	unsigned int vertexCapacity() const { return vertexRanges.capacity; }
+	unsigned int indexCapacity() const { return indexRanges.capacity; }
+
+	void Delete();
+
+private:
+	struct Range
+	{
+		unsigned int offset;
+		unsigned int count;
+	};
+
+	// First fit allocator over element offsets, freed ranges are merged with their neighbours
+	struct RangeList
+	{
+		std::vector<Range> freeRanges;	// Sorted by offset
+		unsigned int end = 0;			// Everything from here on is free
+		unsigned int capacity = 0;
+
+		unsigned int allocate(unsigned int count);
+		void free(unsigned int offset, unsigned int count);
+	};
+
+	VertexLayout layout;
+	GLenum indexType;
+	GLuint VAO, VBO, EBO;
+	GLuint positionVAO, positionVBO;
+	std::vector<glm::vec3> positionScratch;
+	RangeList vertexRanges;
+	RangeList indexRanges;
+
+	// Moves the contents into a larger buffer and points the vertex array at it
+	void growVertices(unsigned int capacity);
+	void growIndices(unsigned int capacity);
+	static GLuint growBuffer(GLuint buffer, size_t usedBytes, size_t capacityBytes);
+
+	static std::vector<std::unique_ptr<GeometryPool>>& pools();
+};
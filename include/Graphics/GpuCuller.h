@@ -0,0 +1,115 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "Graphics/ComputeShader.h"
+#include "Graphics/GeometryPool.h"
+#include "Graphics/InstanceBuffer.h"
+#include "Graphics/RenderQueue.h"
+#include "Graphics/RenderView.h"
+#include "Graphics/ShaderPermutations.h"
+
+#include <vector>
+
+class Model;
+class ShaderHotReload;
+
+// SSBO bindings of cull.comp
+const GLuint CULL_OBJECT_BINDING = 3;
+const GLuint CULL_COMMAND_BINDING = 4;
+const GLuint CULL_VISIBLE_BINDING = 5;
+const GLuint CULL_STATS_BINDING = 6;
+
+// default.vert input fed from the visible list, one (instance, mesh) pair per instance
+const GLuint CULLED_INSTANCE_ATTRIBUTE = 8;
+
+// Counters written by cull.comp, read a few frames late from a mapped buffer so the CPU never waits on them
+struct GpuCullStats
+{
+	GLuint visible = 0;
+	GLuint frustumCulled = 0;
+	GLuint occlusionCulled = 0;
+};
+
+// Culls the instances of one model on the GPU: frustum, Hi-Z occlusion against last frame's depth and
+// detail level selection run in a compute pass that fills one indirect command per mesh and level.
+// The CPU only uploads the instances once and resets the commands, the visible set is never read back.
+class GpuCuller
+{
+public:
+	bool occlusion = true;
+
+	GpuCuller(const char* cullPath = "shaders/cull.comp", const char* pyramidPath = "shaders/depth_pyramid.comp");
+
+	GpuCuller(const GpuCuller&) = delete;
+	GpuCuller& operator=(const GpuCuller&) = delete;
+
+	// Uploads the transforms and world bounds, the model must outlive the culler's use of it
+	void setInstances(Model& model, const std::vector<glm::mat4>& transforms);
+
+	// Compute pass for this frame's view, run before the queue executes
+	void cull(const RenderView& view);
+
+	// Queues one multi-draw per mesh over its levels' commands, drawn with the instances cull() kept
+	void submit(RenderQueue& queue, ShaderPermutations& shaders, ShaderPermutation permutation, RenderPass pass = RenderPass::Opaque);
+
+	// Builds the pyramid the next frame is tested against from a framebuffer's depth,
+	// call after the frame is drawn. The framebuffer's depth format must be GL_DEPTH24_STENCIL8.
+	void buildDepthPyramid(GLuint framebuffer, int width, int height);
+
+	// Recompile the cull and pyramid shaders when their files change
+	void watch(ShaderHotReload& hotReload);
+
+	// Counters of a frame a few frames back
+	const GpuCullStats& stats() const { return cullStats; }
+	size_t size() const { return objectCount; }
+
+	// Delete the programs, buffers and the pyramid
+	void Delete();
+
+private:
+	// std430 layout of one object of cull.comp
+	struct CullObject
+	{
+		glm::vec4 boundsMin;	// w = uniform scale
+		glm::vec4 boundsMax;	// w = world radius
+	};
+
+	static const unsigned int STATS_FRAMES = 3;
+
+	ComputeShader cullShader;
+	ComputeShader pyramidShader;
+
+	Model* model = nullptr;
+	unsigned int objectCount = 0;
+	unsigned int lodCount = 1;
+	InstanceBuffer instances;
+	std::vector<DrawElementsIndirectCommand> commandTemplate;	// instanceCount 0, baseInstance = start of the command's visible range
+	std::vector<float> lodErrors;
+	GLuint objectBuffer = 0;
+	GLuint commandBuffer = 0;
+	GLuint visibleBuffer = 0;
+	GLuint drawDataBuffer = 0;	// Node transform per mesh
+
+	// Ring of counters in one persistently mapped buffer. The GPU clears and fills one slot per frame,
+	// the CPU reads a slot from the mapping once its fence has signaled and never issues a readback.
+	GLuint statsBuffer = 0;
+	const GpuCullStats* statsMapping = nullptr;
+	GLsizeiptr statsStride = 0;
+	GLsync statsFences[STATS_FRAMES] = {};
+	unsigned int statsFrame = 0;
+	GpuCullStats cullStats;
+
+	GLuint depthTexture = 0;
+	GLuint depthFramebuffer = 0;
+	GLuint pyramidTexture = 0;
+	int pyramidWidth = 0;
+	int pyramidHeight = 0;
+	int pyramidLevels = 0;
+	bool pyramidValid = false;
+
+	void readStats(unsigned int frame);
+	void resizePyramid(int width, int height);
+	void drawMesh(Shader& shader, unsigned int mesh);
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <vector>
+
+// Passes of the main view timed on the GPU, to compare the forward and deferred paths
+enum class TimedPass
+{
+	Forward,	// Depth prepass, opaque and sky of the forward path
+	Geometry,	// Depth prepass and opaque surfaces into the G-buffer
+	Lighting,	// Fullscreen lighting pass and depth copy
+	Count
+};
+
+// GPU time of a frame a few frames back, read without waiting. Timers the frame did not run are zero.
+struct GpuPassTimes
+{
+	std::vector<float> ms;			// One entry per timer
+	float totalMs = 0.0f;
+	unsigned int tag = 0;			// setFrameTag of that frame
+};
+
+// Ring of GL_TIME_ELAPSED queries, one set of timers per frame in flight. A frame's results are read when
+// its ring slot comes around again, usually long finished by then, so reading never stalls. Used for the
+// main passes, the shadow cascades and the shadow atlas. Only one timer runs at a time, time elapsed
+// queries do not nest.
+class GpuPassTimers
+{
+public:
+	// At most 32 timers
+	explicit GpuPassTimers(unsigned int timerCount = (unsigned int)TimedPass::Count);
+	~GpuPassTimers();
+
+	GpuPassTimers(const GpuPassTimers&) = delete;
+	GpuPassTimers& operator=(const GpuPassTimers&) = delete;
+
+	// Moves to the next ring slot and reads its queries if they finished, call once per frame before the timers
+	void beginFrame();
+
+	void begin(unsigned int timer);
+	void begin(TimedPass pass) { begin((unsigned int)pass); }
+	void end();
+
+	// Returned with this frame's times, e.g. what the timed passes drew
+	void setFrameTag(unsigned int tag) { frameTag[frame] = tag; }
+
+	const GpuPassTimes& times() const { return lastTimes; }
+
+	// Delete the queries
+	void Delete();
+
+private:
+	static const unsigned int STATS_FRAMES = 3;
+
+	unsigned int timerCount;
+	std::vector<GLuint> queries;				// STATS_FRAMES sets of timerCount
+	unsigned int queryMask[STATS_FRAMES] = {};	// Bit per timer run in that frame
+	unsigned int frameTag[STATS_FRAMES] = {};
+	unsigned int statsFrame = 0;
+	unsigned int frame = 0;
+	bool timing = false;
+	GpuPassTimes lastTimes;
+
+	GLuint query(unsigned int frame, unsigned int timer) const { return queries[frame * timerCount + timer]; }
+	void readTimes(unsigned int frame);
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit FNV-1a, used for cache keys and asset lookups
+const uint64_t HASH_SEED = 14695981039346656037ull;
+const uint64_t HASH_PRIME = 1099511628211ull;
+
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = HASH_SEED)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= HASH_PRIME;
+	}
+	return hash;
+}
+
+inline uint64_t HashString(const std::string& str, uint64_t seed = HASH_SEED)
+{
+	return HashBytes(str.data(), str.size(), seed);
+}
+
+// Compile-time FNV-1a of a string literal, equal to HashString of the same text
+constexpr uint64_t HashLiteral(const char* str, uint64_t hash = HASH_SEED)
+{
+	while (*str)
+	{
+		hash ^= (unsigned char)*str++;
+		hash *= HASH_PRIME;
+	}
+	return hash;
+}
+
+template<typename T>
+inline uint64_t HashValue(const T& value, uint64_t seed = HASH_SEED)
+{
+	return HashBytes(&value, sizeof(T), seed);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include <vector>
+
+// SSBO binding point default.vert reads the instances from
+const GLuint INSTANCE_BUFFER_BINDING = 0;
+
+// std430 layout of one instance, the normal matrix is a mat4 to avoid mat3 padding rules
+struct InstanceData
+{
+	glm::mat4 model;
+	glm::mat4 normalMatrix;
+};
+
+// Per-instance transforms for Model::SubmitInstanced and the shadow casters, rebuilt on the CPU and uploaded once per frame
+class InstanceBuffer
+{
+public:
+	InstanceBuffer();
+	~InstanceBuffer();
+
+	InstanceBuffer(const InstanceBuffer&) = delete;
+	InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+	void clear();
+	void reserve(size_t count);
+
+	// Adds an instance, its normal matrix is derived from the model matrix
+	void add(const glm::mat4& model);
+
+	// Copies the instances to the GPU, the storage is orphaned so frames in flight are not stalled on
+	void upload();
+
+	// Binds the buffer to INSTANCE_BUFFER_BINDING
+	void bind() const;
+
+	size_t size() const { return instances.size(); }
+	const InstanceData* data() const { return instances.data(); }
+	bool empty() const { return instances.empty(); }
+
+	void Delete();
+
+private:
+	GLuint SSBO;
+	size_t capacity;
+	std::vector<InstanceData> instances;
+};
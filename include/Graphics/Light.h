@@ -1,58 +1,136 @@
 #pragma once
 
+#include <glad/glad.h>
 #include <glm/glm/glm.hpp>
 #include <vector>
-#include <memory>
 
-#include "Graphics/Shader.h"
+// Shader storage binding point of the Lights block in default.frag
+const GLuint LIGHT_BUFFER_BINDING = 1;
 
-class Light {
-public:
-    glm::vec3 color;
-    
-    Light(const glm::vec3& color);
-    virtual ~Light();
+// Contribution below which a light is treated as out of range, relative to its brightest channel
+const float LIGHT_CUTOFF = 1.0f / 256.0f;
 
-    virtual void SendToShader(Shader& shader, const std::string& name) = 0;
+// Matches the type field of GpuLight
+enum class LightType : int {
+    Directional = 0,
+    Point = 1,
+    Spot = 2
 };
 
-class DirectionalLight : public Light {
-public:
+// std430 layout of one light in the Lights block, fields a light type does not use are zero
+struct GpuLight {
+    glm::vec4 color;        // rgb = color, w = LightType
+    glm::vec4 position;     // xyz = position
+    glm::vec4 direction;    // xyz = direction, w = first ShadowAtlas tile + 1, 0 without a shadow
+    glm::vec4 params;       // Point: constant, linear, quadratic; Spot: cutOff, outerCutOff; w = range
+};
+
+// Distance at which constant/linear/quadratic attenuation drops the light below LIGHT_CUTOFF
+float LightRange(const glm::vec3& color, float constant, float linear, float quadratic);
+
+// Parameters of a light, LightManager stores them packed by type
+struct DirectionalLight {
+    glm::vec3 color;
     glm::vec3 direction;
 
     DirectionalLight(const glm::vec3& color, const glm::vec3& direction);
-    void SendToShader(Shader& shader, const std::string& name) override;
+    GpuLight Pack() const;
 };
 
-class PointLight : public Light {
-public:
+struct PointLight {
+    glm::vec3 color;
     glm::vec3 position;
     float constant;
     float linear;
     float quadratic;
 
     PointLight(const glm::vec3& color, const glm::vec3& position, float constant, float linear, float quadratic);
-    void SendToShader(Shader& shader, const std::string& name) override;
+    GpuLight Pack() const;
 };
 
-class SpotLight : public Light {
-public:
+struct SpotLight {
+    glm::vec3 color;
     glm::vec3 position;
     glm::vec3 direction;
     float cutOff;
     float outerCutOff;
 
     SpotLight(const glm::vec3& color, const glm::vec3& position, const glm::vec3& direction, float cutOff, float outerCutOff);
-    void SendToShader(Shader& shader, const std::string& name) override;
+    GpuLight Pack() const;
 };
 
+// Stable id of a light in a LightManager, valid until the light is removed
+typedef unsigned int LightHandle;
+const LightHandle NO_LIGHT = ~0u;
+
+// Lights kept in the order of the light buffer: directional, then point, then spot lights, each type
+// contiguous and already in its shader layout. Adding or removing moves at most one light per type,
+// setters flag the light and upload() only sends the flagged lights.
 class LightManager {
 public:
-    std::vector<std::shared_ptr<Light>> lights;
-
     LightManager();
     ~LightManager();
 
-    void addLight(std::shared_ptr<Light> light);
-    void removeLight(std::shared_ptr<Light> light);
-};
\ No newline at end of file
+    LightManager(const LightManager&) = delete;
+    LightManager& operator=(const LightManager&) = delete;
+
+    LightHandle addLight(const DirectionalLight& light);
+    LightHandle addLight(const PointLight& light);
+    LightHandle addLight(const SpotLight& light);
+    void removeLight(LightHandle light);
+
+    LightType type(LightHandle light) const { return (LightType)(int)gpuLights[slots[light]].color.w; }
+    const GpuLight& get(LightHandle light) const { return gpuLights[slots[light]]; }
+
+    // Setters of the fields a type uses, the range follows color and attenuation
+    void setColor(LightHandle light, const glm::vec3& color);
+    void setPosition(LightHandle light, const glm::vec3& position);
+    void setDirection(LightHandle light, const glm::vec3& direction);
+    void setAttenuation(LightHandle light, float constant, float linear, float quadratic);
+    void setCutOff(LightHandle light, float cutOff, float outerCutOff);
+
+    // First tile of the light's shadow in the shadow tile buffer, -1 for none (ShadowAtlas)
+    void setShadowTile(LightHandle light, int tile);
+
+    size_t size() const { return gpuLights.size(); }
+
+    // Sends the lights changed since the last upload, or everything once the buffer has to grow,
+    // and binds the light buffer to LIGHT_BUFFER_BINDING. Call before the frame's draws.
+    void upload();
+
+    // Lights of a type
+    unsigned int count(LightType type) const { return typeEnd[(int)type] - typeBegin(type); }
+
+    // Lights in buffer order
+    const std::vector<GpuLight>& packed() const { return gpuLights; }
+
+    // Lights the last upload sent
+    unsigned int lastUploadCount() const { return uploadedCount; }
+
+    void Delete();
+
+private:
+    GLuint SSBO;
+    size_t capacity;
+
+    // Buffer order, index i holds the light of handle ids[i]
+    std::vector<GpuLight> gpuLights;
+    std::vector<LightHandle> ids;
+    std::vector<unsigned char> dirty;
+    std::vector<unsigned int> dirtyList;
+    bool headerDirty;
+    unsigned int uploadedCount;
+
+    // Index of every handle, NO_LIGHT for free handles
+    std::vector<unsigned int> slots;
+    std::vector<LightHandle> freeHandles;
+
+    // One past the last light of each type
+    unsigned int typeEnd[3];
+
+    unsigned int typeBegin(LightType type) const { return type == LightType::Directional ? 0 : typeEnd[(int)type - 1]; }
+    LightHandle insert(const GpuLight& light);
+    void move(unsigned int from, unsigned int to);
+    void markDirty(unsigned int index);
+    GpuLight& edit(LightHandle light);
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "Graphics/Texture.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TextureStreamer;
+
+// Uniform buffer binding of the material table, and the first of the units holding the texture arrays
+const unsigned int MATERIAL_BUFFER_BINDING = 1;
+const unsigned int MATERIAL_TEXTURE_UNIT = 0;
+
+// Must match default.frag
+const unsigned int MAX_MATERIALS = 256;
+const unsigned int MAX_MATERIAL_TEXTURE_ARRAYS = 8;
+
+// Reserved neutral entry: white, untextured, never released. Meshes without a material of their own draw with it.
+const unsigned int NO_MATERIAL = 0;
+
+// Texture slots a material samples, in the order of GpuMaterial's arrays/layers components
+enum MaterialSlot : unsigned int
+{
+	MATERIAL_SLOT_DIFFUSE = 0,
+	MATERIAL_SLOT_SPECULAR,
+	MATERIAL_SLOT_NORMAL,
+	MATERIAL_SLOT_AMBIENT_OCCLUSION,
+	MATERIAL_SLOT_COUNT
+};
+
+// Slot of a texture type, MATERIAL_SLOT_COUNT for types the shader does not sample
+MaterialSlot MaterialSlotFromType(const std::string& textureType);
+
+// std140 layout of one material, 48 bytes
+struct GpuMaterial
+{
+	glm::vec4 color;	// rgb = color, a = shininess
+	glm::ivec4 arrays;	// Texture array per slot, -1 while the texture is not resident (the shader uses a default)
+	glm::ivec4 layers;	// Layer in that array
+};
+
+// Materials shared by every mesh with the same texture set. Parameters live in one uniform buffer and
+// textures are copied into GL_TEXTURE_2D_ARRAYs grouped by size, format and mip count, so a draw only
+// sets the material index; update() binds the buffer and the arrays once per frame. GL thread only.
+class MaterialLibrary
+{
+public:
+	// Process-wide library, Delete() it before the context goes away
+	static MaterialLibrary& Shared();
+
+	MaterialLibrary();
+
+	MaterialLibrary(const MaterialLibrary&) = delete;
+	MaterialLibrary& operator=(const MaterialLibrary&) = delete;
+
+	// Returns the material for a texture set, counted; meshes with the same textures share one.
+	// directory and gamma identify the images the same way the asset manager does. NO_MATERIAL when the table is full.
+	unsigned int acquire(const std::vector<Texture>& textures, const std::string& directory, bool gamma);
+	void release(unsigned int material);
+
+	// The parameters of NO_MATERIAL are fixed, setting them does nothing
+	void setColor(unsigned int material, const glm::vec3& color);
+	void setShininess(unsigned int material, float shininess);
+
+	// Every texture of the material has been copied into its array, the source textures are no longer needed
+	bool isResident(unsigned int material) const;
+
+	// GL thread, once per frame: copies textures that finished streaming, uploads changed materials and binds everything
+	void update(const TextureStreamer* streamer = nullptr);
+
+	size_t materialCount() const { return byKey.size(); }	// Without NO_MATERIAL
+	size_t arrayCount() const { return arrays.size(); }
+
+	// Delete the buffer and the texture arrays
+	void Delete();
+
+private:
+	struct Entry
+	{
+		uint64_t key;
+		unsigned int refCount;
+		bool resident;
+		GLuint textures[MATERIAL_SLOT_COUNT];	// Source textures, 0 for an empty slot
+		uint64_t sources[MATERIAL_SLOT_COUNT];	// Image keys of the sources
+	};
+
+	// Array layer holding one image, shared by every material using it
+	struct Layer
+	{
+		unsigned int array;
+		unsigned int layer;
+		unsigned int refCount;
+	};
+
+	struct TextureArray
+	{
+		GLuint id;
+		GLsizei width;
+		GLsizei height;
+		GLenum format;
+		GLsizei levels;
+		unsigned int capacity;
+		unsigned int used;
+		std::vector<unsigned int> freeLayers;
+	};
+
+	std::vector<Entry> entries;
+	std::vector<GpuMaterial> materials;
+	std::vector<unsigned int> freeEntries;
+	std::unordered_map<uint64_t, unsigned int> byKey;	// Texture set -> material
+	std::unordered_map<uint64_t, Layer> layers;			// Image -> layer
+	std::vector<TextureArray> arrays;
+	GLuint buffer;
+	bool dirty;
+
+	// Puts NO_MATERIAL into the empty table
+	void reserveDefault();
+
+	// Finds or fills the layer of a slot's image, false if the source is still streaming
+	bool resolve(Entry& entry, unsigned int slot, GpuMaterial& material, const TextureStreamer* streamer);
+
+	// Copies every mip level of a texture into a free layer of the matching array
+	bool copyToLayer(GLuint texture, Layer& layer);
+	unsigned int findArray(GLsizei width, GLsizei height, GLenum format, GLsizei levels);
+	void grow(TextureArray& array, unsigned int capacity);
+	void releaseLayer(uint64_t source);
+};
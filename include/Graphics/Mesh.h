@@ -5,25 +5,29 @@
 #include <glm/glm/gtc/matrix_transform.hpp>
 
 #include "Graphics/Camera.h"
+#include "Graphics/GeometryPool.h"
+#include "Graphics/Material.h"
+#include "Graphics/MeshSimplifier.h"
 #include "Graphics/Texture.h"
+#include "Graphics/VertexFormat.h"
 
 #include <vector>
 #include <string>
 using namespace std;
 
-#define MAX_BONE_INFLUENCE 4 // Max number of bones that can influence a vertex
-
-struct Vertex {
-	glm::vec3 Position;
-	glm::vec3 Normal;
-	glm::vec2 TexCoords;
-	glm::vec3 Tangent;
-	glm::vec3 Bitangent;
+// Material texture reference, resolved to a GL texture on the GL thread
+struct TextureRef {
+	string textureType;
+	string path;
+};
 
-	// Bone IDs which will influence this vertex
-	int m_BoneIDs[MAX_BONE_INFLUENCE];
-	// weigths of the bones
-	float m_Weights[MAX_BONE_INFLUENCE];
+// CPU-side mesh as produced by the importer, safe to build on worker threads
+struct MeshData {
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	vector<TextureRef> textures;
+	vector<MeshLod> lods;	// Index ranges of the detail levels, empty if indices only hold level 0
+	VertexLayout layout = VertexLayout::Static;
 };
 
 
@@ -32,20 +36,54 @@ class Mesh {
 public:
 
 	vector<Vertex> vertices;
-	vector<unsigned int> indices;
+	vector<unsigned int> indices;	// Every detail level back to back
 	vector<Texture> textures;
+	vector<MeshLod> lods;
+	glm::vec3 boundsMin;			// Bounding box in model space
+	glm::vec3 boundsMax;
+	glm::vec3 boundsCenter;			// Bounding sphere in model space
+	float boundsRadius;
 	unsigned int VAO;
+	unsigned int positionVAO;	// Position-only stream for depth passes, the full VAO for meshes outside a pool
+	unsigned int vertexCount;
+	unsigned int indexCount;
+	GLenum indexType;	// GL_UNSIGNED_SHORT below 65536 vertices
+	VertexLayout layout;
+	unsigned int features;	// ShaderFeature bits of the textures, picks the shader permutation
+	unsigned int material = NO_MATERIAL;	// MaterialLibrary entry, acquired and released by the owner
+	bool pooled = false;		// Vertices and indices live in the GeometryPool of the layout and index type, VAO is the pool's
+	GLint baseVertex = 0;		// Offsets into the pool, 0 for meshes with their own buffers
+	GLuint firstIndex = 0;
+
+	// Constructor, vertices are converted to the given GPU layout on upload
+	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, VertexLayout layout = VertexLayout::Static, vector<MeshLod> lods = vector<MeshLod>());
 
-	// Constructor
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures);
+	// Constructor for vertex/index blobs already in the GPU layout (e.g. a mapped mesh cache), uploaded without keeping a CPU copy
+	Mesh(const void* vertexData, unsigned int vertexCount, VertexLayout layout, const void* indexData, unsigned int indexCount, GLenum indexType, vector<Texture> textures, vector<MeshLod> lods);
 
-    // render the mesh
-    void Draw(Shader& shader);
+    // render the mesh, lod is clamped to the available levels
+    void Draw(Shader& shader, unsigned int lod = 0);
+
+    // render instanceCount copies, the shader has to read the per-instance data itself
+    void DrawInstanced(Shader& shader, unsigned int instanceCount, unsigned int lod = 0);
+
+    // Multi-draw command for a detail level, baseInstance is left at 0
+    DrawElementsIndirectCommand IndirectCommand(unsigned int lod, unsigned int instanceCount = 1) const;
+
+    // Selects the material and sets the per-mesh uniforms, the material textures are bound by MaterialLibrary::update.
+    // Also called once per multi-draw batch, every mesh of a batch shares the material and layout.
+    void bindMaterial(Shader& shader);
+
+    // delete the buffer objects/arrays
+    void Delete();
 
 private:
     // render data 
     unsigned int VBO, EBO;
 
     // initializes all the buffer objects/arrays
-	void setupMesh();
+	void setupMesh(const void* vertexData, const void* indexData);
+
+	// Bounding box and sphere around the positions, which lead every vertex layout
+	void computeBounds(const void* vertexData);
 };
\ No newline at end of file
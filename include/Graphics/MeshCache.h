@@ -0,0 +1,151 @@
+#pragma once
+
+#include "Graphics/Mesh.h"
+#include "Graphics/SceneGraph.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+
+	const unsigned char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const unsigned char* bytes;
+	size_t length;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fileDescriptor;
+#endif
+};
+
+// Cooked mesh file (.fmesh)
+// Layout: FileHeader | MeshRecord[meshCount] | TextureRecord[textureCount] | LodRecord[lodCount] | NodeRecord[nodeCount] | string table | vertex/index blobs
+// Blobs are 16-byte aligned so they can be handed to glBufferData straight from the mapping.
+namespace CookedMesh
+{
+	const uint32_t MAGIC = 0x48534D46; // "FMSH"
+	const uint32_t VERSION = 5;
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t importFlags;
+		uint32_t vertexLayout;	// Layout requested at import, skinned meshes keep the full layout
+		uint32_t meshCount;
+		uint32_t textureCount;
+		uint32_t lodCount;
+		uint32_t nodeCount;
+		uint64_t stringTableOffset;
+		uint64_t stringTableSize;
+	};
+
+	struct MeshRecord
+	{
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t firstTexture;
+		uint32_t textureCount;
+		uint32_t vertexLayout;
+		uint32_t vertexStride;
+		uint32_t indexSize;		// 2 or 4 bytes
+		uint32_t firstLod;
+		uint32_t lodCount;
+		uint32_t node;			// Scene node the mesh hangs off
+	};
+
+	struct TextureRecord
+	{
+		uint32_t typeOffset;
+		uint32_t typeLength;
+		uint32_t pathOffset;
+		uint32_t pathLength;
+	};
+
+	// Index range of a detail level, relative to the mesh's index blob
+	struct LodRecord
+	{
+		uint32_t indexOffset;
+		uint32_t indexCount;
+		float error;
+		uint32_t reserved;
+	};
+
+	// Scene node in parent-before-child order
+	struct NodeRecord
+	{
+		float local[16];		// Column major
+		uint32_t parent;		// NO_NODE for roots
+		uint32_t nameOffset;
+		uint32_t nameLength;
+		uint32_t reserved;
+	};
+}
+
+// View into one mesh of a mapped cache file; pointers are valid while the cache is open
+struct CookedMeshView
+{
+	const void* vertices;	// In the GPU layout given by vertexLayout
+	unsigned int vertexCount;
+	VertexLayout vertexLayout;
+	const void* indices;	// In the GPU type given by indexType
+	unsigned int indexCount;
+	GLenum indexType;
+	std::vector<TextureRef> textures;
+	std::vector<MeshLod> lods;
+	unsigned int node;
+};
+
+class MeshCache
+{
+public:
+	// Hash of the source file contents, 0 if it cannot be read
+	static uint64_t HashFile(const std::string& path);
+
+	// Cache file that belongs to a source model
+	static std::string CachePath(const std::string& sourcePath);
+
+	// Write the meshes of a freshly imported model, meshNodes holds the scene node of every mesh
+	static bool Write(const std::string& cachePath, uint64_t sourceHash, unsigned int importFlags, VertexLayout layout, const std::vector<Mesh>& meshes,
+		const SceneGraph& nodes, const std::vector<unsigned int>& meshNodes);
+
+	// Map a cache file, fails if it is missing, corrupt or was cooked from another source/flags/layout
+	bool open(const std::string& cachePath, uint64_t sourceHash, unsigned int importFlags, VertexLayout layout);
+	void close();
+
+	unsigned int meshCount() const;
+	CookedMeshView mesh(unsigned int index) const;
+
+	// Rebuilds the node hierarchy the meshes were cooked with
+	void loadNodes(SceneGraph& nodes) const;
+
+private:
+	MappedFile file;
+	const CookedMesh::FileHeader* header = nullptr;
+	const CookedMesh::MeshRecord* records = nullptr;
+	const CookedMesh::TextureRecord* textureRecords = nullptr;
+	const CookedMesh::LodRecord* lodRecords = nullptr;
+	const CookedMesh::NodeRecord* nodeRecords = nullptr;
+	const char* strings = nullptr;
+
+	bool validate() const;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Graphics/VertexFormat.h"
+
+#include <cstddef>
+#include <vector>
+
+// Post-transform vertex cache size the triangle order is tuned for and ACMR is measured with
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// Clusters may lose this much ACMR to let the overdraw pass reorder them
+const float OVERDRAW_THRESHOLD = 1.05f;
+
+// Result of OptimizeMesh, ACMR = transformed vertices per triangle (0.5 best, 3.0 worst)
+struct MeshOptimizeStats
+{
+	unsigned int verticesBefore = 0;	// As imported
+	unsigned int verticesAfter = 0;		// After welding
+	unsigned int triangleCount = 0;
+	float acmrBefore = 0.0f;			// Welded mesh in import order
+	float acmrAfter = 0.0f;
+};
+
+// Runs every pass below in order: weld, vertex cache, overdraw, vertex fetch
+MeshOptimizeStats OptimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+// Merges bit-identical vertices and rewrites the indices to match
+void WeldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+// Tipsify triangle reordering for post-transform cache hits.
+// Fills clusters with the first triangle of every cluster the overdraw pass may reorder.
+void OptimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, std::vector<unsigned int>* clusters = nullptr, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// Sorts the clusters so outward facing ones are drawn first, clusters are split further while ACMR stays within threshold
+void OptimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& clusters, float threshold = OVERDRAW_THRESHOLD, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorders the vertices by first use so fetches walk the vertex buffer linearly, unused vertices are dropped
+void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+// Average cache miss ratio of a FIFO post-transform cache
+float ComputeACMR(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE);
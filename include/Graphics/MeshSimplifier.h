@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Graphics/VertexFormat.h"
+
+#include <cstddef>
+#include <vector>
+
+// Number of detail levels per mesh, level 0 is the full mesh
+const unsigned int MAX_LOD_LEVELS = 4;
+
+// Triangle count of each level relative to the previous one
+const float LOD_REDUCTION = 0.5f;
+
+// Index range of one detail level inside the mesh's index buffer
+struct MeshLod
+{
+	unsigned int indexOffset;
+	unsigned int indexCount;
+	float error;	// Largest deviation from level 0, in model units
+};
+
+// Quadric error edge collapse simplification down to targetIndexCount indices.
+// Vertices are collapsed onto existing ones so every level shares the vertex buffer;
+// borders and attribute seams are kept. Returns the error of the result in model units.
+float SimplifyMesh(const std::vector<Vertex>& vertices, const unsigned int* indices, size_t indexCount, size_t targetIndexCount, std::vector<unsigned int>& result);
+
+// Appends MAX_LOD_LEVELS - 1 simplified levels to indices and fills lods with every level's range.
+// Levels the simplifier cannot reduce further repeat the previous range, so every mesh has the same level count.
+void GenerateLods(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, std::vector<MeshLod>& lods);
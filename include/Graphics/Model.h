@@ -8,41 +8,137 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "Graphics/AssetHandle.h"
+#include "Graphics/InstanceBuffer.h"
 #include "Graphics/Mesh.h"
+#include "Graphics/MeshCache.h"
+#include "Graphics/MeshOptimizer.h"
+#include "Graphics/RenderQueue.h"
+#include "Graphics/RenderView.h"
+#include "Graphics/SceneGraph.h"
 #include "Graphics/Shader.h"
+#include "Graphics/ShaderPermutations.h"
+#include "Graphics/ThreadPool.h"
 
+#include <algorithm>
+#include <chrono>
 #include <string>
 #include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 using namespace std;
 
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
 
+// Wall-clock time spent in each loading phase, in milliseconds
+struct ModelLoadStats
+{
+	double cacheMs = 0.0;		// Hashing the source and mapping the cooked mesh file
+	double importMs = 0.0;		// Assimp::Importer::ReadFile
+	double convertMs = 0.0;		// aiMesh -> MeshData, mesh optimization and LODs on the worker pool
+	double textureMs = 0.0;		// Texture loading on the GL thread
+	double uploadMs = 0.0;		// VAO/VBO/EBO creation on the GL thread
+	double cacheWriteMs = 0.0;	// Writing the cooked mesh file
+	unsigned int meshCount = 0;
+	unsigned int workerCount = 0;
+	MeshOptimizeStats optimize;	// Summed over all meshes, ACMR weighted by triangle count
+	bool fromCache = false;
+};
+
 class Model
 {
 	public:
 
-		vector<Texture> textures_loaded;
+		unordered_map<string, Texture> textures_loaded;
 		vector<Mesh> meshes;
 		string directory;
+
+		// Assimp node hierarchy, every mesh is drawn with the world matrix of its node.
+		// Models from the asset manager are shared, so changing a node moves it in every user.
+		SceneGraph nodes;
+		vector<unsigned int> meshNodes;
 		bool gammaCorrection;
+		VertexLayout vertexLayout;	// GPU layout of meshes without bones
+		ModelLoadStats loadStats;
+
+		// Bounds in model space (node transforms at load applied) and the error of each detail level over all meshes
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		glm::vec3 boundsCenter;
+		float boundsRadius;
+		vector<float> lodErrors;
+
+		// Constructor, textures are shared through the asset manager when one is given
+		Model(std::string const& path, bool gamma = false, AssetManager* assets = nullptr, VertexLayout layout = VertexLayout::Static);
+
+		// Draw the model with the caller's model matrix, node transforms are not applied
+		void Draw(Shader& shader);
+
+		// Queue the meshes with the detail level picked from the model's projected size.
+		// lod is the level this instance used last frame, it is updated for the hysteresis of the next one.
+		// visible holds one flag per mesh, e.g. FrustumCuller::visibleFlags() from the index AddToCuller returned.
+		// Each mesh uses the variant for its textures, permutation supplies the light counts.
+		// pass is RenderPass::DepthPrepass for the depth-only copy of an opaque submit.
+		void Submit(RenderQueue& queue, ShaderPermutations& shaders, ShaderPermutation permutation, const RenderView& view, const glm::mat4& transform, unsigned int& lod, const unsigned char* visible = nullptr, RenderPass pass = RenderPass::Opaque);
+
+		// Queue one instanced draw per mesh for every instance of the buffer, the buffer must be uploaded
+		// and stay alive until the queue executes. depth is the view distance of the nearest instance.
+		void SubmitInstanced(RenderQueue& queue, ShaderPermutations& shaders, ShaderPermutation permutation, const InstanceBuffer& instances, unsigned int lod, float depth, RenderPass pass = RenderPass::Opaque);
+
+		// Tints every material of the model, materials are shared with other meshes using the same textures
+		void SetColor(const glm::vec3& color);
+
+		// Adds the world bounds of every mesh, returns the index of the first one
+		unsigned int AddToCuller(FrustumCuller& culler, const glm::mat4& transform);
 
-		// Constructor
-		Model(std::string const& path, bool gamma = false);
+		// Coarsest level whose error stays below LOD_PIXEL_ERROR on screen
+		unsigned int SelectLod(const RenderView& view, const glm::mat4& transform, unsigned int currentLod) const;
 
-		// Draw the model
-		void Draw(Shader shader);
+		// Transform of a mesh's node, identity for meshes without one
+		const glm::mat4& meshTransform(unsigned int mesh) const;
+
+		// Delete the GL buffers and drop the texture references
+		void Delete();
 
 	private:
 
+		AssetManager* assets;
+		vector<TextureHandle> textureHandles;
+		bool texturesReleased = false;	// Every material is resident, the texture arrays hold the only copy
+
+		// Assimp post-processing steps, part of the cooked mesh cache key
+		static const unsigned int importFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
 		void loadModel(string const& path);
 
-		void processNode(aiNode* node, const aiScene* scene);
+		void loadCooked(const MeshCache& cache);
+
+		// Model bounds and level errors from the loaded meshes
+		void computeLodInfo();
+
+		// Collects the meshes in depth-first node order, this order is the final mesh order
+		void processNode(aiNode* node, const aiScene* scene, vector<const aiMesh*>& sceneMeshes, unsigned int parent);
+
+		// Drops the source textures once the material library has copied all of them into its arrays
+		void releaseCopiedTextures();
+		void releaseSourceTextures();
+
+		// Variant for a mesh's material features
+		Shader& variantFor(ShaderPermutations& shaders, ShaderPermutation& permutation, unsigned int mesh);
+
+		// CPU-only conversion, runs on worker threads
+		static MeshData processMesh(const aiMesh* mesh, const aiScene* scene, VertexLayout layout);
+
+		// Fills the bone ids and weights, the strongest MAX_BONE_INFLUENCE bones are kept per vertex
+		static void processBones(const aiMesh* mesh, vector<Vertex>& vertices);
+
+		static void loadMaterialTextures(const aiMaterial* mat, aiTextureType type, const string& typeName, vector<TextureRef>& textures);
 
-		Mesh processMesh(aiMesh* mesh, const aiScene* scene);
+		// GL thread: resolves texture references and creates the buffers
+		void uploadMeshes(vector<MeshData>& meshData);
 
-		vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName);
+		Texture loadTexture(const string& path, const string& typeName);
 };
\ No newline at end of file
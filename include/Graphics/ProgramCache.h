@@ -0,0 +1,45 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <string>
+
+// Linked program binary file (.fprog)
+// Layout: FileHeader | program binary
+namespace CookedProgram
+{
+	const uint32_t MAGIC = 0x47525046; // "FPRG"
+	const uint32_t VERSION = 1;
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;			// Sources, defines and driver, see ProgramCache::Key
+		uint32_t binaryFormat;
+		uint32_t binarySize;
+		double compileMs;		// Time the source compile took, to report what a hit saved
+	};
+}
+
+// On-disk cache of linked programs through glGetProgramBinary/glProgramBinary.
+// A binary is only valid for the driver that produced it, so the driver strings are part of the key.
+class ProgramCache
+{
+public:
+	// One cache file per program and define set, e.g. shaders/default.vert.0123456789abcdef.fprog
+	static std::string CachePath(const std::string& vertexPath, const std::string& fragmentPath, const std::string& defines);
+
+	// Hash of both sources, the defines and GL_VENDOR/GL_RENDERER/GL_VERSION
+	static uint64_t Key(const std::string& vertexCode, const std::string& fragmentCode, const std::string& defines);
+
+	// Returns a linked program, or 0 if there is no matching binary or the driver rejects it
+	static GLuint Load(const std::string& cachePath, uint64_t key, double& compileMs);
+
+	// Stores a linked program, it has to be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+	static bool Write(const std::string& cachePath, uint64_t key, GLuint program, double compileMs);
+
+	// False if the driver supports no binary formats
+	static bool Supported();
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <glm/glm/glm.hpp>
+
+#include "Graphics/InstanceBuffer.h"
+#include "Graphics/Mesh.h"
+#include "Graphics/RenderView.h"
+#include "Graphics/Shader.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Passes run in this order, each sets its own fixed function state
+enum class RenderPass : unsigned int
+{
+	DepthPrepass = 0,	// Depth only, color writes off
+	Opaque = 1,			// Depth GL_LESS, front to back within a state group; GL_LEQUAL without depth writes after a prepass
+	Sky = 2				// Depth GL_LEQUAL, after the opaque pass so only uncovered pixels are shaded
+};
+
+// Sort key, most significant first:
+// pass (2) | shader (10) | material (16) | vertex array (12) | depth (24).
+// Shader and vertex array are truncated GL names, a collision only costs a redundant bind.
+namespace RenderKey
+{
+	const unsigned int PASS_BITS = 2;
+	const unsigned int SHADER_BITS = 10;
+	const unsigned int MATERIAL_BITS = 16;
+	const unsigned int VERTEX_ARRAY_BITS = 12;
+	const unsigned int DEPTH_BITS = 24;
+
+	uint64_t Make(RenderPass pass, unsigned int program, unsigned int material, unsigned int vertexArray, float depth);
+}
+
+// One draw, instances == nullptr draws a single copy with transform as the model matrix,
+// otherwise transform is the node transform under every instance
+struct DrawCommand
+{
+	Shader* shader;
+	Mesh* mesh;
+	unsigned int lod;
+	glm::mat4 transform;
+	const InstanceBuffer* instances;
+	int custom;		// Index of a custom draw, -1 for a mesh
+};
+
+// SSBO binding point default.vert reads the per-draw data of a multi-draw from
+const GLuint DRAW_DATA_BINDING = 2;
+
+// default.vert input holding the index into that data. GL 4.5 has no gl_DrawID, so every command
+// carries its index as baseInstance and this attribute reads it back from a 0, 1, 2, ... buffer.
+const GLuint DRAW_INDEX_ATTRIBUTE = 9;
+
+// std430 layout of one multi-draw entry
+struct DrawData
+{
+	glm::mat4 model;			// Node transform for instanced draws
+	glm::mat4 normalMatrix;
+	glm::uvec4 params;			// x = first instance in the frame's instance buffer, y = 1 if instanced
+};
+
+// Counters of the last execute
+struct RenderQueueStats
+{
+	unsigned int commands = 0;
+	unsigned int programChanges = 0;
+	unsigned int drawCalls = 0;		// GL draw calls, a multi-draw counts once
+};
+
+// Collects a frame's draws, sorts them by key and executes them with as few state changes as the order allows
+class RenderQueue
+{
+public:
+	// Pooled meshes that share pass, shader, material and vertex array are drawn with one
+	// glMultiDrawElementsIndirect, the draw count then only grows with the number of materials
+	bool multiDraw = true;
+
+	RenderQueue() = default;
+
+	RenderQueue(const RenderQueue&) = delete;
+	RenderQueue& operator=(const RenderQueue&) = delete;
+
+	// Starts a frame, depths are quantized over [0, view far plane]
+	void begin(const RenderView& view);
+
+	void submit(RenderPass pass, Shader& shader, Mesh& mesh, unsigned int lod, const glm::mat4& transform);
+	void submitInstanced(RenderPass pass, Shader& shader, Mesh& mesh, unsigned int lod, const InstanceBuffer& instances, const glm::mat4& nodeTransform, float depth);
+
+	// Draw outside of the Mesh path, e.g. the skybox; the shader is bound before draw is called
+	void submitCustom(RenderPass pass, Shader& shader, float depth, std::function<void(Shader&)> draw);
+
+	// Radix sorts the keys and draws everything, the queue is empty afterwards
+	void execute();
+
+	// Draws only the passes from first to last and keeps the queue, so other passes can follow
+	// after work outside the queue (e.g. deferred lighting before the sky). begin() empties it.
+	void executePasses(RenderPass first, RenderPass last);
+
+	// Distance of a world position along the view direction, the depth submitInstanced and submitCustom expect
+	float viewDepth(const glm::vec3& position) const;
+
+	size_t size() const { return commands.size(); }
+	const RenderQueueStats& stats() const { return queueStats; }
+
+	// Delete the multi-draw buffers
+	void Delete();
+
+private:
+	struct SortItem
+	{
+		uint64_t key;
+		unsigned int command;
+	};
+
+	// Sorted items drawn by one multi-draw
+	struct Batch
+	{
+		size_t firstItem;
+		size_t itemCount;
+		size_t firstCommand;
+	};
+
+	// GPU buffer that grows geometrically and is orphaned on every upload
+	struct StreamBuffer
+	{
+		GLuint id = 0;
+		size_t capacity = 0;
+
+		void upload(GLenum target, const void* data, size_t size);
+		void Delete();
+	};
+
+	glm::vec3 viewPosition = glm::vec3(0.0f);
+	glm::vec3 viewForward = glm::vec3(0.0f, 0.0f, -1.0f);
+	float depthRange = 1.0f;
+	bool prepared = false;		// Items are sorted and batched
+	bool depthPrepass = false;	// The sorted items start with a depth prepass
+
+	std::vector<DrawCommand> commands;
+	std::vector<std::function<void(Shader&)>> customDraws;
+	std::vector<SortItem> items;
+	std::vector<SortItem> scratch;
+	RenderQueueStats queueStats;
+
+	std::vector<Batch> batches;
+	std::vector<DrawElementsIndirectCommand> indirectCommands;
+	std::vector<DrawData> drawData;
+	std::vector<InstanceData> frameInstances;	// Instances of every batched instanced draw, back to back
+	StreamBuffer indirectBuffer;
+	StreamBuffer drawDataBuffer;
+	StreamBuffer instanceBuffer;
+	GLuint drawIndexBuffer = 0;		// Element i holds i, grows with the draw count
+	size_t drawIndexCapacity = 0;
+
+	void sortItems();
+
+	// Groups the sorted items into batches and uploads their commands, per-draw data and instances
+	void buildBatches();
+	bool batchable(const SortItem& item) const;
+	void drawBatch(const Batch& batch, Shader& shader);
+	void drawCommand(const DrawCommand& command, Shader& shader);
+	void setPassState(RenderPass pass);
+
+	// Sorts and batches once for all executePasses calls of a frame
+	void prepare();
+	void clear();
+};
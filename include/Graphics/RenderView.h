@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glm/glm/glm.hpp>
+
+#include "Graphics/Culling.h"
+
+#include <algorithm>
+
+// LOD switches once a level's error covers more than this many pixels
+const float LOD_PIXEL_ERROR = 1.0f;
+
+// Fraction the pixel error has to move past the threshold before the level changes back
+const float LOD_HYSTERESIS = 0.25f;
+
+// Camera state a frame is drawn with
+struct RenderView
+{
+	glm::vec3 position;
+	glm::mat4 view;
+	glm::mat4 projection;
+	Frustum frustum;
+	float viewportHeight;
+	float lodBias = 1.0f;	// Scales the projected size, > 1 keeps finer levels longer
+
+	RenderView(const glm::vec3& position, const glm::mat4& view, const glm::mat4& projection, float viewportHeight)
+		: position(position), view(view), projection(projection), frustum(Frustum::FromMatrix(projection * view)), viewportHeight(viewportHeight) {}
+
+	// Clip planes of the perspective projection
+	float nearPlane() const { return projection[3][2] / (projection[2][2] - 1.0f); }
+	float farPlane() const { return projection[3][2] / (projection[2][2] + 1.0f); }
+
+	// Pixels covered by one world unit at the given distance
+	float pixelsPerUnit(float distance) const
+	{
+		return 0.5f * viewportHeight * projection[1][1] / std::max(distance, 1e-4f);
+	}
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glm/glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// Parent of root nodes and the result of failed lookups
+const unsigned int NO_NODE = ~0u;
+
+// Transform hierarchy stored as flat arrays in parent-before-child order.
+// setLocal() only flags the node, update() recomputes the world matrices of the flagged nodes and their subtrees.
+class SceneGraph
+{
+public:
+	// The parent has to be added first, returns the index of the new node
+	unsigned int addNode(unsigned int parent, const glm::mat4& local, const std::string& name = std::string());
+
+	void clear();
+
+	void setLocal(unsigned int node, const glm::mat4& local);
+
+	// Recomputes the world matrices that changed since the last update
+	void update();
+
+	size_t size() const { return parents.size(); }
+	unsigned int parent(unsigned int node) const { return parents[node]; }
+	const glm::mat4& local(unsigned int node) const { return locals[node]; }
+	const glm::mat4& world(unsigned int node) const { return worlds[node]; }
+	const std::string& name(unsigned int node) const { return names[node]; }
+
+	// First node with the given name, NO_NODE if there is none
+	unsigned int find(const std::string& name) const;
+
+	// Number of world matrices the last update() recomputed
+	unsigned int lastUpdateCount() const { return updatedCount; }
+
+private:
+	std::vector<unsigned int> parents;
+	std::vector<glm::mat4> locals;
+	std::vector<glm::mat4> worlds;
+	std::vector<unsigned char> dirty;
+	std::vector<std::string> names;
+	std::vector<unsigned int> batch;
+
+	// Nodes before this index are clean
+	size_t firstDirty = 0;
+	unsigned int updatedCount = 0;
+};
+
+// out = a * b, SSE when available
+void MultiplyMatrices(const glm::mat4& a, const glm::mat4& b, glm::mat4& out);
@@ -3,21 +3,98 @@
 #include <glad/glad.h>
 #include <glm/glm/glm.hpp>
 
+#include "Graphics/Hash.h"
+
+#include <chrono>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
-#include <map>
+#include <vector>
+
+// Debug builds report uniforms that are set but are not active in the program
+#ifdef _DEBUG
+#define SHADER_REPORT_INACTIVE_UNIFORMS
+#endif
+
+// Active uniform of a linked program, found by reflection after linking
+struct ShaderUniform
+{
+    std::string name;   // Arrays are stored without the trailing [0]
+    uint64_t hash;
+    GLint location;
+    GLenum type;
+    GLint size;         // Array length, 1 otherwise
+};
+
+// Active uniform or shader storage block of a linked program
+struct ShaderBlock
+{
+    std::string name;
+    uint64_t hash;
+    GLenum interface;   // GL_UNIFORM_BLOCK or GL_SHADER_STORAGE_BLOCK
+    GLint binding;
+    GLint dataSize;
+};
+
+// Index into the program's uniform table, stable for the lifetime of the program
+struct UniformHandle
+{
+    int index = -1;
+
+    bool valid() const { return index >= 0; }
+};
 
 class Shader
 {
 public:
     unsigned int ID;
 
-    Shader(const char* vertexPath, const char* fragmentPath);
+    // Sources the program is built from, kept for hot reload. Compute programs only have computePath.
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string computePath;
+    std::string defines;
+
+    // Whether the program came from the binary cache, and how long compiling or loading it took
+    bool fromBinaryCache = false;
+    double loadMs = 0.0;
+
+    // defines are #define lines inserted after the #version line of both stages
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = "");
 
     void use() const;
 
+    // Delete the program
+    void Delete();
+
+    // Recompiles from the files without blocking, the current program stays in use until the new one links.
+    // pollReload returns true once it swapped programs; uniform values and handles of the old program are gone then.
+    void beginReload();
+    bool pollReload();
+    void cancelReload();
+    bool reloading() const { return pending.program != 0; }
+
+    // Uniform handles, by name or by HashLiteral("name") so hot paths never touch strings.
+    // Invalid if the uniform is not active, setting an invalid handle does nothing.
+    UniformHandle uniform(uint64_t nameHash) const;
+    UniformHandle uniform(const std::string& name) const;
+
+    void setBool(UniformHandle handle, bool value) const;
+    void setInt(UniformHandle handle, int value) const;
+    void setIntArray(UniformHandle handle, const int* values, int count) const;
+    void setUInt(UniformHandle handle, unsigned int value) const;
+    void setFloat(UniformHandle handle, float value) const;
+    void setFloatArray(UniformHandle handle, const float* values, int count) const;
+    void setIVec2(UniformHandle handle, const glm::ivec2& value) const;
+    void setVec2(UniformHandle handle, const glm::vec2& value) const;
+    void setVec3(UniformHandle handle, const glm::vec3& value) const;
+    void setVec4(UniformHandle handle, const glm::vec4& value) const;
+    void setVec4Array(UniformHandle handle, const glm::vec4* values, int count) const;
+    void setMat2(UniformHandle handle, const glm::mat2& mat) const;
+    void setMat3(UniformHandle handle, const glm::mat3& mat) const;
+    void setMat4(UniformHandle handle, const glm::mat4& mat) const;
+
     void setBool(const std::string& name, bool value) const;
 
     void setInt(const std::string& name, int value) const;
@@ -42,15 +119,59 @@ public:
 
     void setMat4(const std::string& name, const glm::mat4& mat) const;
 
-    // Caching uniform locations
-    int getUniformLocation(const std::string& name);
+    // Location of an active uniform, -1 if it is not active
+    int getUniformLocation(const std::string& name) const;
+
+    const std::vector<ShaderUniform>& uniforms() const { return uniformTable; }
+    const std::vector<ShaderBlock>& blocks() const { return blockTable; }
+
+    // Inserts defines after the #version line
+    static std::string injectDefines(const std::string& code, const std::string& defines);
+
+protected:
+    // ComputeShader sets computePath and defines, then loads
+    Shader() : ID(0) {}
 
+    // Builds the program from the binary cache or the sources, returns whether it linked
+    bool load();
 
 private:
 
-    // 
-    std::map<std::string, int> uniformLocationCache;
+    // Sorted by hash, uniformHashes mirrors it so lookups only scan integers
+    std::vector<ShaderUniform> uniformTable;
+    std::vector<uint64_t> uniformHashes;
+    std::vector<ShaderBlock> blockTable;
+
+#ifdef SHADER_REPORT_INACTIVE_UNIFORMS
+    mutable std::vector<uint64_t> reportedInactive;
+    void reportInactive(uint64_t nameHash, const std::string& name) const;
+#endif
+
+    // Program being compiled by beginReload. A compute program has its stage in vertex, fragment is 0.
+    struct PendingProgram
+    {
+        GLuint program = 0;
+        GLuint vertex = 0;
+        GLuint fragment = 0;
+        uint64_t cacheKey = 0;
+        std::chrono::steady_clock::time_point start;
+    };
+    PendingProgram pending;
+
+    // Enumerates the active uniforms and blocks once after linking
+    void reflect();
+
+    bool compute() const { return !computePath.empty(); }
+
+    // "vertex + fragment" or the compute file, for messages
+    std::string sourceName() const;
+    std::string cachePath() const;
+
+    // A compute program reads its one stage into vertexCode and leaves fragmentCode empty
+    bool readSources(std::string& vertexCode, std::string& fragmentCode) const;
+    GLuint startCompile(const std::string& vertexCode, const std::string& fragmentCode, GLuint& vertex, GLuint& fragment) const;
+    bool finishCompile(GLuint program, GLuint vertex, GLuint fragment);
 
     void checkCompileErrors(GLuint shader, std::string type);
 
-};
\ No newline at end of file
+};
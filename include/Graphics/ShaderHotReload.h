@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Graphics/FileWatcher.h"
+#include "Graphics/Shader.h"
+#include "Graphics/ShaderPermutations.h"
+
+#include <string>
+#include <vector>
+
+// Recompiles shaders whose files change on disk, without restarting or blocking the frame.
+// Programs keep drawing with their previous version until the new one has linked.
+class ShaderHotReload
+{
+public:
+	explicit ShaderHotReload(const std::string& directory = "shaders");
+
+	void watch(Shader* shader);
+	void watch(ShaderPermutations* permutations);
+	void unwatch(Shader* shader);
+	void unwatch(ShaderPermutations* permutations);
+
+	// Once per frame: starts compiles for changed files and swaps in finished programs
+	void update();
+
+private:
+	FileWatcher watcher;
+	std::vector<Shader*> shaders;
+	std::vector<ShaderPermutations*> permutations;
+};
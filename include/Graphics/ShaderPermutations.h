@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Graphics/Shader.h"
+#include "Graphics/Texture.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Material features a variant is compiled for, each one is a HAS_* define
+enum ShaderFeature : unsigned int
+{
+	SHADER_FEATURE_DIFFUSE_MAP = 1 << 0,	// HAS_DIFFUSE_MAP
+	SHADER_FEATURE_SPECULAR_MAP = 1 << 1,	// HAS_SPECULAR_MAP
+	SHADER_FEATURE_NORMAL_MAP = 1 << 2,		// HAS_NORMAL_MAP
+	SHADER_FEATURE_AO_MAP = 1 << 3			// HAS_AO_MAP
+};
+
+// Features provided by a mesh's texture set
+unsigned int ShaderFeaturesFromTextures(const std::vector<Texture>& textures);
+
+// Compile-time inputs of one variant
+struct ShaderPermutation
+{
+	unsigned int features = 0;
+	unsigned int dirLights = 0;		// NUM_DIR_LIGHTS, lights are ordered directional, point, spot in the light buffer
+	unsigned int pointLights = 0;	// NUM_POINT_LIGHTS
+	unsigned int spotLights = 0;	// NUM_SPOT_LIGHTS
+	bool clustered = false;			// CLUSTERED_LIGHTING: point and spot lights come from the light clusters, their counts are ignored
+	bool gbuffer = false;			// GBUFFER_OUTPUT: writes the G-buffer of DeferredRenderer instead of shading, light counts are ignored
+	bool shadows = false;			// SHADOWS: the first directional light is shadowed by CascadedShadowMaps
+	bool localShadows = false;		// LOCAL_SHADOWS: point and spot lights with a tile in the ShadowAtlas are shadowed
+
+	uint64_t key() const;
+
+	// #define lines injected after #version
+	std::string defines() const;
+
+	// Only the inputs default.vert reads. It reads none of the defines, so this is the empty permutation.
+	ShaderPermutation vertexStage() const;
+};
+
+// Lazily compiled variants of one vertex/fragment pair, each permutation is compiled on first use
+class ShaderPermutations
+{
+public:
+	// vertexStageOnly: the fragment stage reads no defines (a depth-only pass), variants are keyed on
+	// ShaderPermutation::vertexStage so every lighting and material combination shares one program
+	ShaderPermutations(const std::string& vertexPath, const std::string& fragmentPath, bool vertexStageOnly = false);
+	~ShaderPermutations();
+
+	ShaderPermutations(const ShaderPermutations&) = delete;
+	ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+	// Called once for every new variant, for uniforms that never change such as sampler units
+	std::function<void(Shader&)> setup;
+
+	Shader& get(const ShaderPermutation& permutation);
+
+	size_t variantCount() const { return variants.size(); }
+
+	const std::string& vertexFile() const { return vertexPath; }
+	const std::string& fragmentFile() const { return fragmentPath; }
+
+	// Starts recompiling every variant, see Shader::beginReload
+	void beginReload();
+
+	// Swaps in the variants that finished and runs setup on them
+	void pollReload();
+
+	void Delete();
+
+private:
+	std::string vertexPath;
+	std::string fragmentPath;
+	bool vertexStageOnly;
+	std::unordered_map<uint64_t, std::unique_ptr<Shader>> variants;
+
+	// Last lookup, consecutive meshes usually share a variant
+	uint64_t lastKey;
+	Shader* lastShader;
+};
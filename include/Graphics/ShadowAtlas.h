@@ -0,0 +1,141 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "Graphics/Culling.h"
+#include "Graphics/GpuPassTimers.h"
+#include "Graphics/Light.h"
+#include "Graphics/RenderView.h"
+#include "Graphics/Shader.h"
+#include "Graphics/ShadowCasters.h"
+
+#include <vector>
+
+// Lights an atlas shadows at once, each one owns SHADOW_TILES_PER_LIGHT entries of the tile buffer
+const unsigned int MAX_SHADOWED_LIGHTS = 64;
+
+// Cube faces of a point light in the order +X, -X, +Y, -Y, +Z, -Z, a spot light only uses the first
+const unsigned int SHADOW_TILES_PER_LIGHT = 6;
+
+// Shader storage binding of the ShadowTiles block, texture unit of the atlas
+const GLuint SHADOW_TILE_BUFFER_BINDING = 9;
+const unsigned int SHADOW_ATLAS_UNIT = 13;
+
+// std430 layout of one tile in the ShadowTiles block
+struct GpuShadowTile
+{
+	glm::mat4 viewProjection;	// World to the tile's light clip space
+	glm::vec4 rect;				// xy = atlas offset, zw = atlas scale, zero until the tile is first drawn
+	glm::vec4 params;			// x = world texel size per unit of distance, y = normal offset in texels, z = 1 / tile size
+};
+
+// Counters of the last render(), the time is from a few frames back
+struct ShadowAtlasStats
+{
+	unsigned int shadowedLights = 0;
+	unsigned int tiles = 0;				// Tiles with a place in the atlas
+	unsigned int renderedTiles = 0;
+	unsigned int pendingTiles = 0;		// Out of date but over the budget, drawn in a later frame
+	unsigned int reallocatedLights = 0;	// Lights whose tile size changed
+	float ms = 0.0f;
+};
+
+// Shadows of point and spot lights in one depth atlas. Point lights take six tiles for their cube faces.
+// Tile sizes follow the light's size on screen and are placed with a buddy allocator. Tiles are only
+// drawn again when their light changes, a static caster moves or a dynamic caster is in their frustum,
+// and at most tileBudget of them per frame, the most important and longest waiting first; the others
+// keep their last shadow until their turn.
+class ShadowAtlas
+{
+public:
+	unsigned int tileBudget = 8;	// Tiles drawn per frame
+	int minTileSize = 128;
+	int maxTileSize = 1024;
+	float tileDetail = 1.0f;		// Tile pixels per screen pixel of the light's range
+	float normalOffset = 1.5f;		// Receiver offset along the normal, in texels of its tile
+
+	// The atlas writes the tile of every shadowed light into lights
+	ShadowAtlas(LightManager& lights, int size = 4096, const char* vertexPath = "shaders/shadow_atlas.vert", const char* fragmentPath = "shaders/depth_only.frag");
+	~ShadowAtlas();
+
+	ShadowAtlas(const ShadowAtlas&) = delete;
+	ShadowAtlas& operator=(const ShadowAtlas&) = delete;
+
+	// Point and spot lights only, returns false when the atlas already shadows MAX_SHADOWED_LIGHTS lights
+	bool addLight(LightHandle light);
+
+	// Call before the light is removed from the LightManager
+	void removeLight(LightHandle light);
+
+	// Sizes the tiles for the view and draws the ones due this frame, then binds the tile buffer to
+	// SHADOW_TILE_BUFFER_BINDING and the atlas to SHADOW_ATLAS_UNIT. Call before LightManager::upload,
+	// the light's tiles are written to the light buffer. Restores the framebuffer and viewport.
+	void render(const ShadowCasters& casters, const RenderView& view, GLuint framebuffer, int viewportWidth, int viewportHeight);
+
+	// Draw every tile again, as soon as the budget allows
+	void invalidate();
+
+	const ShadowAtlasStats& stats() const { return atlasStats; }
+
+	// Delete the program, the atlas, the buffer and the queries
+	void Delete();
+
+private:
+	struct ShadowedLight
+	{
+		LightHandle light = NO_LIGHT;
+		int tileSize = 0;								// 0 while the light has no place in the atlas
+		glm::ivec2 origins[SHADOW_TILES_PER_LIGHT];		// Atlas pixel of each tile
+		glm::mat4 viewProjection[SHADOW_TILES_PER_LIGHT];
+		float fieldOfView = 0.0f;
+		GpuLight rendered;								// Light state the tiles are being drawn for
+		unsigned int dirtyTiles = 0;					// Bit per tile that is out of date
+		unsigned int dynamicTiles = 0;					// Bit per tile that held a dynamic caster when last drawn
+		unsigned int waitingFrames[SHADOW_TILES_PER_LIGHT] = {};
+		float importance = 0.0f;						// Pixels the light's range covers on screen
+
+		// Blocks of the previous tile size after a resize. Each stays allocated, and its tile record keeps
+		// pointing at it, until the tile is drawn at its new place, so receivers never lose the shadow.
+		int retiringSize = 0;
+		glm::ivec2 retiringOrigins[SHADOW_TILES_PER_LIGHT];
+		unsigned int retiringTiles = 0;					// Bit per tile still shown from its retiring block
+	};
+
+	struct TileUpdate
+	{
+		unsigned int slot;
+		unsigned int tile;
+		float priority;
+	};
+
+	LightManager& lights;
+	int size;
+	Shader shader;
+	GLuint depthAtlas = 0;
+	GLuint framebuffer = 0;
+	GLuint tileBuffer = 0;
+	std::vector<GpuShadowTile> tiles;
+	bool tilesDirty = true;
+
+	// Slot i owns tiles [i * SHADOW_TILES_PER_LIGHT, (i + 1) * SHADOW_TILES_PER_LIGHT)
+	std::vector<ShadowedLight> slots;
+	uint64_t lastStaticHash = 0;
+
+	// Buddy allocator, level l holds free blocks of size >> l
+	std::vector<std::vector<glm::ivec2>> freeBlocks;
+
+	GpuPassTimers timers{1};
+	ShadowAtlasStats atlasStats;
+
+	int levelOf(int tileSize) const;
+	bool allocateBlock(int level, glm::ivec2& origin);
+	void freeBlock(int level, glm::ivec2 origin);
+
+	bool allocate(ShadowedLight& shadowed, int tileSize);
+	bool resize(ShadowedLight& shadowed, int tileSize);
+	void release(ShadowedLight& shadowed);
+	unsigned int tileCount(const ShadowedLight& shadowed) const;
+	int targetTileSize(const GpuLight& light, const RenderView& view, float& importance) const;
+	void updateMatrices(ShadowedLight& shadowed, const GpuLight& light) const;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glm/glm/glm.hpp>
+
+#include "Graphics/Culling.h"
+#include "Graphics/InstanceBuffer.h"
+#include "Graphics/Shader.h"
+
+#include <cstdint>
+#include <vector>
+
+class Model;
+
+// World box of a caster, of all instances of an instanced caster or of one group of them
+struct CasterBounds
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// Models that cast shadows, re-added every frame and shared by every shadow pass.
+// Static casters are hashed so a pass can keep what it drew while none of them moves.
+class ShadowCasters
+{
+public:
+	void clear();
+	void add(Model& model, const glm::mat4& transform, bool dynamic = false);
+
+	// The buffer must be uploaded and stay alive until the shadow passes ran
+	void add(Model& model, const InstanceBuffer& instances, bool dynamic = false);
+
+	// Changes when a static caster is added, removed or moved
+	uint64_t staticHash() const { return hash; }
+
+	// Every instance of the dynamic casters
+	const std::vector<CasterBounds>& dynamicBounds() const { return dynamic; }
+
+	bool empty() const { return casters.empty(); }
+
+	// Draws every caster through the position-only stream, each instance instanceRepeat times in a row.
+	// Sets model, instanced, nodeTransform and firstInstance. When a frustum is given, casters and groups
+	// of instances outside it are skipped.
+	void draw(Shader& shader, int instanceRepeat = 1, const Frustum* frustum = nullptr) const;
+
+private:
+	struct Caster
+	{
+		Model* model;
+		glm::mat4 transform;
+		const InstanceBuffer* instances;	// nullptr for a single transform
+		CasterBounds bounds;
+		size_t firstGroup;					// Instanced only: range in groups
+		size_t groupCount;
+	};
+
+	// Consecutive instances of an instanced caster with their own bounds, so a tile only draws the ones it sees
+	struct InstanceGroup
+	{
+		CasterBounds bounds;
+		GLint firstInstance;
+		GLsizei instanceCount;
+	};
+
+	std::vector<Caster> casters;
+	std::vector<InstanceGroup> groups;
+	std::vector<CasterBounds> dynamic;
+	uint64_t hash = 0;
+
+	void drawMeshes(Shader& shader, const Caster& caster, GLsizei instanceCount, UniformHandle nodeTransformUniform, UniformHandle modelUniform) const;
+};
@@ -7,6 +7,8 @@
 
 #include "Graphics/Shader.h"
 
+class TextureStreamer;
+
 class Texture
 {
 public:
@@ -17,6 +19,8 @@ public:
 	GLuint unit;
 
 	Texture(const char* image, GLenum texType, GLenum slot, GLenum format, GLenum pixelType);
+	// Streamed 2D texture, usable right away with a placeholder until the image is resident
+	Texture(const char* image, const std::string& textureType, TextureStreamer& streamer);
 	Texture();
 
 	// Assign texture unit to a texture
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "Graphics/ThreadPool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Per-frame streaming statistics
+struct TextureStreamerStats
+{
+	size_t bytesStaged = 0;			// Bytes copied into pixel buffers this frame
+	unsigned int texturesUploaded = 0;	// Textures whose level 0 was specified this frame
+	unsigned int decoding = 0;		// Images still being decoded on the worker pool
+	unsigned int queued = 0;		// Decoded images waiting for upload budget
+	unsigned int inFlight = 0;		// Uploads waiting on their fence
+};
+
+// Streams 2D textures in the background:
+// images are decoded on the worker pool, staged into pixel buffer objects within a per-frame byte budget
+// and specified from the PBO so the copy runs asynchronously. Until then the texture holds a 1x1 placeholder,
+// so the GL name returned by request() can be bound right away and never changes.
+class TextureStreamer
+{
+public:
+	size_t uploadBudget;	// Max bytes staged per update()
+
+	TextureStreamer(size_t uploadBudgetBytes = 8 * 1024 * 1024, ThreadPool& pool = ThreadPool::Shared());
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// Returns a texture that shows a placeholder matching textureType until the file is resident
+	GLuint request(const std::string& path, const std::string& textureType = "texture_diffuse", bool gamma = false, bool flipVertically = true);
+
+	// GL thread, once per frame: retire finished uploads, then stage and upload within the budget
+	void update();
+
+	// Blocks until every requested texture is resident, for loading screens
+	void flush();
+
+	// Stop streaming into a texture that is about to be deleted
+	void cancel(GLuint texture);
+
+	bool isResident(GLuint texture) const;
+	bool isIdle() const;
+
+	const TextureStreamerStats& stats() const { return frameStats; }
+
+private:
+	struct DecodedImage
+	{
+		uint64_t request = 0;
+		GLuint texture = 0;
+		int width = 0;
+		int height = 0;
+		int channels = 0;
+		bool gamma = false;
+		unsigned char* pixels = nullptr;
+		size_t size = 0;
+	};
+
+	// Image being copied into a PBO over one or more frames
+	struct Staging
+	{
+		DecodedImage image;
+		GLuint pbo = 0;
+		size_t pboSize = 0;
+		size_t copied = 0;
+	};
+
+	// Upload issued from a PBO, the PBO is recycled once the fence signals
+	struct InFlightUpload
+	{
+		uint64_t request;
+		GLuint texture;
+		GLuint pbo;
+		size_t pboSize;
+		GLsync fence;
+	};
+
+	struct PixelBuffer
+	{
+		GLuint id;
+		size_t size;
+	};
+
+	ThreadPool& pool;
+
+	// Shared with the decode tasks
+	mutable std::mutex mutex;
+	std::condition_variable decodeFinished;
+	std::deque<DecodedImage> decoded;
+	unsigned int decoding;
+
+	// GL thread only
+	Staging current;
+	bool hasCurrent;
+	std::vector<InFlightUpload> inFlight;
+	std::vector<PixelBuffer> freeBuffers;
+	std::unordered_map<GLuint, uint64_t> pending;	// Texture -> request still streaming into it
+	std::unordered_set<uint64_t> cancelled;		// Requests to drop once decoded (GL names get reused)
+	uint64_t nextRequest;
+	TextureStreamerStats frameStats;
+
+	void retireUploads(bool wait);
+	void completeRequest(GLuint texture, uint64_t request);
+	bool stageNext(size_t& budget, bool unlimited);
+	void finishUpload();
+	GLuint acquirePixelBuffer(size_t size, size_t& bufferSize);
+
+	static void setPlaceholder(GLuint texture, const std::string& textureType);
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads for CPU-side loading work (never touches GL)
+class ThreadPool
+{
+public:
+	// 0 picks hardware_concurrency - 1 workers, at least one
+	explicit ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned int size() const { return (unsigned int)workers.size(); }
+
+	// Queue a fire-and-forget task
+	void submit(std::function<void()> task);
+
+	// Queue a task and get its result through a future
+	template<typename F>
+	auto enqueue(F&& function) -> std::future<decltype(function())>
+	{
+		using Result = decltype(function());
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(function));
+		std::future<Result> result = task->get_future();
+		submit([task]() { (*task)(); });
+		return result;
+	}
+
+	// Runs body(i) for every i in [0, count), the calling thread helps and it returns once all are done
+	void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+	// Engine-wide pool shared by the loaders
+	static ThreadPool& Shared();
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	bool stopping;
+
+	void workerLoop();
+};
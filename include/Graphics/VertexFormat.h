@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define MAX_BONE_INFLUENCE 4 // Max number of bones that can influence a vertex
+
+// Full import vertex, also the GPU format of skinned meshes (88 bytes)
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::vec2 TexCoords;
+	glm::vec3 Tangent;
+	glm::vec3 Bitangent;
+
+	// Bone IDs which will influence this vertex
+	int m_BoneIDs[MAX_BONE_INFLUENCE];
+	// weigths of the bones
+	float m_Weights[MAX_BONE_INFLUENCE];
+};
+
+// Static meshes: no skinning data (56 bytes)
+struct StaticVertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::vec2 TexCoords;
+	glm::vec3 Tangent;
+	glm::vec3 Bitangent;
+};
+
+// Quantized static meshes (28 bytes)
+struct PackedVertex {
+	glm::vec3 Position;
+	int16_t Normal[2];		// Octahedral, snorm16
+	int16_t Tangent[2];		// Octahedral, snorm16
+	uint16_t TexCoords[2];	// Half floats
+	int8_t BitangentSign;	// Bitangent = sign * cross(Normal, Tangent)
+	int8_t Padding[3];
+};
+
+// GPU vertex layout of a mesh, the values are stored in cooked mesh files
+enum class VertexLayout : uint32_t {
+	Skinned = 0,
+	Static = 1,
+	Packed = 2
+};
+
+// Size of one vertex in the given layout
+size_t VertexStride(VertexLayout layout);
+
+// Converts full vertices into the layout's GPU representation
+std::vector<unsigned char> PackVertices(const Vertex* vertices, size_t count, VertexLayout layout);
+
+// 16-bit indices when every vertex can be addressed with them
+GLenum IndexType(size_t vertexCount);
+size_t IndexSize(GLenum indexType);
+
+// Converts indices into the index type's GPU representation
+std::vector<unsigned char> PackIndices(const unsigned int* indices, size_t count, GLenum indexType);
+
+// Enables and points the layout's attributes at the bound GL_ARRAY_BUFFER, unused attributes are disabled
+void SetupVertexAttributes(VertexLayout layout);
+
+// Octahedral mapping of a unit vector to [-1, 1]^2
+glm::vec2 OctEncode(const glm::vec3& n);
+glm::vec3 OctDecode(const glm::vec2& e);
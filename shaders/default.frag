@@ -1,145 +1,287 @@
-#version 460 core
+#version 450 core
 
+#ifdef GBUFFER_OUTPUT
+// G-buffer of DeferredRenderer, lighting happens in deferred_lighting.frag
+layout (location = 0) out vec4 fragColor;       // rgb = albedo, a = ambient occlusion
+layout (location = 1) out vec4 gNormalSpecular; // rg = octahedral normal, b = specular intensity, a = shininess / 256
+#else
 out vec4 fragColor;
+#endif
 
 in vec2 texCoord;
 in vec3 fragPos;
 in vec3 normal;
 
-uniform sampler2D texture_diffuse1;
-uniform sampler2D texture_specular1;
-uniform sampler2D texture_normal1;
-uniform sampler2D texture_height1;
-uniform sampler2D texture_ambientOcclusion1;
-uniform sampler2D texture_roughness1;
+// Permutations define NUM_*_LIGHTS and HAS_* for the mesh's textures (ShaderPermutations).
+// Without them every map is sampled and the light loop reads the types at run time.
+#ifndef NUM_DIR_LIGHTS
+#define HAS_DIFFUSE_MAP
+#define HAS_SPECULAR_MAP
+#define HAS_NORMAL_MAP
+#define HAS_AO_MAP
+#define DYNAMIC_LIGHTS
+#endif
 
-struct DirectionalLight {
-    vec3 color;
-    vec3 direction;
+// Material table (MaterialLibrary), sizes must match Material.h
+#define MAX_MATERIALS 256
+#define MAX_MATERIAL_TEXTURE_ARRAYS 8
+
+#define SLOT_DIFFUSE 0
+#define SLOT_SPECULAR 1
+#define SLOT_NORMAL 2
+#define SLOT_AMBIENT_OCCLUSION 3
+
+struct Material {
+    vec4 color;         // rgb = color, a = shininess
+    ivec4 arrays;       // Texture array per slot, -1 until the texture is resident
+    ivec4 layers;
+};
+
+layout (std140, binding = 1) uniform Materials
+{
+    Material materials[MAX_MATERIALS];
+};
+
+layout (binding = 0) uniform sampler2DArray materialTextures[MAX_MATERIAL_TEXTURE_ARRAYS];
+
+uniform int materialIndex;
+
+layout (std140, binding = 0) uniform FrameConstants
+{
+    mat4 projection;
+    mat4 view;
+    mat4 viewRotation;
+    vec4 viewPos;
+    vec4 ambient;       // rgb = color, a = strength
+    vec4 clusterScale;  // xy = clusters per pixel, z/w = slice scale/bias of log(view depth)
+};
+
+#define LIGHT_DIRECTIONAL 0
+#define LIGHT_POINT 1
+#define LIGHT_SPOT 2
+
+struct Light {
+    vec4 color;         // rgb = color, w = type
+    vec4 position;
+    vec4 direction;
+    vec4 params;        // Point: constant, linear, quadratic; Spot: cutOff, outerCutOff
 };
 
-struct PointLight {
-    vec3 color;
-    vec3 position;
-    float constant;
-    float linear;
-    float quadratic;
+layout (std430, binding = 1) readonly buffer Lights {
+    uint lightCount;
+    Light lights[];
 };
 
-struct SpotLight {
-    vec3 color;
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
+#ifdef CLUSTERED_LIGHTING
+// Point and spot lights reaching each froxel (ClusteredLighting), sizes must match ClusteredLighting.h
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+
+// x = first entry of the cluster in clusterLightIndices, y = light count
+layout (std430, binding = 7) readonly buffer ClusterLightGrid {
+    uvec2 clusterLightGrid[];
+};
+
+layout (std430, binding = 8) readonly buffer ClusterLightIndices {
+    uint clusterLightIndices[];
 };
+#endif
 
-#define MAX_DIR_LIGHTS 4
-#define MAX_POINT_LIGHTS 4
-#define MAX_SPOT_LIGHTS 4
+#ifdef SHADOWS
+// Cascades of the first directional light (CascadedShadowMaps), sizes must match CascadedShadowMaps.h
+#define SHADOW_CASCADE_COUNT 4
 
-uniform int numDirLights;
-uniform int numPointLights;
-uniform int numSpotLights;
+layout (std140, binding = 2) uniform ShadowConstants
+{
+    mat4 cascadeViewProjection[SHADOW_CASCADE_COUNT];
+    vec4 cascadeSplits;     // View depth each cascade ends at
+    vec4 cascadeTexelSize;  // World size of one shadow texel
+    vec4 shadowParams;      // x = depth bias, y = normal offset in texels, z = 1 / resolution
+};
 
-uniform vec3 globalAmbientColor;
-uniform float globalAmbientStrength;
+layout (binding = 12) uniform sampler2DArrayShadow shadowMap;
 
-uniform DirectionalLight dirLights[MAX_DIR_LIGHTS];
-uniform PointLight pointLights[MAX_POINT_LIGHTS];
-uniform SpotLight spotLights[MAX_SPOT_LIGHTS];
+float ShadowFactor(vec3 fragPos, vec3 normal, vec3 lightDir);
+#endif
 
-uniform vec3 viewPos; // Camera/view position
-uniform vec3 objectColor;
+#ifdef LOCAL_SHADOWS
+// Point and spot light shadows (ShadowAtlas), a light's direction.w is its first tile + 1
+struct ShadowTile {
+    mat4 viewProjection;
+    vec4 rect;          // xy = atlas offset, zw = atlas scale, zero until the tile is drawn
+    vec4 params;        // x = world texel size per unit of distance, y = normal offset in texels, z = 1 / tile size
+};
+
+layout (std430, binding = 9) readonly buffer ShadowTiles {
+    ShadowTile shadowTiles[];
+};
+
+layout (binding = 13) uniform sampler2DShadow shadowAtlas;
+
+float LocalShadow(Light light, vec3 normal, vec3 fragPos);
+#endif
 
 // Function prototypes
-vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir);
-vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalculateSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 CalculateDirectionalLight(Light light, vec3 normal, vec3 viewDir, float shadow);
+vec3 CalculatePointLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 CalculateSpotLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 PointLightRadiance(Light light, vec3 normal, vec3 fragPos);
+vec3 SpotLightRadiance(Light light, vec3 normal, vec3 fragPos);
 vec3 CalculateSpecular(vec3 specularColor, vec3 viewDir, vec3 normal, float shininess);
+vec4 SampleMaterial(int slot, vec4 fallback);
+#ifdef GBUFFER_OUTPUT
+void WriteGBuffer(vec3 normal);
+#endif
 
 void main() {
     vec3 norm = normalize(normal);
-    vec3 viewDir = normalize(viewPos - fragPos);
+    vec3 viewDir = normalize(viewPos.xyz - fragPos);
     
-    vec3 tangentNormal = texture(texture_normal1, texCoord).xyz * 2.0 - 1.0;
+#ifdef HAS_NORMAL_MAP
+    vec3 tangentNormal = SampleMaterial(SLOT_NORMAL, vec4(0.5, 0.5, 1.0, 1.0)).xyz * 2.0 - 1.0;
     norm = normalize(norm + tangentNormal);
+#endif
+
+#ifdef GBUFFER_OUTPUT
+    WriteGBuffer(norm);
+    return;
+#endif
 
     vec3 result = vec3(0.0);
 
-    for (int i = 0; i < numDirLights; i++) {
-        result += CalculateDirectionalLight(dirLights[i], norm, viewDir);
-    }
+#ifdef SHADOWS
+    float shadow = NUM_DIR_LIGHTS > 0 ? ShadowFactor(fragPos, norm, normalize(-lights[0].direction.xyz)) : 1.0;
+#else
+    float shadow = 1.0;
+#endif
 
-    for (int i = 0; i < numPointLights; i++) {
-        result += CalculatePointLight(pointLights[i], norm, fragPos, viewDir);
+#ifdef DYNAMIC_LIGHTS
+    for (uint i = 0; i < lightCount; i++) {
+        int type = int(lights[i].color.w);
+        if (type == LIGHT_DIRECTIONAL)
+            result += CalculateDirectionalLight(lights[i], norm, viewDir, 1.0);
+        else if (type == LIGHT_POINT)
+            result += CalculatePointLight(lights[i], norm, fragPos, viewDir);
+        else
+            result += CalculateSpotLight(lights[i], norm, fragPos, viewDir);
     }
+#elif defined(CLUSTERED_LIGHTING)
+    for (int i = 0; i < NUM_DIR_LIGHTS; i++)
+        result += CalculateDirectionalLight(lights[i], norm, viewDir, i == 0 ? shadow : 1.0);
 
-    for (int i = 0; i < numSpotLights; i++) {
-        result += CalculateSpotLight(spotLights[i], norm, fragPos, viewDir);
+    // Only the lights whose range reaches this froxel, without the per-light ambient term
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+    uvec3 clusterCoord = uvec3(min(uvec2(gl_FragCoord.xy * clusterScale.xy), uvec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1)),
+                               uint(clamp(log(viewDepth) * clusterScale.z + clusterScale.w, 0.0, float(CLUSTER_GRID_Z - 1))));
+    uint cluster = (clusterCoord.z * CLUSTER_GRID_Y + clusterCoord.y) * CLUSTER_GRID_X + clusterCoord.x;
+    uvec2 clusterLights = clusterLightGrid[cluster];
+    for (uint i = 0; i < clusterLights.y; i++) {
+        Light light = lights[clusterLightIndices[clusterLights.x + i]];
+        if (length(light.position.xyz - fragPos) > light.params.w)
+            continue;
+        if (int(light.color.w) == LIGHT_POINT)
+            result += PointLightRadiance(light, norm, fragPos);
+        else
+            result += SpotLightRadiance(light, norm, fragPos);
     }
+#else
+    // The light buffer holds the directional, then point, then spot lights
+    for (int i = 0; i < NUM_DIR_LIGHTS; i++)
+        result += CalculateDirectionalLight(lights[i], norm, viewDir, i == 0 ? shadow : 1.0);
+    for (int i = 0; i < NUM_POINT_LIGHTS; i++)
+        result += CalculatePointLight(lights[NUM_DIR_LIGHTS + i], norm, fragPos, viewDir);
+    for (int i = 0; i < NUM_SPOT_LIGHTS; i++)
+        result += CalculateSpotLight(lights[NUM_DIR_LIGHTS + NUM_POINT_LIGHTS + i], norm, fragPos, viewDir);
+#endif
 
-    vec4 texColor = texture(texture_diffuse1, texCoord);
-    vec3 litColor = result * objectColor * texColor.rgb;
+#ifdef HAS_DIFFUSE_MAP
+    vec4 texColor = SampleMaterial(SLOT_DIFFUSE, vec4(1.0));
+#else
+    vec4 texColor = vec4(1.0);
+#endif
+    vec3 litColor = result * materials[materialIndex].color.rgb * texColor.rgb;
 
-    vec3 specularColor = texture(texture_specular1, texCoord).rgb;
-    vec3 specular = CalculateSpecular(specularColor, viewDir, norm, 32.0);
+#ifdef HAS_SPECULAR_MAP
+    vec3 specularColor = SampleMaterial(SLOT_SPECULAR, vec4(0.0)).rgb;
+    vec3 specular = CalculateSpecular(specularColor, viewDir, norm, materials[materialIndex].color.a);
+#else
+    vec3 specular = vec3(0.0);
+#endif
 
     fragColor = vec4(litColor + specular, texColor.a);
 }
 
-// Directional light
-vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDir) {
-    vec3 lightDir = normalize(-light.direction);
+// Directional light, shadow only darkens the direct part
+vec3 CalculateDirectionalLight(Light light, vec3 normal, vec3 viewDir, float shadow) {
+    vec3 lightDir = normalize(-light.direction.xyz);
 
     float diff = max(dot(normal, lightDir), 0.0);
 
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = 0.0;
 
-    vec3 ambient = globalAmbientStrength * globalAmbientColor * texture(texture_ambientOcclusion1, texCoord).rgb;
-    vec3 diffuse = diff * light.color;
-    vec3 specular = spec * light.color;
-    return (ambient + diffuse + specular);
+#ifdef HAS_AO_MAP
+    vec3 ambientLight = ambient.a * ambient.rgb * SampleMaterial(SLOT_AMBIENT_OCCLUSION, vec4(1.0)).rgb;
+#else
+    vec3 ambientLight = ambient.a * ambient.rgb;
+#endif
+    vec3 diffuse = diff * light.color.rgb;
+    vec3 specular = spec * light.color.rgb;
+    return (ambientLight + (diffuse + specular) * shadow);
 }
 
 // Point light
-vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
-    vec3 lightDir = normalize(light.position - fragPos);
+vec3 CalculatePointLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir) {
+    vec3 ambientLight = ambient.a * ambient.rgb;
+    return ambientLight + PointLightRadiance(light, normal, fragPos);
+}
+
+vec3 PointLightRadiance(Light light, vec3 normal, vec3 fragPos) {
+    vec3 lightDir = normalize(light.position.xyz - fragPos);
     
     float diff = max(dot(normal, lightDir), 0.0);
     
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = 0.0; // Assuming no shininess for simplicity; add shininess if needed
     
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    float distance = length(light.position.xyz - fragPos);
+    float attenuation = 1.0 / (light.params.x + light.params.y * distance + light.params.z * (distance * distance));
+#ifdef LOCAL_SHADOWS
+    attenuation *= LocalShadow(light, normal, fragPos);
+#endif
     
-    vec3 ambient = globalAmbientStrength * globalAmbientColor;
-    vec3 diffuse = diff * light.color;
-    vec3 specular = spec * light.color;
-    return ambient + (diffuse + specular) * attenuation;
+    vec3 diffuse = diff * light.color.rgb;
+    vec3 specular = spec * light.color.rgb;
+    return (diffuse + specular) * attenuation;
 }
 
 // Spot light
-vec3 CalculateSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
-    vec3 lightDir = normalize(light.position - fragPos);
-    float theta = dot(lightDir, normalize(-light.direction)); 
-    float epsilon = light.cutOff - light.outerCutOff;
-    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+vec3 CalculateSpotLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir) {
+    vec3 ambientLight = ambient.a * ambient.rgb;
+    return ambientLight + SpotLightRadiance(light, normal, fragPos);
+}
+
+vec3 SpotLightRadiance(Light light, vec3 normal, vec3 fragPos) {
+    vec3 lightDir = normalize(light.position.xyz - fragPos);
+    float theta = dot(lightDir, normalize(-light.direction.xyz)); 
+    float epsilon = light.params.x - light.params.y;
+    float intensity = clamp((theta - light.params.y) / epsilon, 0.0, 1.0);
 
     float diff = max(dot(normal, lightDir), 0.0);
 
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = 0.0; // Assuming no shininess for simplicity; add shininess if needed
     
-    float distance = length(light.position - fragPos);
+    float distance = length(light.position.xyz - fragPos);
     float attenuation = 1.0 / (distance * distance);
+#ifdef LOCAL_SHADOWS
+    attenuation *= LocalShadow(light, normal, fragPos);
+#endif
     
-    vec3 ambient = globalAmbientStrength * globalAmbientColor;
-    vec3 diffuse = diff * light.color;
-    vec3 specular = spec * light.color;
-    return ambient + (diffuse + specular) * attenuation * intensity;
+    vec3 diffuse = diff * light.color.rgb;
+    vec3 specular = spec * light.color.rgb;
+    return (diffuse + specular) * attenuation * intensity;
 }
 
 // Calculate specular
@@ -147,4 +289,104 @@ vec3 CalculateSpecular(vec3 specularColor, vec3 viewDir, vec3 normal, float shin
 	vec3 reflectDir = reflect(-viewDir, normal);
 	float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
 	return spec * specularColor;
-}
\ No newline at end of file
+}
+
+#ifdef SHADOWS
+// 3x3 hardware-filtered taps in the cascade containing the fragment. The receiver moves along its normal
+// by a few texels of that cascade, more at grazing angles, which removes acne without a large depth bias.
+float ShadowFactor(vec3 fragPos, vec3 normal, vec3 lightDir) {
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+    if (viewDepth > cascadeSplits[SHADOW_CASCADE_COUNT - 1])
+        return 1.0;
+    int cascade = 0;
+    while (cascade < SHADOW_CASCADE_COUNT - 1 && viewDepth > cascadeSplits[cascade])
+        cascade++;
+
+    float grazing = 1.0 - max(dot(normal, lightDir), 0.0);
+    vec3 receiver = fragPos + normal * (shadowParams.y * cascadeTexelSize[cascade] * grazing);
+    vec4 clip = cascadeViewProjection[cascade] * vec4(receiver, 1.0);
+    vec3 coord = clip.xyz / clip.w * 0.5 + 0.5;
+    float reference = min(coord.z - shadowParams.x, 1.0);
+
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+            lit += texture(shadowMap, vec4(coord.xy + vec2(x, y) * shadowParams.z, float(cascade), reference));
+    return lit / 9.0;
+}
+#endif
+
+#ifdef LOCAL_SHADOWS
+// Point lights pick the cube face tile by the major axis. The receiver moves along its normal by a few
+// texels of its tile at its distance, the four hardware-filtered taps stay inside the tile.
+float LocalShadow(Light light, vec3 normal, vec3 fragPos) {
+    int tile = int(light.direction.w) - 1;
+    if (tile < 0)
+        return 1.0;
+    vec3 toFrag = fragPos - light.position.xyz;
+    if (int(light.color.w) == LIGHT_POINT) {
+        vec3 axis = abs(toFrag);
+        if (axis.x >= axis.y && axis.x >= axis.z)
+            tile += toFrag.x > 0.0 ? 0 : 1;
+        else if (axis.y >= axis.z)
+            tile += toFrag.y > 0.0 ? 2 : 3;
+        else
+            tile += toFrag.z > 0.0 ? 4 : 5;
+    }
+    ShadowTile shadow = shadowTiles[tile];
+    if (shadow.rect.z == 0.0)
+        return 1.0;
+
+    float texelSize = shadow.params.x * length(toFrag);
+    vec4 clip = shadow.viewProjection * vec4(fragPos + normal * (shadow.params.y * texelSize), 1.0);
+    vec3 coord = clip.xyz / clip.w * 0.5 + 0.5;
+    float reference = min(coord.z, 1.0);
+
+    float lit = 0.0;
+    for (int i = 0; i < 4; i++) {
+        vec2 local = clamp(coord.xy + (vec2(i & 1, i >> 1) - 0.5) * shadow.params.z, vec2(shadow.params.z), vec2(1.0 - shadow.params.z));
+        lit += texture(shadowAtlas, vec3(shadow.rect.xy + local * shadow.rect.zw, reference));
+    }
+    return lit * 0.25;
+}
+#endif
+
+#ifdef GBUFFER_OUTPUT
+vec2 octEncode(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * mix(vec2(-1.0), vec2(1.0), greaterThanEqual(n.xy, vec2(0.0)));
+    return n.xy * 0.5 + 0.5;
+}
+
+// Surface inputs of the forward lighting above, specular color reduced to one intensity
+void WriteGBuffer(vec3 normal) {
+#ifdef HAS_DIFFUSE_MAP
+    vec3 albedo = SampleMaterial(SLOT_DIFFUSE, vec4(1.0)).rgb;
+#else
+    vec3 albedo = vec3(1.0);
+#endif
+#ifdef HAS_AO_MAP
+    float occlusion = SampleMaterial(SLOT_AMBIENT_OCCLUSION, vec4(1.0)).r;
+#else
+    float occlusion = 1.0;
+#endif
+#ifdef HAS_SPECULAR_MAP
+    vec3 specularColor = SampleMaterial(SLOT_SPECULAR, vec4(0.0)).rgb;
+    float specularIntensity = (specularColor.r + specularColor.g + specularColor.b) / 3.0;
+#else
+    float specularIntensity = 0.0;
+#endif
+    fragColor = vec4(albedo * materials[materialIndex].color.rgb, occlusion);
+    gNormalSpecular = vec4(octEncode(normal), specularIntensity, clamp(materials[materialIndex].color.a / 256.0, 0.0, 1.0));
+}
+#endif
+
+// Texture of a material slot, fallback while it is not resident.
+// materialIndex is uniform, so indexing the sampler array is dynamically uniform.
+vec4 SampleMaterial(int slot, vec4 fallback) {
+    int array = materials[materialIndex].arrays[slot];
+    if (array < 0)
+        return fallback;
+    return texture(materialTextures[array], vec3(texCoord, materials[materialIndex].layers[slot]));
+}
@@ -1,21 +1,97 @@
-#version 460 core
+#version 450 core
 
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTex;
+layout (location = 8) in uvec2 aCulledInstance;	// GPU culled draws: x = instance, y = mesh
+layout (location = 9) in uint aDrawIndex;		// Multi-draws: the command's baseInstance, 4.5 has no gl_DrawID
 
 out vec2 texCoord;
 out vec3 fragPos;
 out vec3 normal;
 
+// The depth prepass links this stage with depth_only.frag, both programs must produce the same depth
+invariant gl_Position;
+
+layout (std140, binding = 0) uniform FrameConstants
+{
+    mat4 projection;
+    mat4 view;
+    mat4 viewRotation;
+    vec4 viewPos;
+    vec4 ambient;       // rgb = color, a = strength
+    vec4 clusterScale;  // Light clusters, unused here
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform bool packedVertices;	// Normal is octahedral encoded in aNormal.xy
+uniform bool instanced;			// Transforms come from the instance buffer instead of model
+uniform mat4 nodeTransform;		// Instanced only: the mesh's node transform under the instance transform
+uniform mat3 nodeNormalMatrix;
+uniform bool multiDraw;			// Transforms come from draws[aDrawIndex] (RenderQueue multi-draw batches)
+uniform bool gpuCulled;			// Transforms come from the instance and mesh GpuCuller's compute pass kept
+
+struct InstanceData
+{
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+layout (std430, binding = 0) readonly buffer Instances
+{
+    InstanceData instances[];
+};
+
+struct DrawData
+{
+    mat4 model;             // Node transform for instanced draws
+    mat4 normalMatrix;
+    uvec4 params;           // x = first instance, y = 1 if instanced
+};
+
+layout (std430, binding = 2) readonly buffer Draws
+{
+    DrawData draws[];
+};
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
 
 void main()
 {
-    fragPos = vec3(model * vec4(aPos, 1.0));
-    normal = mat3(transpose(inverse(model))) * aNormal;
+    vec3 objectNormal = packedVertices ? octDecode(aNormal.xy) : aNormal;
+    mat4 modelMatrix;
+    mat3 normalMatrix;
+    if (gpuCulled)
+    {
+        modelMatrix = instances[aCulledInstance.x].model * draws[aCulledInstance.y].model;
+        normalMatrix = mat3(instances[aCulledInstance.x].normalMatrix) * mat3(draws[aCulledInstance.y].normalMatrix);
+    }
+    else if (multiDraw)
+    {
+        DrawData draw = draws[aDrawIndex];
+        modelMatrix = draw.model;
+        normalMatrix = mat3(draw.normalMatrix);
+        if (draw.params.y != 0u)
+        {
+            uint instance = draw.params.x + uint(gl_InstanceID);
+            modelMatrix = instances[instance].model * modelMatrix;
+            normalMatrix = mat3(instances[instance].normalMatrix) * normalMatrix;
+        }
+    }
+    else
+    {
+        modelMatrix = instanced ? instances[gl_InstanceID].model * nodeTransform : model;
+        normalMatrix = instanced ? mat3(instances[gl_InstanceID].normalMatrix) * nodeNormalMatrix : mat3(transpose(inverse(model)));
+    }
+
+    fragPos = vec3(modelMatrix * vec4(aPos, 1.0));
+    normal = normalMatrix * objectNormal;
     texCoord = aTex;
     gl_Position = projection * view * vec4(fragPos, 1.0);
 
@@ -0,0 +1,206 @@
+#version 450 core
+
+out vec4 fragColor;
+
+in vec2 screenUV;
+
+// G-buffer written by default.frag with GBUFFER_OUTPUT (DeferredRenderer), units must match DeferredRenderer.h
+layout (binding = 9) uniform sampler2D gAlbedoOcclusion;     // rgb = albedo, a = ambient occlusion
+layout (binding = 10) uniform sampler2D gNormalSpecular;     // rg = octahedral normal, b = specular intensity, a = shininess / 256
+layout (binding = 11) uniform sampler2D gDepth;
+
+uniform mat4 inverseViewProjection;
+uniform int dirLightCount;
+uniform bool shadows;   // The first directional light has CascadedShadowMaps
+uniform bool localShadows;  // Point and spot lights with a ShadowAtlas tile are shadowed
+
+layout (std140, binding = 0) uniform FrameConstants
+{
+    mat4 projection;
+    mat4 view;
+    mat4 viewRotation;
+    vec4 viewPos;
+    vec4 ambient;       // rgb = color, a = strength
+    vec4 clusterScale;  // xy = clusters per pixel, z/w = slice scale/bias of log(view depth)
+};
+
+#define LIGHT_POINT 1
+
+struct Light {
+    vec4 color;         // rgb = color, w = type
+    vec4 position;
+    vec4 direction;
+    vec4 params;        // Point: constant, linear, quadratic; Spot: cutOff, outerCutOff; w = range
+};
+
+layout (std430, binding = 1) readonly buffer Lights {
+    uint lightCount;
+    Light lights[];
+};
+
+// Light clusters (ClusteredLighting), sizes must match ClusteredLighting.h
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+
+// x = first entry of the cluster in clusterLightIndices, y = light count
+layout (std430, binding = 7) readonly buffer ClusterLightGrid {
+    uvec2 clusterLightGrid[];
+};
+
+layout (std430, binding = 8) readonly buffer ClusterLightIndices {
+    uint clusterLightIndices[];
+};
+
+// Cascades of the first directional light, must match CascadedShadowMaps.h
+#define SHADOW_CASCADE_COUNT 4
+
+layout (std140, binding = 2) uniform ShadowConstants
+{
+    mat4 cascadeViewProjection[SHADOW_CASCADE_COUNT];
+    vec4 cascadeSplits;     // View depth each cascade ends at
+    vec4 cascadeTexelSize;  // World size of one shadow texel
+    vec4 shadowParams;      // x = depth bias, y = normal offset in texels, z = 1 / resolution
+};
+
+layout (binding = 12) uniform sampler2DArrayShadow shadowMap;
+
+// Point and spot light shadows, must match ShadowAtlas.h
+struct ShadowTile {
+    mat4 viewProjection;
+    vec4 rect;          // xy = atlas offset, zw = atlas scale, zero until the tile is drawn
+    vec4 params;        // x = world texel size per unit of distance, y = normal offset in texels, z = 1 / tile size
+};
+
+layout (std430, binding = 9) readonly buffer ShadowTiles {
+    ShadowTile shadowTiles[];
+};
+
+layout (binding = 13) uniform sampler2DShadow shadowAtlas;
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
+// Same as LocalShadow in default.frag
+float LocalShadow(Light light, vec3 normal, vec3 fragPos) {
+    int tile = int(light.direction.w) - 1;
+    if (!localShadows || tile < 0)
+        return 1.0;
+    vec3 toFrag = fragPos - light.position.xyz;
+    if (int(light.color.w) == LIGHT_POINT) {
+        vec3 axis = abs(toFrag);
+        if (axis.x >= axis.y && axis.x >= axis.z)
+            tile += toFrag.x > 0.0 ? 0 : 1;
+        else if (axis.y >= axis.z)
+            tile += toFrag.y > 0.0 ? 2 : 3;
+        else
+            tile += toFrag.z > 0.0 ? 4 : 5;
+    }
+    ShadowTile shadow = shadowTiles[tile];
+    if (shadow.rect.z == 0.0)
+        return 1.0;
+
+    float texelSize = shadow.params.x * length(toFrag);
+    vec4 clip = shadow.viewProjection * vec4(fragPos + normal * (shadow.params.y * texelSize), 1.0);
+    vec3 coord = clip.xyz / clip.w * 0.5 + 0.5;
+    float reference = min(coord.z, 1.0);
+
+    float lit = 0.0;
+    for (int i = 0; i < 4; i++) {
+        vec2 local = clamp(coord.xy + (vec2(i & 1, i >> 1) - 0.5) * shadow.params.z, vec2(shadow.params.z), vec2(1.0 - shadow.params.z));
+        lit += texture(shadowAtlas, vec3(shadow.rect.xy + local * shadow.rect.zw, reference));
+    }
+    return lit * 0.25;
+}
+
+// Same terms as the clustered path of default.frag
+vec3 PointLightRadiance(Light light, vec3 normal, vec3 fragPos) {
+    vec3 lightDir = normalize(light.position.xyz - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float distance = length(light.position.xyz - fragPos);
+    float attenuation = 1.0 / (light.params.x + light.params.y * distance + light.params.z * (distance * distance));
+    return diff * light.color.rgb * attenuation * LocalShadow(light, normal, fragPos);
+}
+
+vec3 SpotLightRadiance(Light light, vec3 normal, vec3 fragPos) {
+    vec3 lightDir = normalize(light.position.xyz - fragPos);
+    float theta = dot(lightDir, normalize(-light.direction.xyz));
+    float epsilon = light.params.x - light.params.y;
+    float intensity = clamp((theta - light.params.y) / epsilon, 0.0, 1.0);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float distance = length(light.position.xyz - fragPos);
+    return diff * light.color.rgb * intensity / (distance * distance) * LocalShadow(light, normal, fragPos);
+}
+
+// Same as ShadowFactor in default.frag
+float ShadowFactor(vec3 fragPos, vec3 normal, vec3 lightDir, float viewDepth) {
+    if (viewDepth > cascadeSplits[SHADOW_CASCADE_COUNT - 1])
+        return 1.0;
+    int cascade = 0;
+    while (cascade < SHADOW_CASCADE_COUNT - 1 && viewDepth > cascadeSplits[cascade])
+        cascade++;
+
+    float grazing = 1.0 - max(dot(normal, lightDir), 0.0);
+    vec3 receiver = fragPos + normal * (shadowParams.y * cascadeTexelSize[cascade] * grazing);
+    vec4 clip = cascadeViewProjection[cascade] * vec4(receiver, 1.0);
+    vec3 coord = clip.xyz / clip.w * 0.5 + 0.5;
+    float reference = min(coord.z - shadowParams.x, 1.0);
+
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+            lit += texture(shadowMap, vec4(coord.xy + vec2(x, y) * shadowParams.z, float(cascade), reference));
+    return lit / 9.0;
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    // Nothing was drawn here, the sky pass fills it
+    if (depth >= 1.0)
+        discard;
+
+    vec4 albedoOcclusion = texelFetch(gAlbedoOcclusion, pixel, 0);
+    vec4 normalSpecular = texelFetch(gNormalSpecular, pixel, 0);
+    vec3 norm = octDecode(normalSpecular.xy * 2.0 - 1.0);
+
+    vec4 worldPos = inverseViewProjection * vec4(screenUV * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec3 fragPos = worldPos.xyz / worldPos.w;
+    vec3 viewDir = normalize(viewPos.xyz - fragPos);
+
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+
+    vec3 result = vec3(0.0);
+    vec3 ambientLight = ambient.a * ambient.rgb * albedoOcclusion.a;
+    for (int i = 0; i < dirLightCount; i++) {
+        vec3 lightDir = normalize(-lights[i].direction.xyz);
+        float shadow = shadows && i == 0 ? ShadowFactor(fragPos, norm, lightDir, viewDepth) : 1.0;
+        result += ambientLight + max(dot(norm, lightDir), 0.0) * lights[i].color.rgb * shadow;
+    }
+
+    uvec3 clusterCoord = uvec3(min(uvec2(gl_FragCoord.xy * clusterScale.xy), uvec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1)),
+                               uint(clamp(log(viewDepth) * clusterScale.z + clusterScale.w, 0.0, float(CLUSTER_GRID_Z - 1))));
+    uint cluster = (clusterCoord.z * CLUSTER_GRID_Y + clusterCoord.y) * CLUSTER_GRID_X + clusterCoord.x;
+    uvec2 clusterLights = clusterLightGrid[cluster];
+    for (uint i = 0; i < clusterLights.y; i++) {
+        Light light = lights[clusterLightIndices[clusterLights.x + i]];
+        if (length(light.position.xyz - fragPos) > light.params.w)
+            continue;
+        if (int(light.color.w) == LIGHT_POINT)
+            result += PointLightRadiance(light, norm, fragPos);
+        else
+            result += SpotLightRadiance(light, norm, fragPos);
+    }
+
+    // Specular of default.frag's CalculateSpecular, zero for materials without a specular map
+    vec3 reflectDir = reflect(-viewDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), normalSpecular.a * 256.0) * normalSpecular.b;
+
+    fragColor = vec4(result * albedoOcclusion.rgb + spec, 1.0);
+}
@@ -0,0 +1,5 @@
+#version 450 core
+
+// Depth prepass with default.vert, only depth is written
+void main() {
+}
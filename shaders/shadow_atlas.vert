@@ -0,0 +1,27 @@
+#version 450 core
+
+// One tile of the shadow atlas (ShadowAtlas), viewport and scissor select the tile
+layout (location = 0) in vec3 aPos;	// Position-only stream of the geometry pool
+
+uniform mat4 lightViewProjection;
+uniform mat4 model;
+uniform bool instanced;			// Transforms come from the instance buffer instead of model
+uniform mat4 nodeTransform;		// Instanced only: the mesh's node transform under the instance transform
+uniform int firstInstance;		// Instanced only: buffer index of the draw's first instance
+
+struct InstanceData
+{
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+layout (std430, binding = 0) readonly buffer Instances
+{
+    InstanceData instances[];
+};
+
+void main()
+{
+    mat4 modelMatrix = instanced ? instances[firstInstance + gl_InstanceID].model * nodeTransform : model;
+    gl_Position = lightViewProjection * modelMatrix * vec4(aPos, 1.0);
+}
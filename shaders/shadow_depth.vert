@@ -0,0 +1,50 @@
+#version 450 core
+
+// Cascades are picked per instance: gl_InstanceID = caster instance * cascadeCount + cascade slot.
+// LAYERED_CASCADES writes gl_Layer so every cascade of the shadow array is drawn in one pass,
+// without it the draw goes to the single layer attached to the framebuffer.
+#ifdef LAYERED_CASCADES
+#extension GL_ARB_shader_viewport_layer_array : require
+#endif
+
+#define SHADOW_CASCADE_COUNT 4
+
+layout (location = 0) in vec3 aPos;	// Position-only stream of the geometry pool
+
+layout (std140, binding = 2) uniform ShadowConstants
+{
+    mat4 cascadeViewProjection[SHADOW_CASCADE_COUNT];
+    vec4 cascadeSplits;
+    vec4 cascadeTexelSize;
+    vec4 shadowParams;
+};
+
+uniform mat4 model;
+uniform bool instanced;			// Transforms come from the instance buffer instead of model
+uniform mat4 nodeTransform;		// Instanced only: the mesh's node transform under the instance transform
+uniform int firstInstance;		// Instanced only: buffer index of the draw's first instance
+uniform int cascadeCount;		// Cascades drawn by this call
+uniform int cascades[SHADOW_CASCADE_COUNT];
+
+struct InstanceData
+{
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+layout (std430, binding = 0) readonly buffer Instances
+{
+    InstanceData instances[];
+};
+
+void main()
+{
+    int slot = gl_InstanceID % cascadeCount;
+    int instance = gl_InstanceID / cascadeCount;
+    mat4 modelMatrix = instanced ? instances[firstInstance + instance].model * nodeTransform : model;
+    int cascade = cascades[slot];
+    gl_Position = cascadeViewProjection[cascade] * modelMatrix * vec4(aPos, 1.0);
+#ifdef LAYERED_CASCADES
+    gl_Layer = cascade;
+#endif
+}
@@ -1,10 +1,10 @@
-#version 460 core
+#version 450 core
 
 out vec4 fragColor;
 
 in vec3 texCoord;
 
-uniform samplerCube skybox;
+layout (binding = 0) uniform samplerCube skybox;
 
 void main()
 {
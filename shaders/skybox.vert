@@ -1,15 +1,22 @@
-#version 460 core
+#version 450 core
 
 layout (location = 0) in vec3 aPos;
 
 out vec3 texCoord;
 
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140, binding = 0) uniform FrameConstants
+{
+	mat4 projection;
+	mat4 view;
+	mat4 viewRotation;
+	vec4 viewPos;
+	vec4 ambient;	   // rgb = color, a = strength
+	vec4 clusterScale;  // Light clusters, unused here
+};
 
 void main()
 {
 	texCoord = aPos;
-	gl_Position = projection * view * vec4(aPos, 1.0);
+	gl_Position = projection * viewRotation * vec4(aPos, 1.0);
 	gl_Position = gl_Position.xyww;                     // z = w = 1.0
 }
@@ -0,0 +1,123 @@
+#include "Graphics/AssetManager.h"
+#include "Graphics/Hash.h"
+
+template class AssetHandle<Model>;
+template class AssetHandle<Texture>;
+template class AssetHandle<Shader>;
+
+AssetManager::AssetManager(TextureStreamer* streamer)
+	: streamer(streamer) {}
+
+AssetManager::~AssetManager()
+{
+	// Models first, they hold references to textures
+	while (!models.empty())
+	{
+		std::unique_ptr<Model> model = std::move(models.begin()->second.asset);
+		models.erase(models.begin());
+		unload(*model);
+	}
+	for (auto& entry : textures)
+		unload(*entry.second.asset);
+	for (auto& entry : shaders)
+		unload(*entry.second.asset);
+
+	textures.clear();
+	shaders.clear();
+}
+
+ModelHandle AssetManager::loadModel(const std::string& path, bool gamma, VertexLayout layout)
+{
+	std::string name = NormalizePath(path);
+	uint64_t id = HashValue(layout, HashValue(gamma, HashString(name)));
+
+	ModelHandle handle = find<Model>(id);
+	if (handle)
+		return handle;
+
+	return insert(id, name, std::unique_ptr<Model>(new Model(name, gamma, this, layout)));
+}
+
+TextureHandle AssetManager::loadTexture(const std::string& path, const std::string& textureType, bool gamma)
+{
+	std::string name = NormalizePath(path);
+	uint64_t id = HashValue(gamma, HashString(name));
+
+	TextureHandle handle = find<Texture>(id);
+	if (handle)
+		return handle;
+
+	std::unique_ptr<Texture> texture(new Texture());
+	if (streamer)
+	{
+		texture->ID = streamer->request(name, textureType, gamma);
+	}
+	else
+	{
+		size_t split = name.find_last_of('/');
+		std::string directory = split == std::string::npos ? "." : name.substr(0, split);
+		std::string file = split == std::string::npos ? name : name.substr(split + 1);
+		texture->ID = TextureFromFile(file.c_str(), directory, gamma);
+	}
+	texture->type = GL_TEXTURE_2D;
+	texture->path = name;
+
+	return insert(id, name, std::move(texture));
+}
+
+ShaderHandle AssetManager::loadShader(const std::string& vertexPath, const std::string& fragmentPath)
+{
+	std::string vertexName = NormalizePath(vertexPath);
+	std::string fragmentName = NormalizePath(fragmentPath);
+	uint64_t id = HashString(fragmentName, HashString(vertexName));
+
+	ShaderHandle handle = find<Shader>(id);
+	if (handle)
+		return handle;
+
+	return insert(id, vertexName + " + " + fragmentName, std::unique_ptr<Shader>(new Shader(vertexName.c_str(), fragmentName.c_str())));
+}
+
+std::string AssetManager::NormalizePath(const std::string& path)
+{
+	std::string normalized = path;
+	for (char& c : normalized)
+	{
+		if (c == '\\')
+			c = '/';
+	}
+
+	// Drop "./" segments and repeated slashes
+	std::string result;
+	result.reserve(normalized.size());
+	for (size_t i = 0; i < normalized.size(); i++)
+	{
+		bool segmentStart = result.empty() || result.back() == '/';
+		if (segmentStart && normalized.compare(i, 2, "./") == 0)
+		{
+			i++;
+			continue;
+		}
+		if (normalized[i] == '/' && !result.empty() && result.back() == '/')
+			continue;
+		result += normalized[i];
+	}
+	return result;
+}
+
+void AssetManager::unload(Model& model)
+{
+	model.Delete();
+}
+
+void AssetManager::unload(Texture& texture)
+{
+	if (streamer)
+		streamer->cancel(texture.ID);
+	texture.Delete();
+}
+
+void AssetManager::unload(Shader& shader)
+{
+	shader.Delete();
+}
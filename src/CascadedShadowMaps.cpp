@@ -0,0 +1,246 @@
+#include "Graphics/CascadedShadowMaps.h"
+#include "Graphics/GLState.h"
+
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+// Uniform name hashes, computed at compile time
+static constexpr uint64_t CASCADE_COUNT_UNIFORM = HashLiteral("cascadeCount");
+static constexpr uint64_t CASCADES_UNIFORM = HashLiteral("cascades");
+
+// Lets the vertex stage pick the layer, so one instanced draw reaches every cascade
+static bool layerFromVertexSupported()
+{
+	static int supported = -1;
+	if (supported < 0)
+	{
+		supported = 0;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count && !supported; i++)
+		{
+			const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, (GLuint)i));
+			supported = name && std::strcmp(name, "GL_ARB_shader_viewport_layer_array") == 0;
+		}
+	}
+	return supported == 1;
+}
+
+CascadedShadowMaps::CascadedShadowMaps(int resolution, const char* vertexPath, const char* fragmentPath)
+	: resolution(resolution), cascadeShader(vertexPath, fragmentPath)
+{
+	if (layerFromVertexSupported())
+		layeredShader.reset(new Shader(vertexPath, fragmentPath, "#define LAYERED_CASCADES\n"));
+
+	// Hardware 2x2 PCF: linear filtering of a depth comparison. Outside the array means lit.
+	glGenTextures(1, &depthArray);
+	GLState::bindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, resolution, resolution, SHADOW_CASCADE_COUNT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	const float border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "ERROR::SHADOW::FRAMEBUFFER_INCOMPLETE" << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenBuffers(1, &constantsBuffer);
+	GLState::bindBuffer(GL_UNIFORM_BUFFER, constantsBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowConstants), nullptr, GL_DYNAMIC_DRAW);
+
+	constants = ShadowConstants();
+	for (glm::vec3& center : cascadeCenter)
+		center = glm::vec3(0.0f);
+}
+
+CascadedShadowMaps::~CascadedShadowMaps()
+{
+	Delete();
+}
+
+void CascadedShadowMaps::render(const ShadowCasters& casters, const RenderView& view, const glm::vec3& lightDirection, GLuint target, int viewportWidth, int viewportHeight)
+{
+	renderedMask = 0;
+	if (!depthArray || !cascadeShader.ID)
+		return;
+
+	// Cached cascades hold the static casters as they were when drawn
+	glm::vec3 direction = glm::normalize(lightDirection);
+	if (casters.staticHash() != lastStaticHash || direction != lastLightDirection)
+		cacheValid = 0;
+	lastStaticHash = casters.staticHash();
+	lastLightDirection = direction;
+
+	// Practical split scheme: a blend of uniform and logarithmic split depths
+	float nearDepth = view.nearPlane();
+	float farDepth = std::min(shadowDistance, view.farPlane());
+	float sliceNear = nearDepth;
+	for (unsigned int cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		float t = (float)(cascade + 1) / SHADOW_CASCADE_COUNT;
+		float logSplit = nearDepth * std::pow(farDepth / nearDepth, t);
+		float uniformSplit = nearDepth + (farDepth - nearDepth) * t;
+		float sliceFar = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+		constants.cascadeSplits[cascade] = sliceFar;
+
+		fitCascade(casters, cascade, view, sliceNear, sliceFar, direction, cascade >= firstCachedCascade);
+		sliceNear = sliceFar;
+	}
+	constants.params = glm::vec4(depthBias, normalOffset, 1.0f / resolution, 0.0f);
+
+	GLState::bindBuffer(GL_UNIFORM_BUFFER, constantsBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ShadowConstants), &constants);
+	GLState::bindBufferBase(GL_UNIFORM_BUFFER, SHADOW_CONSTANTS_BINDING, constantsBuffer);
+
+	timers.beginFrame();
+	readStats();
+
+	if (renderedMask)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, resolution, resolution);
+		GLState::depthMask(GL_TRUE);
+		GLState::depthFunc(GL_LESS);
+		// Casters between the light and the near plane are clamped onto it instead of clipped
+		glEnable(GL_DEPTH_CLAMP);
+
+		int due[SHADOW_CASCADE_COUNT];
+		int dueCount = 0;
+		for (unsigned int cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+		{
+			if (!(renderedMask >> cascade & 1))
+				continue;
+			due[dueCount++] = (int)cascade;
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0, cascade);
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+
+		if (layered() && !profileCascades)
+		{
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0);
+			timers.begin(SHADOW_CASCADE_COUNT);
+			drawCasters(casters, *layeredShader, due, dueCount);
+			timers.end();
+		}
+		else
+		{
+			for (int i = 0; i < dueCount; i++)
+			{
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0, due[i]);
+				timers.begin(due[i]);
+				drawCasters(casters, cascadeShader, &due[i], 1);
+				timers.end();
+			}
+		}
+		timers.setFrameTag(renderedMask);
+
+		glDisable(GL_DEPTH_CLAMP);
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+		glViewport(0, 0, viewportWidth, viewportHeight);
+	}
+
+	GLState::bindTexture(SHADOW_MAP_UNIT, GL_TEXTURE_2D_ARRAY, depthArray);
+}
+
+void CascadedShadowMaps::fitCascade(const ShadowCasters& casters, unsigned int cascade, const RenderView& view, float nearDepth, float farDepth, const glm::vec3& lightDirection, bool cached)
+{
+	// Smallest sphere around the slice, centered on the view axis. It depends only on the split depths
+	// and the field of view, so the cascade's size never changes while the camera turns.
+	float tanX = 1.0f / view.projection[0][0];
+	float tanY = 1.0f / view.projection[1][1];
+	float k2 = tanX * tanX + tanY * tanY;
+	float centerDepth = std::min(0.5f * (nearDepth + farDepth) * (1.0f + k2), farDepth);
+	float radius = std::sqrt(nearDepth * nearDepth * k2 + (centerDepth - nearDepth) * (centerDepth - nearDepth));
+	radius = std::ceil(radius * 16.0f) / 16.0f;
+	glm::vec3 center = glm::vec3(glm::inverse(view.view) * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+
+	// A cached cascade stays while the slice is inside the sphere it was drawn for and no dynamic caster was or is in it
+	unsigned int bit = 1u << cascade;
+	bool keep = cached && (cacheValid & bit) && !(hadDynamic & bit) &&
+		glm::length(center - cascadeCenter[cascade]) + radius <= cascadeRadius[cascade] && !dynamicCasterInside(casters, cascade);
+	if (keep)
+		return;
+
+	cascadeCenter[cascade] = center;
+	cascadeRadius[cascade] = cached ? radius * cacheMargin : radius;
+	radius = cascadeRadius[cascade];
+
+	// Fixed light orientation, the center moves in whole texels so the rasterized casters do not shimmer
+	glm::vec3 up = std::abs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+	float texelSize = 2.0f * radius / resolution;
+	glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+	lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+	lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+	glm::mat4 projection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius,
+		-(lightCenter.z + radius), -(lightCenter.z - radius));
+
+	constants.cascadeViewProjection[cascade] = projection * lightView;
+	constants.cascadeTexelSize[cascade] = texelSize;
+	renderedMask |= bit;
+	if (cached)
+		cacheValid |= bit;
+	hadDynamic = dynamicCasterInside(casters, cascade) ? hadDynamic | bit : hadDynamic & ~bit;
+}
+
+bool CascadedShadowMaps::dynamicCasterInside(const ShadowCasters& casters, unsigned int cascade) const
+{
+	// The cascade is a column along the light, its square covers the sphere's radius times sqrt(2) at the corners
+	float reach = cascadeRadius[cascade] * 1.4143f;
+	for (const CasterBounds& bounds : casters.dynamicBounds())
+	{
+		glm::vec3 offset = 0.5f * (bounds.min + bounds.max) - cascadeCenter[cascade];
+		glm::vec3 across = offset - lastLightDirection * glm::dot(offset, lastLightDirection);
+		if (glm::length(across) <= reach + 0.5f * glm::length(bounds.max - bounds.min))
+			return true;
+	}
+	return false;
+}
+
+void CascadedShadowMaps::drawCasters(const ShadowCasters& casters, Shader& shader, const int* cascades, int count)
+{
+	shader.use();
+	shader.setInt(shader.uniform(CASCADE_COUNT_UNIFORM), count);
+	shader.setIntArray(shader.uniform(CASCADES_UNIFORM), cascades, count);
+	casters.draw(shader, count);
+}
+
+void CascadedShadowMaps::readStats()
+{
+	const GpuPassTimes& times = timers.times();
+	for (unsigned int cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+		shadowStats.cascadeMs[cascade] = times.ms[cascade];
+	shadowStats.totalMs = times.totalMs;
+	shadowStats.renderedCascades = times.tag;
+}
+
+void CascadedShadowMaps::Delete()
+{
+	cascadeShader.Delete();
+	if (layeredShader)
+		layeredShader->Delete();
+	layeredShader.reset();
+	GLState::deleteTexture(depthArray);
+	depthArray = 0;
+	if (framebuffer)
+		glDeleteFramebuffers(1, &framebuffer);
+	framebuffer = 0;
+	if (constantsBuffer)
+		GLState::deleteBuffer(constantsBuffer);
+	constantsBuffer = 0;
+	timers.Delete();
+}
@@ -0,0 +1,171 @@
+#include "Graphics/ClusteredLighting.h"
+#include "Graphics/GLState.h"
+#include "Graphics/ShaderHotReload.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Must match the local size of light_clusters.comp
+static const GLuint ASSIGN_GROUP_SIZE = 128;
+
+// Uniform name hashes, computed at compile time
+static constexpr uint64_t VIEW_UNIFORM = HashLiteral("view");
+static constexpr uint64_t INVERSE_PROJECTION_UNIFORM = HashLiteral("inverseProjection");
+static constexpr uint64_t NEAR_PLANE_UNIFORM = HashLiteral("nearPlane");
+static constexpr uint64_t FAR_PLANE_UNIFORM = HashLiteral("farPlane");
+static constexpr uint64_t FIRST_LOCAL_LIGHT_UNIFORM = HashLiteral("firstLocalLight");
+static constexpr uint64_t LOCAL_LIGHT_COUNT_UNIFORM = HashLiteral("localLightCount");
+
+ClusteredLighting::ClusteredLighting(const char* computePath)
+	: assignShader(computePath)
+{
+	glGenBuffers(1, &gridBuffer);
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNT * sizeof(glm::uvec2), nullptr, GL_DYNAMIC_DRAW);
+
+	glGenBuffers(1, &indexBuffer);
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+}
+
+glm::vec4 ClusteredLighting::ClusterScale(const RenderView& view, float viewportWidth, float viewportHeight)
+{
+	// slice = log(depth / near) / log(far / near) * slices = log(depth) * scale + bias
+	float nearPlane = view.nearPlane();
+	float sliceScale = (float)CLUSTER_GRID_Z / std::log(view.farPlane() / nearPlane);
+	return glm::vec4((float)CLUSTER_GRID_X / viewportWidth, (float)CLUSTER_GRID_Y / viewportHeight, sliceScale, -std::log(nearPlane) * sliceScale);
+}
+
+void ClusteredLighting::update(const LightManager& lights, const RenderView& view)
+{
+	// Lights are ordered directional, point, spot in the buffer, everything after the directional ones is clustered
+	GLuint firstLocal = lights.count(LightType::Directional);
+	GLuint localCount = lights.count(LightType::Point) + lights.count(LightType::Spot);
+
+	lastOnGpu = gpuAssignment && assignShader.ID;
+	if (lastOnGpu)
+	{
+		GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_GRID_BINDING, gridBuffer);
+		GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_INDEX_BINDING, indexBuffer);
+
+		assignShader.use();
+		assignShader.setMat4(assignShader.uniform(VIEW_UNIFORM), view.view);
+		assignShader.setMat4(assignShader.uniform(INVERSE_PROJECTION_UNIFORM), glm::inverse(view.projection));
+		assignShader.setFloat(assignShader.uniform(NEAR_PLANE_UNIFORM), view.nearPlane());
+		assignShader.setFloat(assignShader.uniform(FAR_PLANE_UNIFORM), view.farPlane());
+		assignShader.setUInt(assignShader.uniform(FIRST_LOCAL_LIGHT_UNIFORM), firstLocal);
+		assignShader.setUInt(assignShader.uniform(LOCAL_LIGHT_COUNT_UNIFORM), localCount);
+		assignShader.dispatch((CLUSTER_COUNT + ASSIGN_GROUP_SIZE - 1) / ASSIGN_GROUP_SIZE);
+
+		// Read by the fragment shaders of this frame
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		return;
+	}
+
+	// Only the filled part of the packed index list is uploaded
+	assignOnCpu(lights, view);
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, grid.size() * sizeof(glm::uvec2), grid.data());
+	if (!indices.empty())
+	{
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, indices.size() * sizeof(GLuint), indices.data());
+	}
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_GRID_BINDING, gridBuffer);
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_INDEX_BINDING, indexBuffer);
+}
+
+void ClusteredLighting::watch(ShaderHotReload& hotReload)
+{
+	hotReload.watch(&assignShader);
+}
+
+void ClusteredLighting::computeClusterBounds(const RenderView& view)
+{
+	clusterMin.resize(CLUSTER_COUNT);
+	clusterMax.resize(CLUSTER_COUNT);
+
+	const float nearPlane = view.nearPlane();
+	const float farPlane = view.farPlane();
+	const glm::mat4 inverseProjection = glm::inverse(view.projection);
+	for (unsigned int z = 0; z < CLUSTER_GRID_Z; z++)
+	{
+		float sliceNear = nearPlane * std::pow(farPlane / nearPlane, (float)z / CLUSTER_GRID_Z);
+		float sliceFar = nearPlane * std::pow(farPlane / nearPlane, (float)(z + 1) / CLUSTER_GRID_Z);
+		for (unsigned int y = 0; y < CLUSTER_GRID_Y; y++)
+		{
+			for (unsigned int x = 0; x < CLUSTER_GRID_X; x++)
+			{
+				// Rays through the tile corners, cut at the slice's depths
+				glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+				for (unsigned int corner = 0; corner < 4; corner++)
+				{
+					glm::vec2 ndc((float)(x + (corner & 1)) / CLUSTER_GRID_X * 2.0f - 1.0f, (float)(y + (corner >> 1)) / CLUSTER_GRID_Y * 2.0f - 1.0f);
+					glm::vec4 onNear = inverseProjection * glm::vec4(ndc, -1.0f, 1.0f);
+					glm::vec3 ray = glm::vec3(onNear) / onNear.w;
+					ray /= -ray.z;
+					boundsMin = glm::min(boundsMin, glm::min(ray * sliceNear, ray * sliceFar));
+					boundsMax = glm::max(boundsMax, glm::max(ray * sliceNear, ray * sliceFar));
+				}
+				unsigned int cluster = (z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x;
+				clusterMin[cluster] = boundsMin;
+				clusterMax[cluster] = boundsMax;
+			}
+		}
+	}
+}
+
+void ClusteredLighting::assignOnCpu(const LightManager& lights, const RenderView& view)
+{
+	computeClusterBounds(view);
+	grid.assign(CLUSTER_COUNT, glm::uvec2(0));
+	hits.clear();
+
+	const float nearPlane = view.nearPlane();
+	const float farPlane = view.farPlane();
+	const float sliceScale = (float)CLUSTER_GRID_Z / std::log(farPlane / nearPlane);
+	const std::vector<GpuLight>& packed = lights.packed();
+	for (GLuint i = lights.count(LightType::Directional); i < packed.size(); i++)
+	{
+		glm::vec3 center = glm::vec3(view.view * glm::vec4(glm::vec3(packed[i].position), 1.0f));
+		float range = packed[i].params.w;
+
+		// Only the slices the sphere's depth range reaches are tested
+		float depthNear = -center.z - range;
+		float depthFar = -center.z + range;
+		if (depthFar < nearPlane || depthNear > farPlane)
+			continue;
+		unsigned int firstSlice = depthNear <= nearPlane ? 0 : (unsigned int)std::min(std::log(depthNear / nearPlane) * sliceScale, (float)CLUSTER_GRID_Z - 1.0f);
+		unsigned int lastSlice = depthFar >= farPlane ? CLUSTER_GRID_Z - 1 : (unsigned int)std::min(std::log(depthFar / nearPlane) * sliceScale, (float)CLUSTER_GRID_Z - 1.0f);
+
+		for (unsigned int cluster = firstSlice * CLUSTER_GRID_X * CLUSTER_GRID_Y; cluster < (lastSlice + 1) * CLUSTER_GRID_X * CLUSTER_GRID_Y; cluster++)
+		{
+			glm::vec3 closest = glm::clamp(center, clusterMin[cluster], clusterMax[cluster]) - center;
+			if (glm::dot(closest, closest) > range * range || grid[cluster].y == MAX_LIGHTS_PER_CLUSTER)
+				continue;
+			grid[cluster].y++;
+			hits.push_back(glm::uvec2(cluster, i));
+		}
+	}
+
+	// Offsets are the running sum of the counts. Each offset starts at the end of its list and the hits
+	// are placed back to front, which leaves it at the first entry with the lights still in order
+	GLuint offset = 0;
+	for (glm::uvec2& entry : grid)
+	{
+		offset += entry.y;
+		entry.x = offset;
+	}
+	indices.resize(offset);
+	for (size_t hit = hits.size(); hit-- > 0;)
+		indices[--grid[hits[hit].x].x] = hits[hit].y;
+}
+
+void ClusteredLighting::Delete()
+{
+	assignShader.Delete();
+	GLState::deleteBuffer(gridBuffer);
+	GLState::deleteBuffer(indexBuffer);
+	gridBuffer = indexBuffer = 0;
+}
@@ -0,0 +1,16 @@
+#include "Graphics/ComputeShader.h"
+#include "Graphics/GLState.h"
+
+ComputeShader::ComputeShader(const char* computePath, const std::string& defines)
+{
+	this->computePath = computePath;
+	this->defines = defines;
+	if (!load())
+		Delete();
+}
+
+void ComputeShader::dispatch(GLuint groupsX, GLuint groupsY, GLuint groupsZ) const
+{
+	if (ID && groupsX && groupsY && groupsZ)
+		glDispatchCompute(groupsX, groupsY, groupsZ);
+}
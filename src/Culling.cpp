@@ -0,0 +1,262 @@
+#include "Graphics/Culling.h"
+#include "Graphics/RenderView.h"
+
+#include <cmath>
+#include <initializer_list>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULL_AVX 1
+static const size_t CULL_WIDTH = 8;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULL_SSE 1
+static const size_t CULL_WIDTH = 4;
+#else
+static const size_t CULL_WIDTH = 1;
+#endif
+
+// The arrays are padded to this so every SIMD width can run without a tail
+static const size_t CULL_PADDING = 8;
+
+// Frustum
+//-----------------------------------------------------------
+Frustum Frustum::FromMatrix(const glm::mat4& m)
+{
+	// glm is column major, m[c][r]
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0;	// Left
+	frustum.planes[1] = row3 - row0;	// Right
+	frustum.planes[2] = row3 + row1;	// Bottom
+	frustum.planes[3] = row3 - row1;	// Top
+	frustum.planes[4] = row3 + row2;	// Near
+	frustum.planes[5] = row3 - row2;	// Far
+
+	for (glm::vec4& plane : frustum.planes)
+	{
+		float length = glm::length(glm::vec3(plane));
+		if (length > 0.0f)
+			plane /= length;
+	}
+	return frustum;
+}
+
+bool Frustum::intersects(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const
+{
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+	for (const glm::vec4& plane : planes)
+	{
+		glm::vec3 normal = glm::vec3(plane);
+		if (glm::dot(normal, center) + plane.w + glm::dot(glm::abs(normal), extent) < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+
+void TransformBounds(const glm::vec3& localMin, const glm::vec3& localMax, const glm::mat4& transform, glm::vec3& worldMin, glm::vec3& worldMax)
+{
+	// Arvo: the new extent is the old one through the absolute rotation/scale part
+	glm::vec3 center = glm::vec3(transform * glm::vec4((localMin + localMax) * 0.5f, 1.0f));
+	glm::vec3 extent = (localMax - localMin) * 0.5f;
+	glm::mat3 basis = glm::mat3(transform);
+	glm::vec3 worldExtent = glm::abs(basis[0]) * extent.x + glm::abs(basis[1]) * extent.y + glm::abs(basis[2]) * extent.z;
+
+	worldMin = center - worldExtent;
+	worldMax = center + worldExtent;
+}
+
+
+// FrustumCuller
+//-----------------------------------------------------------
+// Planes split into lanes, a* = |n*| for the box extent projection
+struct CullPlanes
+{
+	float nx[6], ny[6], nz[6], w[6];
+	float ax[6], ay[6], az[6];
+};
+
+// Small-object test: culled if radius * scale < minPixelSize * distance
+struct SmallObjectTest
+{
+	bool enabled;
+	float px, py, pz;
+	float scale;
+	float minPixelSize;
+};
+
+// Returns the lanes inside the frustum, smallMask gets the lanes below the pixel threshold
+static unsigned int cullBlock(const float* cx, const float* cy, const float* cz, const float* ex, const float* ey, const float* ez,
+	const CullPlanes& planes, const SmallObjectTest& small, unsigned int& smallMask)
+{
+#if defined(CULL_AVX)
+	__m256 centerX = _mm256_loadu_ps(cx), centerY = _mm256_loadu_ps(cy), centerZ = _mm256_loadu_ps(cz);
+	__m256 extentX = _mm256_loadu_ps(ex), extentY = _mm256_loadu_ps(ey), extentZ = _mm256_loadu_ps(ez);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+
+	for (int p = 0; p < 6; p++)
+	{
+		__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(centerX, _mm256_set1_ps(planes.nx[p])), _mm256_mul_ps(centerY, _mm256_set1_ps(planes.ny[p]))),
+			_mm256_add_ps(_mm256_mul_ps(centerZ, _mm256_set1_ps(planes.nz[p])), _mm256_set1_ps(planes.w[p])));
+		__m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(extentX, _mm256_set1_ps(planes.ax[p])), _mm256_mul_ps(extentY, _mm256_set1_ps(planes.ay[p]))),
+			_mm256_mul_ps(extentZ, _mm256_set1_ps(planes.az[p])));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+	}
+
+	smallMask = 0;
+	if (small.enabled)
+	{
+		__m256 dx = _mm256_sub_ps(centerX, _mm256_set1_ps(small.px));
+		__m256 dy = _mm256_sub_ps(centerY, _mm256_set1_ps(small.py));
+		__m256 dz = _mm256_sub_ps(centerZ, _mm256_set1_ps(small.pz));
+		__m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)));
+		__m256 radius = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(extentX, extentX), _mm256_mul_ps(extentY, extentY)), _mm256_mul_ps(extentZ, extentZ)));
+		__m256 tooSmall = _mm256_cmp_ps(_mm256_mul_ps(radius, _mm256_set1_ps(small.scale)), _mm256_mul_ps(distance, _mm256_set1_ps(small.minPixelSize)), _CMP_LT_OQ);
+		smallMask = (unsigned int)_mm256_movemask_ps(tooSmall);
+	}
+	return (unsigned int)_mm256_movemask_ps(inside);
+#elif defined(CULL_SSE)
+	__m128 centerX = _mm_loadu_ps(cx), centerY = _mm_loadu_ps(cy), centerZ = _mm_loadu_ps(cz);
+	__m128 extentX = _mm_loadu_ps(ex), extentY = _mm_loadu_ps(ey), extentZ = _mm_loadu_ps(ez);
+	__m128 zero = _mm_setzero_ps();
+	__m128 inside = _mm_cmpeq_ps(zero, zero);
+
+	for (int p = 0; p < 6; p++)
+	{
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(centerX, _mm_set1_ps(planes.nx[p])), _mm_mul_ps(centerY, _mm_set1_ps(planes.ny[p]))),
+			_mm_add_ps(_mm_mul_ps(centerZ, _mm_set1_ps(planes.nz[p])), _mm_set1_ps(planes.w[p])));
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(extentX, _mm_set1_ps(planes.ax[p])), _mm_mul_ps(extentY, _mm_set1_ps(planes.ay[p]))),
+			_mm_mul_ps(extentZ, _mm_set1_ps(planes.az[p])));
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+	}
+
+	smallMask = 0;
+	if (small.enabled)
+	{
+		__m128 dx = _mm_sub_ps(centerX, _mm_set1_ps(small.px));
+		__m128 dy = _mm_sub_ps(centerY, _mm_set1_ps(small.py));
+		__m128 dz = _mm_sub_ps(centerZ, _mm_set1_ps(small.pz));
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		__m128 radius = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(extentX, extentX), _mm_mul_ps(extentY, extentY)), _mm_mul_ps(extentZ, extentZ)));
+		__m128 tooSmall = _mm_cmplt_ps(_mm_mul_ps(radius, _mm_set1_ps(small.scale)), _mm_mul_ps(distance, _mm_set1_ps(small.minPixelSize)));
+		smallMask = (unsigned int)_mm_movemask_ps(tooSmall);
+	}
+	return (unsigned int)_mm_movemask_ps(inside);
+#else
+	bool inside = true;
+	for (int p = 0; p < 6 && inside; p++)
+	{
+		float d = cx[0] * planes.nx[p] + cy[0] * planes.ny[p] + cz[0] * planes.nz[p] + planes.w[p];
+		float r = ex[0] * planes.ax[p] + ey[0] * planes.ay[p] + ez[0] * planes.az[p];
+		inside = d + r >= 0.0f;
+	}
+
+	smallMask = 0;
+	if (small.enabled)
+	{
+		float dx = cx[0] - small.px, dy = cy[0] - small.py, dz = cz[0] - small.pz;
+		float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+		float radius = std::sqrt(ex[0] * ex[0] + ey[0] * ey[0] + ez[0] * ez[0]);
+		smallMask = radius * small.scale < distance * small.minPixelSize ? 1u : 0u;
+	}
+	return inside ? 1u : 0u;
+#endif
+}
+
+void FrustumCuller::clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+	visibility.clear();
+	count = 0;
+}
+
+unsigned int FrustumCuller::add(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+
+	centerX.push_back(center.x);
+	centerY.push_back(center.y);
+	centerZ.push_back(center.z);
+	extentX.push_back(extent.x);
+	extentY.push_back(extent.y);
+	extentZ.push_back(extent.z);
+	return (unsigned int)count++;
+}
+
+unsigned int FrustumCuller::add(const glm::vec3& localMin, const glm::vec3& localMax, const glm::mat4& transform)
+{
+	glm::vec3 worldMin, worldMax;
+	TransformBounds(localMin, localMax, transform, worldMin, worldMax);
+	return add(worldMin, worldMax);
+}
+
+void FrustumCuller::cull(const RenderView& view)
+{
+	cullStats = CullStats();
+	cullStats.tested = (unsigned int)count;
+	visibility.assign(count, 0);
+	if (count == 0)
+		return;
+
+	CullPlanes planes;
+	for (int p = 0; p < 6; p++)
+	{
+		const glm::vec4& plane = view.frustum.planes[p];
+		planes.nx[p] = plane.x;
+		planes.ny[p] = plane.y;
+		planes.nz[p] = plane.z;
+		planes.w[p] = plane.w;
+		planes.ax[p] = std::abs(plane.x);
+		planes.ay[p] = std::abs(plane.y);
+		planes.az[p] = std::abs(plane.z);
+	}
+
+	// Projected diameter = 2 * radius * pixelsPerUnit(distance)
+	SmallObjectTest small;
+	small.enabled = minPixelSize > 0.0f;
+	small.px = view.position.x;
+	small.py = view.position.y;
+	small.pz = view.position.z;
+	small.scale = 2.0f * view.pixelsPerUnit(1.0f);
+	small.minPixelSize = minPixelSize;
+
+	// Pad with empty boxes, their lanes are ignored
+	size_t padded = (count + CULL_PADDING - 1) / CULL_PADDING * CULL_PADDING;
+	for (std::vector<float>* lane : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+		lane->resize(padded, 0.0f);
+
+	for (size_t i = 0; i < count; i += CULL_WIDTH)
+	{
+		unsigned int smallMask;
+		unsigned int insideMask = cullBlock(&centerX[i], &centerY[i], &centerZ[i], &extentX[i], &extentY[i], &extentZ[i], planes, small, smallMask);
+
+		for (size_t lane = 0; lane < CULL_WIDTH && i + lane < count; lane++)
+		{
+			if (!(insideMask & (1u << lane)))
+				cullStats.frustumCulled++;
+			else if (smallMask & (1u << lane))
+				cullStats.smallCulled++;
+			else
+				visibility[i + lane] = 1;
+		}
+	}
+
+	// Drop the padding so add() keeps appending after the real boxes
+	for (std::vector<float>* lane : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+		lane->resize(count);
+
+	cullStats.drawn = cullStats.tested - cullStats.frustumCulled - cullStats.smallCulled;
+}
@@ -0,0 +1,128 @@
+#include "Graphics/DeferredRenderer.h"
+#include "Graphics/GLState.h"
+
+#include <iostream>
+
+// Uniform name hashes, computed at compile time
+static constexpr uint64_t INVERSE_VIEW_PROJECTION_UNIFORM = HashLiteral("inverseViewProjection");
+static constexpr uint64_t DIR_LIGHT_COUNT_UNIFORM = HashLiteral("dirLightCount");
+static constexpr uint64_t SHADOWS_UNIFORM = HashLiteral("shadows");
+static constexpr uint64_t LOCAL_SHADOWS_UNIFORM = HashLiteral("localShadows");
+
+static GLuint createTarget(GLenum format, int width, int height)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	GLState::bindTexture(GL_TEXTURE_2D, texture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return texture;
+}
+
+DeferredRenderer::DeferredRenderer(const char* vertexPath, const char* fragmentPath)
+	: shader(vertexPath, fragmentPath)
+{
+	glGenVertexArrays(1, &emptyVertexArray);
+}
+
+DeferredRenderer::~DeferredRenderer()
+{
+	Delete();
+}
+
+void DeferredRenderer::beginGeometry(int width, int height)
+{
+	if (width <= 0 || height <= 0)
+		return;
+	if (width != this->width || height != this->height)
+		resize(width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	// Masks left off by a previous pass would keep the clear from reaching the targets
+	GLState::colorMask(GL_TRUE);
+	GLState::depthMask(GL_TRUE);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void DeferredRenderer::light(GLuint target, const RenderView& view, unsigned int dirLightCount, bool shadows, bool localShadows)
+{
+	if (!framebuffer)
+		return;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+
+	// Every pixel is written once, sky pixels are discarded and keep the target's clear color
+	GLState::depthFunc(GL_ALWAYS);
+	GLState::depthMask(GL_FALSE);
+
+	shader.use();
+	shader.setMat4(shader.uniform(INVERSE_VIEW_PROJECTION_UNIFORM), glm::inverse(view.projection * view.view));
+	shader.setInt(shader.uniform(DIR_LIGHT_COUNT_UNIFORM), (int)dirLightCount);
+	shader.setBool(shader.uniform(SHADOWS_UNIFORM), shadows);
+	shader.setBool(shader.uniform(LOCAL_SHADOWS_UNIFORM), localShadows);
+	// Sampler units are fixed by the shader's binding layouts
+	GLState::bindTexture(GBUFFER_ALBEDO_UNIT, GL_TEXTURE_2D, albedoTexture);
+	GLState::bindTexture(GBUFFER_NORMAL_UNIT, GL_TEXTURE_2D, normalTexture);
+	GLState::bindTexture(GBUFFER_DEPTH_UNIT, GL_TEXTURE_2D, depthTexture);
+
+	GLState::bindVertexArray(emptyVertexArray);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	GLState::depthMask(GL_TRUE);
+	GLState::depthFunc(GL_LESS);
+
+	// The sky and anything drawn after lighting depth test against the opaque surfaces
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+}
+
+void DeferredRenderer::resize(int width, int height)
+{
+	deleteTargets();
+	this->width = width;
+	this->height = height;
+
+	albedoTexture = createTarget(GL_RGBA8, width, height);
+	normalTexture = createTarget(GL_RGBA16, width, height);
+	// Same format as the default framebuffer's depth, blits need matching depth formats
+	depthTexture = createTarget(GL_DEPTH24_STENCIL8, width, height);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+	const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "ERROR::DEFERRED::GBUFFER_INCOMPLETE" << std::endl;
+}
+
+void DeferredRenderer::deleteTargets()
+{
+	if (framebuffer)
+		glDeleteFramebuffers(1, &framebuffer);
+	framebuffer = 0;
+	GLState::deleteTexture(albedoTexture);
+	GLState::deleteTexture(normalTexture);
+	GLState::deleteTexture(depthTexture);
+	albedoTexture = normalTexture = depthTexture = 0;
+	width = height = 0;
+}
+
+void DeferredRenderer::Delete()
+{
+	deleteTargets();
+	if (emptyVertexArray)
+		GLState::deleteVertexArray(emptyVertexArray);
+	emptyVertexArray = 0;
+	shader.Delete();
+}
@@ -0,0 +1,116 @@
+#include "Graphics/FileWatcher.h"
+
+#include <iostream>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/inotify.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher(const std::string& directory)
+	: directory(directory), inotifyDescriptor(-1)
+{
+	inotifyDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyDescriptor < 0 || inotify_add_watch(inotifyDescriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		std::cout << "ERROR::FILE_WATCHER::CANNOT_WATCH: " << directory << std::endl;
+		if (inotifyDescriptor >= 0)
+			close(inotifyDescriptor);
+		inotifyDescriptor = -1;
+	}
+}
+
+FileWatcher::~FileWatcher()
+{
+	if (inotifyDescriptor >= 0)
+		close(inotifyDescriptor);
+}
+
+std::vector<std::string> FileWatcher::poll()
+{
+	std::vector<std::string> changed;
+	if (inotifyDescriptor < 0)
+		return changed;
+
+	// Editors often save through a temporary file and a rename, IN_MOVED_TO catches those
+	alignas(inotify_event) char buffer[4096];
+	for (;;)
+	{
+		ssize_t length = read(inotifyDescriptor, buffer, sizeof(buffer));
+		if (length <= 0)
+			break;
+
+		for (ssize_t offset = 0; offset < length;)
+		{
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+			if (event->len > 0 && !(event->mask & IN_ISDIR))
+			{
+				std::string file = directory + "/" + event->name;
+				bool seen = false;
+				for (const std::string& name : changed)
+					seen = seen || name == file;
+				if (!seen)
+					changed.push_back(file);
+			}
+			offset += sizeof(inotify_event) + event->len;
+		}
+	}
+	return changed;
+}
+
+#else
+
+FileWatcher::FileWatcher(const std::string& directory)
+	: directory(directory), lastPoll(std::chrono::steady_clock::now())
+{
+	modifiedTimes = scan();
+}
+
+FileWatcher::~FileWatcher() {}
+
+std::vector<std::string> FileWatcher::poll()
+{
+	std::vector<std::string> changed;
+	auto now = std::chrono::steady_clock::now();
+	if (std::chrono::duration<double>(now - lastPoll).count() < POLL_INTERVAL)
+		return changed;
+	lastPoll = now;
+
+	std::unordered_map<std::string, long long> current = scan();
+	for (const auto& file : current)
+	{
+		auto previous = modifiedTimes.find(file.first);
+		if (previous == modifiedTimes.end() || previous->second != file.second)
+			changed.push_back(directory + "/" + file.first);
+	}
+	modifiedTimes = std::move(current);
+	return changed;
+}
+
+std::unordered_map<std::string, long long> FileWatcher::scan() const
+{
+	std::unordered_map<std::string, long long> times;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((directory + "/*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return times;
+	do
+	{
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			times[data.cFileName] = ((long long)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#endif
+	return times;
+}
+
+#endif
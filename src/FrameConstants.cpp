@@ -0,0 +1,32 @@
+#include "Graphics/FrameConstants.h"
+#include "Graphics/GLState.h"
+
+FrameConstantsBuffer::FrameConstantsBuffer()
+	: UBO(0)
+{
+	glGenBuffers(1, &UBO);
+	GLState::bindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameConstants), nullptr, GL_DYNAMIC_DRAW);
+}
+
+FrameConstantsBuffer::~FrameConstantsBuffer()
+{
+	Delete();
+}
+
+void FrameConstantsBuffer::update(const FrameConstants& constants)
+{
+	if (!UBO)
+		return;
+
+	GLState::bindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameConstants), &constants);
+	GLState::bindBufferBase(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_BINDING, UBO);
+}
+
+void FrameConstantsBuffer::Delete()
+{
+	if (UBO)
+		GLState::deleteBuffer(UBO);
+	UBO = 0;
+}
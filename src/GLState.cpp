@@ -0,0 +1,270 @@
+#include "Graphics/GLState.h"
+
+// Sentinel for state that is not known, no GL name or enum has this value
+static const GLuint UNKNOWN = ~0u;
+
+// Texture targets tracked per unit
+static const GLenum TEXTURE_TARGETS[] = { GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_2D_ARRAY };
+static const unsigned int TEXTURE_TARGET_COUNT = sizeof(TEXTURE_TARGETS) / sizeof(TEXTURE_TARGETS[0]);
+
+// Generic buffer targets
+static const GLenum BUFFER_TARGETS[] = { GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_SHADER_STORAGE_BUFFER, GL_PIXEL_UNPACK_BUFFER,
+	GL_DRAW_INDIRECT_BUFFER, GL_DISPATCH_INDIRECT_BUFFER, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER };
+static const unsigned int BUFFER_TARGET_COUNT = sizeof(BUFFER_TARGETS) / sizeof(BUFFER_TARGETS[0]);
+
+struct StateCache
+{
+	GLuint program;
+	GLuint vertexArray;
+	GLuint activeUnit;
+	GLuint textures[GLState::MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+	GLuint buffers[BUFFER_TARGET_COUNT];
+	GLuint uniformBuffers[GLState::MAX_BUFFER_BINDINGS];
+	GLuint storageBuffers[GLState::MAX_BUFFER_BINDINGS];
+	GLuint depthFunc;
+	GLuint depthMask;
+	GLuint colorMask;
+	GLuint polygonMode;
+	GLStateStats stats;
+
+	StateCache() { reset(); }
+
+	void reset()
+	{
+		program = vertexArray = activeUnit = UNKNOWN;
+		for (auto& unit : textures)
+			for (GLuint& texture : unit)
+				texture = UNKNOWN;
+		for (GLuint& buffer : buffers)
+			buffer = UNKNOWN;
+		for (unsigned int i = 0; i < GLState::MAX_BUFFER_BINDINGS; i++)
+			uniformBuffers[i] = storageBuffers[i] = UNKNOWN;
+		depthFunc = depthMask = colorMask = polygonMode = UNKNOWN;
+	}
+};
+
+static StateCache& cache()
+{
+	static StateCache state;
+	return state;
+}
+
+// Stores value in slot, returns whether the call has to be issued
+static bool update(GLuint& slot, GLuint value)
+{
+	StateCache& state = cache();
+	if (slot == value)
+	{
+		state.stats.skipped++;
+		return false;
+	}
+	slot = value;
+	state.stats.issued++;
+	return true;
+}
+
+static int textureTargetIndex(GLenum target)
+{
+	for (unsigned int i = 0; i < TEXTURE_TARGET_COUNT; i++)
+	{
+		if (TEXTURE_TARGETS[i] == target)
+			return (int)i;
+	}
+	return -1;
+}
+
+static GLuint* bufferSlot(GLenum target)
+{
+	for (unsigned int i = 0; i < BUFFER_TARGET_COUNT; i++)
+	{
+		if (BUFFER_TARGETS[i] == target)
+			return &cache().buffers[i];
+	}
+	return nullptr;
+}
+
+static GLuint* indexedBufferSlot(GLenum target, GLuint index)
+{
+	if (index >= GLState::MAX_BUFFER_BINDINGS)
+		return nullptr;
+	if (target == GL_UNIFORM_BUFFER)
+		return &cache().uniformBuffers[index];
+	if (target == GL_SHADER_STORAGE_BUFFER)
+		return &cache().storageBuffers[index];
+	return nullptr;
+}
+
+void GLState::useProgram(GLuint program)
+{
+	if (update(cache().program, program))
+		glUseProgram(program);
+}
+
+void GLState::bindVertexArray(GLuint vertexArray)
+{
+	if (update(cache().vertexArray, vertexArray))
+		glBindVertexArray(vertexArray);
+}
+
+void GLState::bindTexture(unsigned int unit, GLenum target, GLuint texture)
+{
+	StateCache& state = cache();
+	int targetIndex = textureTargetIndex(target);
+	if (unit < MAX_TEXTURE_UNITS && targetIndex >= 0 && state.textures[unit][targetIndex] == texture)
+	{
+		state.stats.skipped++;
+		return;
+	}
+
+	if (update(state.activeUnit, unit))
+		glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(target, texture);
+	state.stats.issued++;
+	if (unit < MAX_TEXTURE_UNITS && targetIndex >= 0)
+		state.textures[unit][targetIndex] = texture;
+}
+
+void GLState::bindTexture(GLenum target, GLuint texture)
+{
+	StateCache& state = cache();
+	if (state.activeUnit == UNKNOWN)
+	{
+		glActiveTexture(GL_TEXTURE0);
+		state.activeUnit = 0;
+		state.stats.issued++;
+	}
+	bindTexture(state.activeUnit, target, texture);
+}
+
+void GLState::bindBuffer(GLenum target, GLuint buffer)
+{
+	GLuint* slot = bufferSlot(target);
+	if (!slot)
+	{
+		glBindBuffer(target, buffer);
+		cache().stats.issued++;
+		return;
+	}
+	if (update(*slot, buffer))
+		glBindBuffer(target, buffer);
+}
+
+void GLState::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	GLuint* slot = indexedBufferSlot(target, index);
+	if (slot && !update(*slot, buffer))
+		return;
+	if (!slot)
+		cache().stats.issued++;
+
+	// Also binds the generic target
+	glBindBufferBase(target, index, buffer);
+	if (GLuint* generic = bufferSlot(target))
+		*generic = buffer;
+}
+
+void GLState::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	// Also binds the generic target
+	glBindBufferRange(target, index, buffer, offset, size);
+	cache().stats.issued++;
+	if (GLuint* slot = indexedBufferSlot(target, index))
+		*slot = UNKNOWN;
+	if (GLuint* generic = bufferSlot(target))
+		*generic = buffer;
+}
+
+void GLState::depthFunc(GLenum func)
+{
+	if (update(cache().depthFunc, func))
+		glDepthFunc(func);
+}
+
+void GLState::depthMask(GLboolean write)
+{
+	if (update(cache().depthMask, write))
+		glDepthMask(write);
+}
+
+void GLState::colorMask(GLboolean write)
+{
+	if (update(cache().colorMask, write))
+		glColorMask(write, write, write, write);
+}
+
+void GLState::polygonMode(GLenum mode)
+{
+	if (update(cache().polygonMode, mode))
+		glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+void GLState::deleteProgram(GLuint program)
+{
+	if (!program)
+		return;
+	glDeleteProgram(program);
+
+	// A deleted program stays in use until another one is bound, but its name may be handed out again
+	if (cache().program == program)
+		cache().program = UNKNOWN;
+}
+
+void GLState::deleteVertexArray(GLuint vertexArray)
+{
+	if (!vertexArray)
+		return;
+	glDeleteVertexArrays(1, &vertexArray);
+	if (cache().vertexArray == vertexArray)
+		cache().vertexArray = 0;
+}
+
+void GLState::deleteTexture(GLuint texture)
+{
+	if (!texture)
+		return;
+	glDeleteTextures(1, &texture);
+	for (auto& unit : cache().textures)
+	{
+		for (GLuint& bound : unit)
+		{
+			if (bound == texture)
+				bound = 0;
+		}
+	}
+}
+
+void GLState::deleteBuffer(GLuint buffer)
+{
+	if (!buffer)
+		return;
+	glDeleteBuffers(1, &buffer);
+
+	StateCache& state = cache();
+	for (GLuint& bound : state.buffers)
+	{
+		if (bound == buffer)
+			bound = 0;
+	}
+	for (unsigned int i = 0; i < MAX_BUFFER_BINDINGS; i++)
+	{
+		if (state.uniformBuffers[i] == buffer)
+			state.uniformBuffers[i] = 0;
+		if (state.storageBuffers[i] == buffer)
+			state.storageBuffers[i] = 0;
+	}
+}
+
+void GLState::invalidate()
+{
+	cache().reset();
+}
+
+const GLStateStats& GLState::stats()
+{
+	return cache().stats;
+}
+
+void GLState::resetStats()
+{
+	cache().stats = GLStateStats();
+}
@@ -0,0 +1,192 @@
+#include "Graphics/GeometryPool.h"
+#include "Graphics/GLState.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Elements reserved when a pool is created, so small scenes never grow
+static const unsigned int INITIAL_VERTEX_CAPACITY = 1 << 16;
+static const unsigned int INITIAL_INDEX_CAPACITY = 1 << 18;
+
+std::vector<std::unique_ptr<GeometryPool>>& GeometryPool::pools()
+{
+	static std::vector<std::unique_ptr<GeometryPool>> all;
+	return all;
+}
+
+GeometryPool& GeometryPool::Get(VertexLayout layout, GLenum indexType)
+{
+	for (auto& pool : pools())
+	{
+		if (pool->layout == layout && pool->indexType == indexType)
+			return *pool;
+	}
+	pools().emplace_back(new GeometryPool(layout, indexType));
+	return *pools().back();
+}
+
+void GeometryPool::DeleteAll()
+{
+	for (auto& pool : pools())
+		pool->Delete();
+	pools().clear();
+}
+
+GeometryPool::GeometryPool(VertexLayout layout, GLenum indexType)
+	: layout(layout), indexType(indexType), VAO(0), VBO(0), EBO(0), positionVAO(0), positionVBO(0)
+{
+	glGenVertexArrays(1, &VAO);
+	glGenVertexArrays(1, &positionVAO);
+	growVertices(INITIAL_VERTEX_CAPACITY);
+	growIndices(INITIAL_INDEX_CAPACITY);
+}
+
+void GeometryPool::allocate(const void* vertexData, unsigned int vertexCount, const void* indexData, unsigned int indexCount, GLint& baseVertex, GLuint& firstIndex)
+{
+	const size_t stride = VertexStride(layout);
+	const size_t indexSize = IndexSize(indexType);
+
+	unsigned int vertexOffset = vertexRanges.allocate(vertexCount);
+	if (vertexRanges.end > vertexRanges.capacity)
+		growVertices(std::max(vertexRanges.end, vertexRanges.capacity * 2));
+	unsigned int indexOffset = indexRanges.allocate(indexCount);
+	if (indexRanges.end > indexRanges.capacity)
+		growIndices(std::max(indexRanges.end, indexRanges.capacity * 2));
+
+	GLState::bindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferSubData(GL_ARRAY_BUFFER, vertexOffset * stride, vertexCount * stride, vertexData);
+
+	// Positions lead every layout
+	const unsigned char* bytes = static_cast<const unsigned char*>(vertexData);
+	positionScratch.resize(vertexCount);
+	for (unsigned int i = 0; i < vertexCount; i++)
+		std::memcpy(&positionScratch[i], bytes + i * stride, sizeof(glm::vec3));
+	GLState::bindBuffer(GL_ARRAY_BUFFER, positionVBO);
+	glBufferSubData(GL_ARRAY_BUFFER, vertexOffset * sizeof(glm::vec3), vertexCount * sizeof(glm::vec3), positionScratch.data());
+	GLState::bindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset * indexSize, indexCount * indexSize, indexData);
+
+	baseVertex = (GLint)vertexOffset;
+	firstIndex = indexOffset;
+}
+
+void GeometryPool::free(GLint baseVertex, unsigned int vertexCount, GLuint firstIndex, unsigned int indexCount)
+{
+	vertexRanges.free((unsigned int)baseVertex, vertexCount);
+	indexRanges.free(firstIndex, indexCount);
+}
+
+void GeometryPool::growVertices(unsigned int capacity)
+{
+	const size_t stride = VertexStride(layout);
+	VBO = growBuffer(VBO, vertexRanges.capacity * stride, capacity * stride);
+	positionVBO = growBuffer(positionVBO, vertexRanges.capacity * sizeof(glm::vec3), capacity * sizeof(glm::vec3));
+	vertexRanges.capacity = capacity;
+
+	// Attribute pointers capture the buffer, set them up again
+	GLState::bindVertexArray(VAO);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, VBO);
+	SetupVertexAttributes(layout);
+
+	GLState::bindVertexArray(positionVAO);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, positionVBO);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+	GLState::bindVertexArray(0);
+}
+
+void GeometryPool::growIndices(unsigned int capacity)
+{
+	const size_t indexSize = IndexSize(indexType);
+	EBO = growBuffer(EBO, indexRanges.capacity * indexSize, capacity * indexSize);
+	indexRanges.capacity = capacity;
+
+	GLState::bindVertexArray(VAO);
+	GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	GLState::bindVertexArray(positionVAO);
+	GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	GLState::bindVertexArray(0);
+}
+
+GLuint GeometryPool::growBuffer(GLuint buffer, size_t usedBytes, size_t capacityBytes)
+{
+	// Copy targets, so neither the bound vertex array nor its element buffer is touched
+	GLuint grown;
+	glGenBuffers(1, &grown);
+	GLState::bindBuffer(GL_COPY_WRITE_BUFFER, grown);
+	glBufferData(GL_COPY_WRITE_BUFFER, capacityBytes, nullptr, GL_STATIC_DRAW);
+	if (buffer)
+	{
+		GLState::bindBuffer(GL_COPY_READ_BUFFER, buffer);
+		if (usedBytes)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+		GLState::deleteBuffer(buffer);
+	}
+	return grown;
+}
+
+void GeometryPool::Delete()
+{
+	GLState::deleteVertexArray(VAO);
+	GLState::deleteVertexArray(positionVAO);
+	GLState::deleteBuffer(VBO);
+	GLState::deleteBuffer(EBO);
+	GLState::deleteBuffer(positionVBO);
+	VAO = VBO = EBO = positionVAO = positionVBO = 0;
+	vertexRanges = RangeList();
+	indexRanges = RangeList();
+}
+
+unsigned int GeometryPool::RangeList::allocate(unsigned int count)
+{
+	for (size_t i = 0; i < freeRanges.size(); i++)
+	{
+		Range& range = freeRanges[i];
+		if (range.count < count)
+			continue;
+
+		unsigned int offset = range.offset;
+		range.offset += count;
+		range.count -= count;
+		if (range.count == 0)
+			freeRanges.erase(freeRanges.begin() + i);
+		return offset;
+	}
+
+	unsigned int offset = end;
+	end += count;
+	return offset;
+}
+
+void GeometryPool::RangeList::free(unsigned int offset, unsigned int count)
+{
+	if (count == 0)
+		return;
+
+	auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(), offset, [](const Range& range, unsigned int value) { return range.offset < value; });
+	auto inserted = freeRanges.insert(next, { offset, count });
+
+	// Merge with the following and the preceding range
+	auto following = inserted + 1;
+	if (following != freeRanges.end() && inserted->offset + inserted->count == following->offset)
+	{
+		inserted->count += following->count;
+		freeRanges.erase(following);
+	}
+	if (inserted != freeRanges.begin())
+	{
+		auto preceding = inserted - 1;
+		if (preceding->offset + preceding->count == inserted->offset)
+		{
+			preceding->count += inserted->count;
+			inserted = freeRanges.erase(inserted) - 1;
+		}
+	}
+
+	// A range reaching the end gives the space back to it
+	if (inserted->offset + inserted->count == end)
+	{
+		end = inserted->offset;
+		freeRanges.erase(inserted);
+	}
+}
@@ -0,0 +1,339 @@
+#include "Graphics/GpuCuller.h"
+#include "Graphics/GLState.h"
+#include "Graphics/MeshSimplifier.h"
+#include "Graphics/Model.h"
+#include "Graphics/ShaderHotReload.h"
+
+#include <algorithm>
+#include <iostream>
+
+// Unit the pyramid is sampled from during the cull pass, above the material texture arrays
+static const unsigned int PYRAMID_TEXTURE_UNIT = 8;
+
+static const GLuint CULL_GROUP_SIZE = 64;
+static const GLuint PYRAMID_GROUP_SIZE = 8;
+
+// Uniform name hashes, computed at compile time
+static constexpr uint64_t OBJECT_COUNT_UNIFORM = HashLiteral("objectCount");
+static constexpr uint64_t MESH_COUNT_UNIFORM = HashLiteral("meshCount");
+static constexpr uint64_t LOD_COUNT_UNIFORM = HashLiteral("lodCount");
+static constexpr uint64_t FRUSTUM_PLANES_UNIFORM = HashLiteral("frustumPlanes");
+static constexpr uint64_t VIEW_PROJECTION_UNIFORM = HashLiteral("viewProjection");
+static constexpr uint64_t VIEW_POSITION_UNIFORM = HashLiteral("viewPosition");
+static constexpr uint64_t LOD_SCALE_UNIFORM = HashLiteral("lodScale");
+static constexpr uint64_t LOD_PIXEL_ERROR_UNIFORM = HashLiteral("lodPixelError");
+static constexpr uint64_t LOD_ERRORS_UNIFORM = HashLiteral("lodErrors");
+static constexpr uint64_t OCCLUSION_UNIFORM = HashLiteral("occlusion");
+static constexpr uint64_t DEPTH_PYRAMID_UNIFORM = HashLiteral("depthPyramid");
+static constexpr uint64_t PYRAMID_SIZE_UNIFORM = HashLiteral("pyramidSize");
+static constexpr uint64_t PYRAMID_LEVELS_UNIFORM = HashLiteral("pyramidLevels");
+static constexpr uint64_t GPU_CULLED_UNIFORM = HashLiteral("gpuCulled");
+static constexpr uint64_t DEPTH_TEXTURE_UNIFORM = HashLiteral("depthTexture");
+static constexpr uint64_t FIRST_LEVEL_UNIFORM = HashLiteral("firstLevel");
+static constexpr uint64_t SOURCE_SIZE_UNIFORM = HashLiteral("sourceSize");
+static constexpr uint64_t DESTINATION_SIZE_UNIFORM = HashLiteral("destinationSize");
+
+static GLuint createBuffer(GLenum target, size_t size, const void* data, GLenum usage)
+{
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	GLState::bindBuffer(target, buffer);
+	glBufferData(target, std::max<size_t>(size, 1), data, usage);
+	return buffer;
+}
+
+GpuCuller::GpuCuller(const char* cullPath, const char* pyramidPath)
+	: cullShader(cullPath), pyramidShader(pyramidPath)
+{
+	// Slots start at the storage buffer offset alignment, they are bound as ranges
+	GLint alignment = 1;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	statsStride = ((GLsizeiptr)sizeof(GpuCullStats) + alignment - 1) / alignment * alignment;
+
+	// Coherent, so the counters show up in the mapping once the fence after the barrier has signaled
+	const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &statsBuffer);
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, statsStride * STATS_FRAMES, nullptr, flags);
+	statsMapping = static_cast<const GpuCullStats*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, statsStride * STATS_FRAMES, flags));
+}
+
+void GpuCuller::setInstances(Model& model, const std::vector<glm::mat4>& transforms)
+{
+	this->model = &model;
+	model.nodes.update();
+	objectCount = (unsigned int)transforms.size();
+	lodCount = (unsigned int)std::min<size_t>(std::max<size_t>(model.lodErrors.size(), 1), MAX_LOD_LEVELS);
+	lodErrors.assign(MAX_LOD_LEVELS, 0.0f);
+	std::copy(model.lodErrors.begin(), model.lodErrors.begin() + std::min<size_t>(model.lodErrors.size(), MAX_LOD_LEVELS), lodErrors.begin());
+
+	// World bounds per instance, the scale and sphere radius feed the level selection
+	std::vector<CullObject> objects;
+	objects.reserve(transforms.size());
+	instances.clear();
+	instances.reserve(transforms.size());
+	for (const glm::mat4& transform : transforms)
+	{
+		float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+		glm::vec3 worldMin, worldMax;
+		TransformBounds(model.boundsMin, model.boundsMax, transform, worldMin, worldMax);
+		objects.push_back({ glm::vec4(worldMin, scale), glm::vec4(worldMax, model.boundsRadius * scale) });
+		instances.add(transform);
+	}
+	instances.upload();
+
+	// Every command owns objectCount slots of the visible list, so appends never overlap
+	const unsigned int meshCount = (unsigned int)model.meshes.size();
+	commandTemplate.clear();
+	std::vector<DrawData> drawData;
+	for (unsigned int mesh = 0; mesh < meshCount; mesh++)
+	{
+		for (unsigned int lod = 0; lod < lodCount; lod++)
+		{
+			DrawElementsIndirectCommand command = model.meshes[mesh].IndirectCommand(lod, 0);
+			command.baseInstance = (GLuint)commandTemplate.size() * objectCount;
+			commandTemplate.push_back(command);
+		}
+
+		DrawData draw;
+		draw.model = model.meshTransform(mesh);
+		draw.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(draw.model))));
+		draw.params = glm::uvec4(0u);
+		drawData.push_back(draw);
+	}
+
+	GLState::deleteBuffer(objectBuffer);
+	GLState::deleteBuffer(commandBuffer);
+	GLState::deleteBuffer(visibleBuffer);
+	GLState::deleteBuffer(drawDataBuffer);
+	objectBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER, objects.size() * sizeof(CullObject), objects.data(), GL_STATIC_DRAW);
+	commandBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER, commandTemplate.size() * sizeof(DrawElementsIndirectCommand), commandTemplate.data(), GL_DYNAMIC_DRAW);
+	visibleBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER, commandTemplate.size() * objectCount * sizeof(glm::uvec2), nullptr, GL_DYNAMIC_COPY);
+	drawDataBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER, drawData.size() * sizeof(DrawData), drawData.data(), GL_STATIC_DRAW);
+}
+
+void GpuCuller::cull(const RenderView& view)
+{
+	if (!model || objectCount == 0 || !cullShader.ID)
+		return;
+
+	// The ring slot is reused every STATS_FRAMES frames, its counters are done by then
+	unsigned int frame = statsFrame;
+	statsFrame = (statsFrame + 1) % STATS_FRAMES;
+	readStats(frame);
+
+	// Cleared on the GPU, the CPU only ever reads the mapping
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+	glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, frame * statsStride, sizeof(GpuCullStats), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commandTemplate.size() * sizeof(DrawElementsIndirectCommand), commandTemplate.data());
+
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_OBJECT_BINDING, objectBuffer);
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMAND_BINDING, commandBuffer);
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_VISIBLE_BINDING, visibleBuffer);
+	GLState::bindBufferRange(GL_SHADER_STORAGE_BUFFER, CULL_STATS_BINDING, statsBuffer, frame * statsStride, sizeof(GpuCullStats));
+
+	cullShader.use();
+	cullShader.setUInt(cullShader.uniform(OBJECT_COUNT_UNIFORM), objectCount);
+	cullShader.setUInt(cullShader.uniform(MESH_COUNT_UNIFORM), (unsigned int)model->meshes.size());
+	cullShader.setUInt(cullShader.uniform(LOD_COUNT_UNIFORM), lodCount);
+	cullShader.setVec4Array(cullShader.uniform(FRUSTUM_PLANES_UNIFORM), view.frustum.planes, 6);
+	cullShader.setMat4(cullShader.uniform(VIEW_PROJECTION_UNIFORM), view.projection * view.view);
+	cullShader.setVec3(cullShader.uniform(VIEW_POSITION_UNIFORM), view.position);
+	cullShader.setFloat(cullShader.uniform(LOD_SCALE_UNIFORM), 0.5f * view.viewportHeight * view.projection[1][1] * view.lodBias);
+	cullShader.setFloat(cullShader.uniform(LOD_PIXEL_ERROR_UNIFORM), LOD_PIXEL_ERROR);
+	cullShader.setFloatArray(cullShader.uniform(LOD_ERRORS_UNIFORM), lodErrors.data(), (int)MAX_LOD_LEVELS);
+
+	// Last frame's pyramid, tested with this frame's matrices; the first frame and resizes skip the test
+	bool testOcclusion = occlusion && pyramidValid;
+	cullShader.setBool(cullShader.uniform(OCCLUSION_UNIFORM), testOcclusion);
+	cullShader.setInt(cullShader.uniform(DEPTH_PYRAMID_UNIFORM), (int)PYRAMID_TEXTURE_UNIT);
+	cullShader.setVec2(cullShader.uniform(PYRAMID_SIZE_UNIFORM), glm::vec2((float)pyramidWidth, (float)pyramidHeight));
+	cullShader.setInt(cullShader.uniform(PYRAMID_LEVELS_UNIFORM), testOcclusion ? pyramidLevels : 0);
+	if (testOcclusion)
+		GLState::bindTexture(PYRAMID_TEXTURE_UNIT, GL_TEXTURE_2D, pyramidTexture);
+
+	cullShader.dispatch((objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE);
+
+	// Commands and the visible list are consumed by indirect draws and vertex fetch, the counters by the mapping
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+
+	if (statsFences[frame])
+		glDeleteSync(statsFences[frame]);
+	statsFences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void GpuCuller::readStats(unsigned int frame)
+{
+	if (!statsFences[frame] || !statsMapping)
+		return;
+
+	// A status query, not a wait: an unfinished frame keeps the older counters
+	GLint status = GL_UNSIGNALED;
+	glGetSynciv(statsFences[frame], GL_SYNC_STATUS, 1, nullptr, &status);
+	if (status != GL_SIGNALED)
+		return;
+
+	cullStats = *reinterpret_cast<const GpuCullStats*>(reinterpret_cast<const char*>(statsMapping) + frame * statsStride);
+	glDeleteSync(statsFences[frame]);
+	statsFences[frame] = 0;
+}
+
+void GpuCuller::submit(RenderQueue& queue, ShaderPermutations& shaders, ShaderPermutation permutation, RenderPass pass)
+{
+	if (!model || objectCount == 0)
+		return;
+
+	for (unsigned int mesh = 0; mesh < model->meshes.size(); mesh++)
+	{
+		permutation.features = model->meshes[mesh].features;
+		queue.submitCustom(pass, shaders.get(permutation), 0.0f, [this, mesh](Shader& shader) { drawMesh(shader, mesh); });
+	}
+}
+
+void GpuCuller::drawMesh(Shader& shader, unsigned int mesh)
+{
+	Mesh& target = model->meshes[mesh];
+	target.bindMaterial(shader);
+	UniformHandle gpuCulled = shader.uniform(GPU_CULLED_UNIFORM);
+	shader.setBool(gpuCulled, true);
+
+	instances.bind();
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+	GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+	// baseInstance offsets divisor attributes, so instance i of a command reads visible[baseInstance + i]
+	// without gl_BaseInstance. The attribute is only enabled for these draws, the vertex array is shared.
+	GLState::bindVertexArray(target.VAO);
+	glVertexAttribIFormat(CULLED_INSTANCE_ATTRIBUTE, 2, GL_UNSIGNED_INT, 0);
+	glVertexAttribBinding(CULLED_INSTANCE_ATTRIBUTE, CULLED_INSTANCE_ATTRIBUTE);
+	glVertexBindingDivisor(CULLED_INSTANCE_ATTRIBUTE, 1);
+	glBindVertexBuffer(CULLED_INSTANCE_ATTRIBUTE, visibleBuffer, 0, sizeof(glm::uvec2));
+	glEnableVertexAttribArray(CULLED_INSTANCE_ATTRIBUTE);
+
+	// Levels without survivors have an instance count of 0 and cost nothing
+	const size_t offset = (size_t)mesh * lodCount * sizeof(DrawElementsIndirectCommand);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, target.indexType, (const void*)offset, (GLsizei)lodCount, 0);
+
+	glDisableVertexAttribArray(CULLED_INSTANCE_ATTRIBUTE);
+	shader.setBool(gpuCulled, false);
+}
+
+void GpuCuller::buildDepthPyramid(GLuint framebuffer, int width, int height)
+{
+	if (width <= 0 || height <= 0 || !pyramidShader.ID)
+		return;
+	if (width != pyramidWidth || height != pyramidHeight)
+		resizePyramid(width, height);
+
+	// Copy the depth out, the framebuffer's own attachment may not be a texture
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthFramebuffer);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	pyramidShader.use();
+	pyramidShader.setInt(pyramidShader.uniform(DEPTH_TEXTURE_UNIFORM), (int)PYRAMID_TEXTURE_UNIT);
+	UniformHandle firstLevel = pyramidShader.uniform(FIRST_LEVEL_UNIFORM);
+	UniformHandle sourceSize = pyramidShader.uniform(SOURCE_SIZE_UNIFORM);
+	UniformHandle destinationSize = pyramidShader.uniform(DESTINATION_SIZE_UNIFORM);
+	GLState::bindTexture(PYRAMID_TEXTURE_UNIT, GL_TEXTURE_2D, depthTexture);
+
+	int sourceWidth = width, sourceHeight = height;
+	for (int level = 0; level < pyramidLevels; level++)
+	{
+		int levelWidth = std::max(width >> level, 1);
+		int levelHeight = std::max(height >> level, 1);
+		pyramidShader.setBool(firstLevel, level == 0);
+		pyramidShader.setIVec2(sourceSize, glm::ivec2(sourceWidth, sourceHeight));
+		pyramidShader.setIVec2(destinationSize, glm::ivec2(levelWidth, levelHeight));
+		glBindImageTexture(0, pyramidTexture, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		pyramidShader.dispatch((levelWidth + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, (levelHeight + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		sourceWidth = levelWidth;
+		sourceHeight = levelHeight;
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	pyramidValid = true;
+}
+
+void GpuCuller::watch(ShaderHotReload& hotReload)
+{
+	hotReload.watch(&cullShader);
+	hotReload.watch(&pyramidShader);
+}
+
+void GpuCuller::resizePyramid(int width, int height)
+{
+	GLState::deleteTexture(depthTexture);
+	GLState::deleteTexture(pyramidTexture);
+	if (depthFramebuffer)
+		glDeleteFramebuffers(1, &depthFramebuffer);
+
+	pyramidWidth = width;
+	pyramidHeight = height;
+	pyramidLevels = 1;
+	while ((width >> pyramidLevels) > 0 || (height >> pyramidLevels) > 0)
+		pyramidLevels++;
+	pyramidValid = false;
+
+	// Same format as the default framebuffer's depth, blits need matching depth formats
+	glGenTextures(1, &depthTexture);
+	GLState::bindTexture(GL_TEXTURE_2D, depthTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenTextures(1, &pyramidTexture);
+	GLState::bindTexture(GL_TEXTURE_2D, pyramidTexture);
+	glTexStorage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	GLint boundFramebuffer = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &boundFramebuffer);
+	glGenFramebuffers(1, &depthFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, depthFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "ERROR::GPU_CULLER::DEPTH_FRAMEBUFFER_INCOMPLETE " << width << "x" << height << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)boundFramebuffer);
+}
+
+void GpuCuller::Delete()
+{
+	cullShader.Delete();
+	pyramidShader.Delete();
+	instances.Delete();
+	GLState::deleteBuffer(objectBuffer);
+	GLState::deleteBuffer(commandBuffer);
+	GLState::deleteBuffer(visibleBuffer);
+	GLState::deleteBuffer(drawDataBuffer);
+	objectBuffer = commandBuffer = visibleBuffer = drawDataBuffer = 0;
+	if (statsMapping)
+	{
+		GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		statsMapping = nullptr;
+	}
+	GLState::deleteBuffer(statsBuffer);
+	statsBuffer = 0;
+	for (unsigned int i = 0; i < STATS_FRAMES; i++)
+	{
+		if (statsFences[i])
+			glDeleteSync(statsFences[i]);
+		statsFences[i] = 0;
+	}
+	GLState::deleteTexture(depthTexture);
+	GLState::deleteTexture(pyramidTexture);
+	if (depthFramebuffer)
+		glDeleteFramebuffers(1, &depthFramebuffer);
+	depthTexture = pyramidTexture = depthFramebuffer = 0;
+	pyramidWidth = pyramidHeight = pyramidLevels = 0;
+	pyramidValid = false;
+	model = nullptr;
+	objectCount = 0;
+}
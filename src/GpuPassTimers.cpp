@@ -0,0 +1,80 @@
+#include "Graphics/GpuPassTimers.h"
+
+#include <algorithm>
+
+GpuPassTimers::GpuPassTimers(unsigned int timerCount)
+	: timerCount(std::min(timerCount, 32u)), queries(STATS_FRAMES * this->timerCount, 0u)
+{
+	glGenQueries((GLsizei)queries.size(), queries.data());
+	lastTimes.ms.assign(this->timerCount, 0.0f);
+}
+
+GpuPassTimers::~GpuPassTimers()
+{
+	Delete();
+}
+
+void GpuPassTimers::beginFrame()
+{
+	// The ring slot is reused every STATS_FRAMES frames, its queries are usually done by then
+	frame = statsFrame;
+	statsFrame = (statsFrame + 1) % STATS_FRAMES;
+	readTimes(frame);
+	queryMask[frame] = 0;
+	frameTag[frame] = 0;
+}
+
+void GpuPassTimers::begin(unsigned int timer)
+{
+	if (timing || timer >= timerCount || !query(frame, timer))
+		return;
+	glBeginQuery(GL_TIME_ELAPSED, query(frame, timer));
+	queryMask[frame] |= 1u << timer;
+	timing = true;
+}
+
+void GpuPassTimers::end()
+{
+	if (!timing)
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	timing = false;
+}
+
+void GpuPassTimers::readTimes(unsigned int frame)
+{
+	if (!queryMask[frame])
+		return;
+
+	// Only read finished queries, an unfinished frame keeps the older times
+	for (unsigned int timer = 0; timer < timerCount; timer++)
+	{
+		if (!(queryMask[frame] >> timer & 1))
+			continue;
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(query(frame, timer), GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return;
+	}
+
+	lastTimes.totalMs = 0.0f;
+	lastTimes.tag = frameTag[frame];
+	for (unsigned int timer = 0; timer < timerCount; timer++)
+	{
+		lastTimes.ms[timer] = 0.0f;
+		if (!(queryMask[frame] >> timer & 1))
+			continue;
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(query(frame, timer), GL_QUERY_RESULT, &nanoseconds);
+		lastTimes.ms[timer] = (float)(nanoseconds / 1.0e6);
+		lastTimes.totalMs += lastTimes.ms[timer];
+	}
+}
+
+void GpuPassTimers::Delete()
+{
+	if (!queries.empty() && queries[0])
+		glDeleteQueries((GLsizei)queries.size(), queries.data());
+	std::fill(queries.begin(), queries.end(), 0u);
+	timing = false;
+}
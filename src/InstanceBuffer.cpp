@@ -0,0 +1,62 @@
+#include "Graphics/InstanceBuffer.h"
+#include "Graphics/GLState.h"
+
+#include <algorithm>
+
+InstanceBuffer::InstanceBuffer()
+	: SSBO(0), capacity(0)
+{
+	glGenBuffers(1, &SSBO);
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+	Delete();
+}
+
+void InstanceBuffer::clear()
+{
+	instances.clear();
+}
+
+void InstanceBuffer::reserve(size_t count)
+{
+	instances.reserve(count);
+}
+
+void InstanceBuffer::add(const glm::mat4& model)
+{
+	InstanceData instance;
+	instance.model = model;
+	instance.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+	instances.push_back(instance);
+}
+
+void InstanceBuffer::upload()
+{
+	if (!SSBO)
+		return;
+
+	// Grow geometrically, otherwise re-specify the same size to orphan the old storage
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, SSBO);
+	size_t required = std::max<size_t>(instances.size(), 1);
+	if (required > capacity)
+		capacity = std::max(required, capacity * 2);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(InstanceData), nullptr, GL_STREAM_DRAW);
+	if (!instances.empty())
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, instances.size() * sizeof(InstanceData), instances.data());
+}
+
+void InstanceBuffer::bind() const
+{
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BUFFER_BINDING, SSBO);
+}
+
+void InstanceBuffer::Delete()
+{
+	if (SSBO)
+		GLState::deleteBuffer(SSBO);
+	SSBO = 0;
+	capacity = 0;
+	instances.clear();
+}
@@ -1,56 +1,259 @@
 #include "Graphics/Light.h"
+#include "Graphics/GLState.h"
 
-// Light class
-Light::Light(const glm::vec3& color) : color(color) {}
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 
-Light::~Light() {}
+float LightRange(const glm::vec3& color, float constant, float linear, float quadratic) {
+    // Solve constant + linear * d + quadratic * d^2 = brightness / LIGHT_CUTOFF
+    float target = std::max(color.r, std::max(color.g, color.b)) / LIGHT_CUTOFF;
+    if (target <= constant)
+        return 0.0f;
+    if (quadratic > 0.0f)
+        return (-linear + std::sqrt(linear * linear + 4.0f * quadratic * (target - constant))) / (2.0f * quadratic);
+    if (linear > 0.0f)
+        return (target - constant) / linear;
+    return FLT_MAX;
+}
+
+// Distance at which a packed light falls below LIGHT_CUTOFF, zero for directional lights
+static float PackedRange(const GpuLight& gpuLight) {
+    glm::vec3 color = glm::vec3(gpuLight.color);
+    switch ((LightType)(int)gpuLight.color.w) {
+    case LightType::Point:
+        return LightRange(color, gpuLight.params.x, gpuLight.params.y, gpuLight.params.z);
+    case LightType::Spot:
+        // Spot lights fall off with the inverse square distance
+        return LightRange(color, 0.0f, 0.0f, 1.0f);
+    default:
+        return 0.0f;
+    }
+}
 
 
-// DirectionalLight class
+// DirectionalLight
 DirectionalLight::DirectionalLight(const glm::vec3& color, const glm::vec3& direction)
-    : Light(color), direction(direction) {}
+    : color(color), direction(direction) {}
 
-void DirectionalLight::SendToShader(Shader& shader, const std::string& name) {
-    shader.setVec3(name + ".color", color);
-    shader.setVec3(name + ".direction", direction);
+GpuLight DirectionalLight::Pack() const {
+    GpuLight gpuLight;
+    gpuLight.color = glm::vec4(color, (float)LightType::Directional);
+    gpuLight.position = glm::vec4(0.0f);
+    gpuLight.direction = glm::vec4(direction, 0.0f);
+    gpuLight.params = glm::vec4(0.0f);
+    return gpuLight;
 }
 
 
-// PointLight class
+// PointLight
 PointLight::PointLight(const glm::vec3& color, const glm::vec3& position, float constant, float linear, float quadratic)
-    : Light(color), position(position), constant(constant), linear(linear), quadratic(quadratic) {}
+    : color(color), position(position), constant(constant), linear(linear), quadratic(quadratic) {}
 
-void PointLight::SendToShader(Shader& shader, const std::string& name) {
-    shader.setVec3(name + ".color", color);
-    shader.setVec3(name + ".position", position);
-    shader.setFloat(name + ".constant", constant);
-    shader.setFloat(name + ".linear", linear);
-    shader.setFloat(name + ".quadratic", quadratic);
+GpuLight PointLight::Pack() const {
+    GpuLight gpuLight;
+    gpuLight.color = glm::vec4(color, (float)LightType::Point);
+    gpuLight.position = glm::vec4(position, 1.0f);
+    gpuLight.direction = glm::vec4(0.0f);
+    gpuLight.params = glm::vec4(constant, linear, quadratic, 0.0f);
+    gpuLight.params.w = PackedRange(gpuLight);
+    return gpuLight;
 }
 
 
-// SpotLight class
+// SpotLight
 SpotLight::SpotLight(const glm::vec3& color, const glm::vec3& position, const glm::vec3& direction, float cutOff, float outerCutOff)
-    : Light(color), position(position), direction(direction), cutOff(cutOff), outerCutOff(outerCutOff) {}
+    : color(color), position(position), direction(direction), cutOff(cutOff), outerCutOff(outerCutOff) {}
 
-void SpotLight::SendToShader(Shader& shader, const std::string& name) {
-    shader.setVec3(name + ".color", color);
-    shader.setVec3(name + ".position", position);
-    shader.setVec3(name + ".direction", direction);
-    shader.setFloat(name + ".cutOff", cutOff);
-    shader.setFloat(name + ".outerCutOff", outerCutOff);
+GpuLight SpotLight::Pack() const {
+    GpuLight gpuLight;
+    gpuLight.color = glm::vec4(color, (float)LightType::Spot);
+    gpuLight.position = glm::vec4(position, 1.0f);
+    gpuLight.direction = glm::vec4(direction, 0.0f);
+    gpuLight.params = glm::vec4(cutOff, outerCutOff, 0.0f, 0.0f);
+    gpuLight.params.w = PackedRange(gpuLight);
+    return gpuLight;
 }
 
 
 // LightManager class
-LightManager::LightManager() {}
+LightManager::LightManager() : SSBO(0), capacity(0), headerDirty(true), uploadedCount(0), typeEnd{ 0, 0, 0 } {}
+
+LightManager::~LightManager() {
+    Delete();
+}
+
+LightHandle LightManager::addLight(const DirectionalLight& light) {
+    return insert(light.Pack());
+}
+
+LightHandle LightManager::addLight(const PointLight& light) {
+    return insert(light.Pack());
+}
+
+LightHandle LightManager::addLight(const SpotLight& light) {
+    return insert(light.Pack());
+}
+
+LightHandle LightManager::insert(const GpuLight& light) {
+    int type = (int)light.color.w;
+
+    LightHandle handle;
+    if (!freeHandles.empty()) {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+    }
+    else {
+        handle = (LightHandle)slots.size();
+        slots.push_back(NO_LIGHT);
+    }
+
+    // Open a slot at the end of the type: the first light of every later type moves to the end of its type
+    gpuLights.emplace_back();
+    ids.push_back(NO_LIGHT);
+    dirty.push_back(0);
+    unsigned int hole = (unsigned int)gpuLights.size() - 1;
+    for (int later = 2; later > type; later--) {
+        unsigned int first = typeBegin((LightType)later);
+        if (first != hole)
+            move(first, hole);
+        hole = first;
+        typeEnd[later]++;
+    }
+    typeEnd[type]++;
+
+    gpuLights[hole] = light;
+    ids[hole] = handle;
+    slots[handle] = hole;
+    markDirty(hole);
+    headerDirty = true;
+    return handle;
+}
+
+void LightManager::removeLight(LightHandle light) {
+    if (light >= slots.size() || slots[light] == NO_LIGHT)
+        return;
+
+    int type = (int)gpuLights[slots[light]].color.w;
+    unsigned int hole = slots[light];
+    slots[light] = NO_LIGHT;
+    freeHandles.push_back(light);
+
+    // Close the gap with the last light of the type, then with the last light of every later type
+    for (int t = type; t < 3; t++) {
+        unsigned int last = typeEnd[t] - 1;
+        if (last != hole)
+            move(last, hole);
+        hole = last;
+        typeEnd[t]--;
+    }
+    gpuLights.pop_back();
+    ids.pop_back();
+    dirty.pop_back();
+    headerDirty = true;
+}
+
+void LightManager::move(unsigned int from, unsigned int to) {
+    gpuLights[to] = gpuLights[from];
+    ids[to] = ids[from];
+    slots[ids[to]] = to;
+    markDirty(to);
+}
+
+void LightManager::markDirty(unsigned int index) {
+    if (dirty[index])
+        return;
+    dirty[index] = 1;
+    dirtyList.push_back(index);
+}
+
+GpuLight& LightManager::edit(LightHandle light) {
+    markDirty(slots[light]);
+    return gpuLights[slots[light]];
+}
+
+void LightManager::setColor(LightHandle light, const glm::vec3& color) {
+    GpuLight& gpuLight = edit(light);
+    gpuLight.color = glm::vec4(color, gpuLight.color.w);
+    gpuLight.params.w = PackedRange(gpuLight);
+}
+
+void LightManager::setPosition(LightHandle light, const glm::vec3& position) {
+    edit(light).position = glm::vec4(position, 1.0f);
+}
+
+void LightManager::setDirection(LightHandle light, const glm::vec3& direction) {
+    GpuLight& gpuLight = edit(light);
+    gpuLight.direction = glm::vec4(direction, gpuLight.direction.w);
+}
+
+void LightManager::setAttenuation(LightHandle light, float constant, float linear, float quadratic) {
+    GpuLight& gpuLight = edit(light);
+    gpuLight.params = glm::vec4(constant, linear, quadratic, 0.0f);
+    gpuLight.params.w = PackedRange(gpuLight);
+}
+
+void LightManager::setCutOff(LightHandle light, float cutOff, float outerCutOff) {
+    GpuLight& gpuLight = edit(light);
+    gpuLight.params.x = cutOff;
+    gpuLight.params.y = outerCutOff;
+}
+
+void LightManager::setShadowTile(LightHandle light, int tile) {
+    edit(light).direction.w = (float)(tile + 1);
+}
+
+void LightManager::upload() {
+    // Created on first use so a LightManager can exist before the GL context
+    if (!SSBO)
+        glGenBuffers(1, &SSBO);
+
+    // The block starts with the light count padded to 16 bytes, followed by the lights
+    const GLsizeiptr headerSize = 4 * sizeof(GLuint);
+    // Dirty lights closer than this go out in one call, resending a few clean lights is cheaper than another call
+    const unsigned int MERGE_GAP = 16;
+
+    // Lights removed since they were flagged are past the end
+    std::sort(dirtyList.begin(), dirtyList.end());
+    dirtyList.erase(std::lower_bound(dirtyList.begin(), dirtyList.end(), (unsigned int)gpuLights.size()), dirtyList.end());
+    for (unsigned int index : dirtyList)
+        dirty[index] = 0;
+
+    GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, SSBO);
+    uploadedCount = 0;
+    size_t required = std::max<size_t>(gpuLights.size(), 1);
+    if (required > capacity) {
+        capacity = std::max(required, capacity * 2);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, headerSize + capacity * sizeof(GpuLight), nullptr, GL_DYNAMIC_DRAW);
+        if (!gpuLights.empty())
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, headerSize, gpuLights.size() * sizeof(GpuLight), gpuLights.data());
+        uploadedCount = (unsigned int)gpuLights.size();
+        headerDirty = true;
+    }
+    else {
+        for (size_t i = 0; i < dirtyList.size();) {
+            unsigned int first = dirtyList[i];
+            unsigned int last = first;
+            for (i++; i < dirtyList.size() && dirtyList[i] <= last + MERGE_GAP; i++)
+                last = dirtyList[i];
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, headerSize + first * sizeof(GpuLight), (last - first + 1) * sizeof(GpuLight), &gpuLights[first]);
+            uploadedCount += last - first + 1;
+        }
+    }
+    dirtyList.clear();
 
-LightManager::~LightManager() {}
+    if (headerDirty) {
+        GLuint header[4] = { (GLuint)gpuLights.size(), 0, 0, 0 };
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, headerSize, header);
+        headerDirty = false;
+    }
 
-void LightManager::addLight(std::shared_ptr<Light> light) {
-    lights.push_back(light);
+    GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_BINDING, SSBO);
 }
 
-void LightManager::removeLight(std::shared_ptr<Light> light) {
-    lights.erase(std::remove(lights.begin(), lights.end(), light), lights.end());
+void LightManager::Delete() {
+    if (SSBO)
+        GLState::deleteBuffer(SSBO);
+    SSBO = 0;
+    capacity = 0;
 }
@@ -0,0 +1,329 @@
+#include "Graphics/Material.h"
+#include "Graphics/AssetManager.h"
+#include "Graphics/GLState.h"
+#include "Graphics/Hash.h"
+#include "Graphics/TextureStreamer.h"
+
+#include <algorithm>
+#include <iostream>
+
+MaterialSlot MaterialSlotFromType(const std::string& textureType)
+{
+	if (textureType == "texture_diffuse")
+		return MATERIAL_SLOT_DIFFUSE;
+	if (textureType == "texture_specular")
+		return MATERIAL_SLOT_SPECULAR;
+	if (textureType == "texture_normal")
+		return MATERIAL_SLOT_NORMAL;
+	if (textureType == "texture_ambientOcclusion")
+		return MATERIAL_SLOT_AMBIENT_OCCLUSION;
+	return MATERIAL_SLOT_COUNT;
+}
+
+MaterialLibrary& MaterialLibrary::Shared()
+{
+	static MaterialLibrary library;
+	return library;
+}
+
+MaterialLibrary::MaterialLibrary()
+	: buffer(0), dirty(false)
+{
+	reserveDefault();
+}
+
+void MaterialLibrary::reserveDefault()
+{
+	// Counted once and resident, so release and update never touch it; it is not in byKey, no texture set maps to it
+	Entry entry = {};
+	entry.refCount = 1;
+	entry.resident = true;
+	entries.push_back(entry);
+
+	GpuMaterial material;
+	material.color = glm::vec4(1.0f, 1.0f, 1.0f, 32.0f);
+	material.arrays = glm::ivec4(-1);
+	material.layers = glm::ivec4(0);
+	materials.push_back(material);
+	dirty = true;
+}
+
+unsigned int MaterialLibrary::acquire(const std::vector<Texture>& textures, const std::string& directory, bool gamma)
+{
+	// The first texture of each slot is the one the shader samples
+	Entry entry = {};
+	for (const Texture& texture : textures)
+	{
+		MaterialSlot slot = MaterialSlotFromType(texture.textureType);
+		if (slot == MATERIAL_SLOT_COUNT || entry.textures[slot])
+			continue;
+		entry.textures[slot] = texture.ID;
+		entry.sources[slot] = HashValue(gamma, HashString(AssetManager::NormalizePath(directory + '/' + texture.path)));
+	}
+
+	uint64_t key = HASH_SEED;
+	for (uint64_t source : entry.sources)
+		key = HashValue(source, key);
+
+	auto found = byKey.find(key);
+	if (found != byKey.end())
+	{
+		entries[found->second].refCount++;
+		return found->second;
+	}
+
+	unsigned int index;
+	if (!freeEntries.empty())
+	{
+		index = freeEntries.back();
+		freeEntries.pop_back();
+	}
+	else if (entries.size() < MAX_MATERIALS)
+	{
+		index = (unsigned int)entries.size();
+		entries.emplace_back();
+		materials.emplace_back();
+	}
+	else
+	{
+		std::cout << "ERROR::MATERIAL::TABLE_FULL " << MAX_MATERIALS << " materials" << std::endl;
+		return NO_MATERIAL;
+	}
+
+	entry.key = key;
+	entry.refCount = 1;
+	entry.resident = false;
+	entries[index] = entry;
+
+	GpuMaterial& material = materials[index];
+	material.color = glm::vec4(1.0f, 1.0f, 1.0f, 32.0f);
+	material.arrays = glm::ivec4(-1);
+	material.layers = glm::ivec4(0);
+
+	byKey[key] = index;
+	dirty = true;
+	return index;
+}
+
+void MaterialLibrary::release(unsigned int material)
+{
+	if (material == NO_MATERIAL || material >= entries.size() || entries[material].refCount == 0)
+		return;
+
+	Entry& entry = entries[material];
+	if (--entry.refCount > 0)
+		return;
+
+	for (unsigned int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++)
+	{
+		if (materials[material].arrays[slot] >= 0)
+			releaseLayer(entry.sources[slot]);
+	}
+	byKey.erase(entry.key);
+	freeEntries.push_back(material);
+}
+
+void MaterialLibrary::setColor(unsigned int material, const glm::vec3& color)
+{
+	if (material == NO_MATERIAL || material >= materials.size())
+		return;
+	materials[material].color = glm::vec4(color, materials[material].color.a);
+	dirty = true;
+}
+
+void MaterialLibrary::setShininess(unsigned int material, float shininess)
+{
+	if (material == NO_MATERIAL || material >= materials.size())
+		return;
+	materials[material].color.a = shininess;
+	dirty = true;
+}
+
+bool MaterialLibrary::isResident(unsigned int material) const
+{
+	return material < entries.size() && entries[material].refCount > 0 && entries[material].resident;
+}
+
+void MaterialLibrary::update(const TextureStreamer* streamer)
+{
+	for (unsigned int i = 0; i < entries.size(); i++)
+	{
+		Entry& entry = entries[i];
+		if (entry.refCount == 0 || entry.resident)
+			continue;
+
+		entry.resident = true;
+		for (unsigned int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++)
+		{
+			if (entry.textures[slot] && materials[i].arrays[slot] < 0 && !resolve(entry, slot, materials[i], streamer))
+				entry.resident = false;
+		}
+	}
+
+	// Fixed size, so a growing table never reallocates the buffer
+	if (!buffer)
+	{
+		glGenBuffers(1, &buffer);
+		GLState::bindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * sizeof(GpuMaterial), nullptr, GL_DYNAMIC_DRAW);
+		dirty = true;
+	}
+	if (dirty)
+	{
+		GLState::bindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, materials.size() * sizeof(GpuMaterial), materials.data());
+	}
+	dirty = false;
+
+	GLState::bindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_BUFFER_BINDING, buffer);
+	for (unsigned int i = 0; i < arrays.size(); i++)
+		GLState::bindTexture(MATERIAL_TEXTURE_UNIT + i, GL_TEXTURE_2D_ARRAY, arrays[i].id);
+}
+
+bool MaterialLibrary::resolve(Entry& entry, unsigned int slot, GpuMaterial& material, const TextureStreamer* streamer)
+{
+	auto found = layers.find(entry.sources[slot]);
+	if (found == layers.end())
+	{
+		if (streamer && !streamer->isResident(entry.textures[slot]))
+			return false;
+
+		// A texture that cannot be copied keeps the default, it is not retried
+		Layer layer;
+		if (!copyToLayer(entry.textures[slot], layer))
+			return true;
+		layer.refCount = 0;
+		found = layers.emplace(entry.sources[slot], layer).first;
+	}
+
+	found->second.refCount++;
+	material.arrays[slot] = (int)found->second.array;
+	material.layers[slot] = (int)found->second.layer;
+	dirty = true;
+	return true;
+}
+
+bool MaterialLibrary::copyToLayer(GLuint texture, Layer& layer)
+{
+	GLint width = 0, height = 0, format = 0;
+	GLState::bindTexture(GL_TEXTURE_2D, texture);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+	if (width <= 0 || height <= 0)
+	{
+		std::cout << "ERROR::MATERIAL::EMPTY_TEXTURE " << texture << std::endl;
+		return false;
+	}
+
+	// Levels the source actually has, textures without a mip chain go into arrays without one
+	GLsizei levels = 1;
+	while ((width >> levels) > 0 || (height >> levels) > 0)
+	{
+		GLint levelWidth = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, levels, GL_TEXTURE_WIDTH, &levelWidth);
+		if (levelWidth == 0)
+			break;
+		levels++;
+	}
+
+	unsigned int index = findArray(width, height, (GLenum)format, levels);
+	if (index == ~0u)
+		return false;
+
+	TextureArray& array = arrays[index];
+	if (!array.freeLayers.empty())
+	{
+		layer.layer = array.freeLayers.back();
+		array.freeLayers.pop_back();
+	}
+	else
+	{
+		if (array.used == array.capacity)
+			grow(array, array.capacity * 2);
+		layer.layer = array.used++;
+	}
+	layer.array = index;
+
+	for (GLsizei level = 0; level < levels; level++)
+	{
+		glCopyImageSubData(texture, GL_TEXTURE_2D, level, 0, 0, 0, array.id, GL_TEXTURE_2D_ARRAY, level, 0, 0, (GLint)layer.layer,
+			std::max(width >> level, 1), std::max(height >> level, 1), 1);
+	}
+	return true;
+}
+
+unsigned int MaterialLibrary::findArray(GLsizei width, GLsizei height, GLenum format, GLsizei levels)
+{
+	for (unsigned int i = 0; i < arrays.size(); i++)
+	{
+		const TextureArray& array = arrays[i];
+		if (array.width == width && array.height == height && array.format == format && array.levels == levels)
+			return i;
+	}
+
+	if (arrays.size() >= MAX_MATERIAL_TEXTURE_ARRAYS)
+	{
+		std::cout << "ERROR::MATERIAL::TOO_MANY_TEXTURE_ARRAYS " << width << "x" << height << " format " << format << " needs a new array" << std::endl;
+		return ~0u;
+	}
+
+	TextureArray array = {};
+	array.width = width;
+	array.height = height;
+	array.format = format;
+	array.levels = levels;
+	grow(array, 1);
+	arrays.push_back(array);
+	return (unsigned int)arrays.size() - 1;
+}
+
+void MaterialLibrary::grow(TextureArray& array, unsigned int capacity)
+{
+	GLuint id;
+	glGenTextures(1, &id);
+	GLState::bindTexture(GL_TEXTURE_2D_ARRAY, id);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, array.levels, array.format, array.width, array.height, capacity);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, array.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	// Storage is immutable, move the used layers over
+	if (array.id)
+	{
+		for (GLsizei level = 0; level < array.levels; level++)
+		{
+			glCopyImageSubData(array.id, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, id, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+				std::max(array.width >> level, 1), std::max(array.height >> level, 1), (GLsizei)array.used);
+		}
+		GLState::deleteTexture(array.id);
+	}
+	array.id = id;
+	array.capacity = capacity;
+}
+
+void MaterialLibrary::releaseLayer(uint64_t source)
+{
+	auto found = layers.find(source);
+	if (found == layers.end() || --found->second.refCount > 0)
+		return;
+
+	arrays[found->second.array].freeLayers.push_back(found->second.layer);
+	layers.erase(found);
+}
+
+void MaterialLibrary::Delete()
+{
+	GLState::deleteBuffer(buffer);
+	buffer = 0;
+	for (TextureArray& array : arrays)
+		GLState::deleteTexture(array.id);
+	arrays.clear();
+	layers.clear();
+	entries.clear();
+	materials.clear();
+	freeEntries.clear();
+	byKey.clear();
+	reserveDefault();
+}
@@ -1,85 +1,164 @@
 #include "Graphics/Mesh.h"
+#include "Graphics/GLState.h"
+#include "Graphics/ShaderPermutations.h"
 
-Mesh::Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures) {
-    this->vertices = vertices;
-    this->indices = indices;
-    this->textures = textures;
+#include <algorithm>
+#include <cstring>
 
-    setupMesh();
-}
+// Uniform name hashes, computed at compile time
+static constexpr uint64_t PACKED_VERTICES_UNIFORM = HashLiteral("packedVertices");
+static constexpr uint64_t MATERIAL_INDEX_UNIFORM = HashLiteral("materialIndex");
 
-void Mesh::Draw(Shader& shader)
-{
-    std::map<std::string, unsigned int> textureTypeCounters;
-    textureTypeCounters["texture_diffuse"] = 1;
-    textureTypeCounters["texture_specular"] = 1;
-    textureTypeCounters["texture_normal"] = 1;
-    textureTypeCounters["texture_height"] = 1;
-    textureTypeCounters["texture_albedo"] = 1;
-    textureTypeCounters["texture_metallic"] = 1;
-    textureTypeCounters["texture_roughness"] = 1;
-    textureTypeCounters["texture_ambientOcclusion"] = 1;
-    textureTypeCounters["texture_emission"] = 1;
-
-    for (unsigned int i = 0; i < textures.size(); i++)
+Mesh::Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, VertexLayout layout, vector<MeshLod> lods) {
+    this->vertices = std::move(vertices);
+    this->indices = std::move(indices);
+    this->textures = std::move(textures);
+    this->lods = std::move(lods);
+    if (this->lods.empty())
+        this->lods.push_back({ 0, (unsigned int)this->indices.size(), 0.0f });
+    this->vertexCount = (unsigned int)this->vertices.size();
+    this->indexCount = (unsigned int)this->indices.size();
+    this->indexType = IndexType(this->vertices.size());
+    this->layout = layout;
+    computeBounds(this->vertices.data());
+    features = ShaderFeaturesFromTextures(this->textures);
+
+    vector<unsigned char> packedIndices = PackIndices(this->indices.data(), this->indices.size(), indexType);
+    if (layout == VertexLayout::Skinned)
+    {
+        setupMesh(this->vertices.data(), packedIndices.data());
+    }
+    else
     {
-        glActiveTexture(GL_TEXTURE0 + i); // Activate the proper texture unit before binding
+        vector<unsigned char> packed = PackVertices(this->vertices.data(), this->vertices.size(), layout);
+        setupMesh(packed.data(), packedIndices.data());
+    }
+}
 
-        string texType = textures[i].textureType;
-        string number = std::to_string(textureTypeCounters[texType]++);
+Mesh::Mesh(const void* vertexData, unsigned int vertexCount, VertexLayout layout, const void* indexData, unsigned int indexCount, GLenum indexType, vector<Texture> textures, vector<MeshLod> lods) {
+    this->textures = std::move(textures);
+    this->lods = std::move(lods);
+    if (this->lods.empty())
+        this->lods.push_back({ 0, indexCount, 0.0f });
+    this->vertexCount = vertexCount;
+    this->indexCount = indexCount;
+    this->indexType = indexType;
+    this->layout = layout;
+    computeBounds(vertexData);
+    features = ShaderFeaturesFromTextures(this->textures);
 
-        int uniformLocation = shader.getUniformLocation(texType + number);
-        glUniform1i(uniformLocation, i);
+    setupMesh(vertexData, indexData);
+}
 
-        // Bind the texture
-        glBindTexture(GL_TEXTURE_2D, textures[i].ID);
-    }
+void Mesh::Draw(Shader& shader, unsigned int lod)
+{
+    bindMaterial(shader);
 
     // Draw mesh
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    const MeshLod& level = lods[std::min(lod, (unsigned int)lods.size() - 1)];
+    GLState::bindVertexArray(VAO);
+    glDrawElementsBaseVertex(GL_TRIANGLES, level.indexCount, indexType, (void*)((size_t)(firstIndex + level.indexOffset) * IndexSize(indexType)), baseVertex);
+}
+
+void Mesh::DrawInstanced(Shader& shader, unsigned int instanceCount, unsigned int lod)
+{
+    if (instanceCount == 0)
+        return;
+
+    bindMaterial(shader);
+
+    // One draw for every instance, the vertex shader reads the transforms by gl_InstanceID
+    const MeshLod& level = lods[std::min(lod, (unsigned int)lods.size() - 1)];
+    GLState::bindVertexArray(VAO);
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, level.indexCount, indexType, (void*)((size_t)(firstIndex + level.indexOffset) * IndexSize(indexType)), instanceCount, baseVertex);
+}
+
+void Mesh::bindMaterial(Shader& shader)
+{
+    // Switching materials is one integer, the parameters and texture layers are looked up in the shader
+    shader.setInt(shader.uniform(MATERIAL_INDEX_UNIFORM), (int)material);
+
+    // Packed meshes carry octahedral normals
+    shader.setBool(shader.uniform(PACKED_VERTICES_UNIFORM), layout == VertexLayout::Packed);
+}
 
-    // Always good practice to set everything back to defaults once configured
-    glActiveTexture(GL_TEXTURE0);
+DrawElementsIndirectCommand Mesh::IndirectCommand(unsigned int lod, unsigned int instanceCount) const
+{
+    const MeshLod& level = lods[std::min(lod, (unsigned int)lods.size() - 1)];
+    return { level.indexCount, instanceCount, firstIndex + level.indexOffset, baseVertex, 0 };
+}
+
+void Mesh::Delete()
+{
+    // The pool's vertex array is shared, only the ranges go back
+    if (pooled)
+    {
+        GeometryPool::Get(layout, indexType).free(baseVertex, vertexCount, firstIndex, indexCount);
+        pooled = false;
+        VAO = positionVAO = 0;
+        return;
+    }
+
+    GLState::deleteVertexArray(VAO);
+    GLState::deleteBuffer(VBO);
+    GLState::deleteBuffer(EBO);
+    VAO = positionVAO = VBO = EBO = 0;
 }
 
-void Mesh::setupMesh()
+void Mesh::setupMesh(const void* vertexData, const void* indexData)
 {
+    // Static layouts share their pool's buffers, skinned meshes keep their own
+    if (layout != VertexLayout::Skinned)
+    {
+        GeometryPool& pool = GeometryPool::Get(layout, indexType);
+        pool.allocate(vertexData, vertexCount, indexData, indexCount, baseVertex, firstIndex);
+        VAO = pool.vertexArray();
+        positionVAO = pool.positionVertexArray();
+        VBO = EBO = 0;
+        pooled = true;
+        return;
+    }
+
     // create buffers/arrays
     glGenVertexArrays(1, &VAO);
+    positionVAO = VAO;
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
 
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-    // Positions
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-    // Normals
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-    // Texture coords
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-    // Tangent
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-    // Bitangent
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-    // Ids
-    glEnableVertexAttribArray(5);
-    glVertexAttribIPointer(5, MAX_BONE_INFLUENCE, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
-
-    // Weights
-    glEnableVertexAttribArray(6);
-    glVertexAttribPointer(6, MAX_BONE_INFLUENCE, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-    glBindVertexArray(0);
+    GLState::bindVertexArray(VAO);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * VertexStride(layout), vertexData, GL_STATIC_DRAW);
 
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * IndexSize(indexType), indexData, GL_STATIC_DRAW);
+
+    // Only the attributes of this mesh's layout are enabled
+    SetupVertexAttributes(layout);
+    GLState::bindVertexArray(0);
+}
+
+void Mesh::computeBounds(const void* vertexData)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(vertexData);
+    const size_t stride = VertexStride(layout);
+
+    glm::vec3 minimum(0.0f), maximum(0.0f);
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        glm::vec3 position;
+        memcpy(&position, bytes + i * stride, sizeof(position));
+        minimum = i == 0 ? position : glm::min(minimum, position);
+        maximum = i == 0 ? position : glm::max(maximum, position);
+    }
+
+    boundsMin = minimum;
+    boundsMax = maximum;
+    boundsCenter = (minimum + maximum) * 0.5f;
+    boundsRadius = 0.0f;
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        glm::vec3 position;
+        memcpy(&position, bytes + i * stride, sizeof(position));
+        boundsRadius = std::max(boundsRadius, glm::length(position - boundsCenter));
+    }
 }
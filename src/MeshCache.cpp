@@ -0,0 +1,403 @@
+#include "Graphics/MeshCache.h"
+#include "Graphics/Hash.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// MappedFile
+//-----------------------------------------------------------
+#ifdef _WIN32
+MappedFile::MappedFile()
+	: bytes(nullptr), length(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr) {}
+#else
+MappedFile::MappedFile()
+	: bytes(nullptr), length(0), fileDescriptor(-1) {}
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+#ifdef _WIN32
+	fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mappingHandle)
+	{
+		close();
+		return false;
+	}
+
+	bytes = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	length = (size_t)fileSize.QuadPart;
+#else
+	fileDescriptor = ::open(path.c_str(), O_RDONLY);
+	if (fileDescriptor < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fileDescriptor, &info) != 0 || info.st_size == 0)
+	{
+		close();
+		return false;
+	}
+
+	void* mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+	bytes = mapping == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(mapping);
+	length = (size_t)info.st_size;
+#endif
+
+	if (!bytes)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (bytes)
+		UnmapViewOfFile(bytes);
+	if (mappingHandle)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+	mappingHandle = nullptr;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (bytes)
+		munmap(const_cast<unsigned char*>(bytes), length);
+	if (fileDescriptor >= 0)
+		::close(fileDescriptor);
+	fileDescriptor = -1;
+#endif
+	bytes = nullptr;
+	length = 0;
+}
+
+
+// MeshCache
+//-----------------------------------------------------------
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+uint64_t MeshCache::HashFile(const std::string& path)
+{
+	MappedFile source;
+	if (!source.open(path))
+		return 0;
+
+	return HashBytes(source.data(), source.size());
+}
+
+std::string MeshCache::CachePath(const std::string& sourcePath)
+{
+	return sourcePath + ".fmesh";
+}
+
+bool MeshCache::Write(const std::string& cachePath, uint64_t sourceHash, unsigned int importFlags, VertexLayout layout, const std::vector<Mesh>& meshes,
+	const SceneGraph& nodes, const std::vector<unsigned int>& meshNodes)
+{
+	using namespace CookedMesh;
+
+	std::vector<MeshRecord> meshRecords(meshes.size());
+	std::vector<std::vector<unsigned char>> vertexBlobs(meshes.size());
+	std::vector<std::vector<unsigned char>> indexBlobs(meshes.size());
+	std::vector<TextureRecord> texRecords;
+	std::vector<LodRecord> lodRecords;
+	std::vector<NodeRecord> nodeRecords(nodes.size());
+	std::string stringTable;
+
+	for (unsigned int i = 0; i < nodes.size(); i++)
+	{
+		memcpy(nodeRecords[i].local, &nodes.local(i)[0][0], sizeof(nodeRecords[i].local));
+		nodeRecords[i].parent = nodes.parent(i);
+		nodeRecords[i].nameOffset = (uint32_t)stringTable.size();
+		nodeRecords[i].nameLength = (uint32_t)nodes.name(i).size();
+		nodeRecords[i].reserved = 0;
+		stringTable += nodes.name(i);
+	}
+
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		meshRecords[i].vertexCount = (uint32_t)meshes[i].vertices.size();
+		meshRecords[i].indexCount = (uint32_t)meshes[i].indices.size();
+		meshRecords[i].firstTexture = (uint32_t)texRecords.size();
+		meshRecords[i].textureCount = (uint32_t)meshes[i].textures.size();
+		meshRecords[i].vertexLayout = (uint32_t)meshes[i].layout;
+		meshRecords[i].vertexStride = (uint32_t)VertexStride(meshes[i].layout);
+		meshRecords[i].indexSize = (uint32_t)IndexSize(meshes[i].indexType);
+		meshRecords[i].firstLod = (uint32_t)lodRecords.size();
+		meshRecords[i].lodCount = (uint32_t)meshes[i].lods.size();
+		meshRecords[i].node = i < meshNodes.size() ? meshNodes[i] : NO_NODE;
+		for (const MeshLod& lod : meshes[i].lods)
+			lodRecords.push_back({ lod.indexOffset, lod.indexCount, lod.error, 0 });
+		vertexBlobs[i] = PackVertices(meshes[i].vertices.data(), meshes[i].vertices.size(), meshes[i].layout);
+		indexBlobs[i] = PackIndices(meshes[i].indices.data(), meshes[i].indices.size(), meshes[i].indexType);
+
+		for (const Texture& texture : meshes[i].textures)
+		{
+			TextureRecord record;
+			record.typeOffset = (uint32_t)stringTable.size();
+			record.typeLength = (uint32_t)texture.textureType.size();
+			stringTable += texture.textureType;
+			record.pathOffset = (uint32_t)stringTable.size();
+			record.pathLength = (uint32_t)texture.path.size();
+			stringTable += texture.path;
+			texRecords.push_back(record);
+		}
+	}
+
+	// Lay out the blobs after the tables
+	uint64_t offset = sizeof(FileHeader) + meshRecords.size() * sizeof(MeshRecord) + texRecords.size() * sizeof(TextureRecord) + lodRecords.size() * sizeof(LodRecord) + nodeRecords.size() * sizeof(NodeRecord);
+	FileHeader header = {};
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.sourceHash = sourceHash;
+	header.importFlags = importFlags;
+	header.vertexLayout = (uint32_t)layout;
+	header.meshCount = (uint32_t)meshRecords.size();
+	header.textureCount = (uint32_t)texRecords.size();
+	header.lodCount = (uint32_t)lodRecords.size();
+	header.nodeCount = (uint32_t)nodeRecords.size();
+	header.stringTableOffset = offset;
+	header.stringTableSize = stringTable.size();
+	offset += stringTable.size();
+
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		offset = alignUp(offset, 16);
+		meshRecords[i].vertexOffset = offset;
+		offset += vertexBlobs[i].size();
+
+		offset = alignUp(offset, 16);
+		meshRecords[i].indexOffset = offset;
+		offset += indexBlobs[i].size();
+	}
+
+	// Write to a temporary file first so a crash never leaves a half-written cache behind
+	std::string tempPath = cachePath + ".tmp";
+	std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cout << "ERROR::MESH_CACHE::CANNOT_WRITE: " << cachePath << std::endl;
+		return false;
+	}
+
+	uint64_t written = 0;
+	auto writeBytes = [&](const void* data, uint64_t size)
+	{
+		out.write(static_cast<const char*>(data), (std::streamsize)size);
+		written += size;
+	};
+	auto padTo = [&](uint64_t target)
+	{
+		static const char zeros[16] = {};
+		writeBytes(zeros, target - written);
+	};
+
+	writeBytes(&header, sizeof(header));
+	writeBytes(meshRecords.data(), meshRecords.size() * sizeof(MeshRecord));
+	writeBytes(texRecords.data(), texRecords.size() * sizeof(TextureRecord));
+	writeBytes(lodRecords.data(), lodRecords.size() * sizeof(LodRecord));
+	writeBytes(nodeRecords.data(), nodeRecords.size() * sizeof(NodeRecord));
+	writeBytes(stringTable.data(), stringTable.size());
+
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		padTo(meshRecords[i].vertexOffset);
+		writeBytes(vertexBlobs[i].data(), vertexBlobs[i].size());
+		padTo(meshRecords[i].indexOffset);
+		writeBytes(indexBlobs[i].data(), indexBlobs[i].size());
+	}
+
+	out.close();
+	if (!out)
+	{
+		std::remove(tempPath.c_str());
+		return false;
+	}
+
+	std::remove(cachePath.c_str());
+	return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
+
+bool MeshCache::open(const std::string& cachePath, uint64_t sourceHash, unsigned int importFlags, VertexLayout layout)
+{
+	close();
+
+	if (sourceHash == 0 || !file.open(cachePath))
+		return false;
+
+	if (file.size() < sizeof(CookedMesh::FileHeader))
+	{
+		close();
+		return false;
+	}
+
+	header = reinterpret_cast<const CookedMesh::FileHeader*>(file.data());
+	if (header->magic != CookedMesh::MAGIC || header->version != CookedMesh::VERSION ||
+		header->sourceHash != sourceHash || header->importFlags != importFlags ||
+		header->vertexLayout != (uint32_t)layout || !validate())
+	{
+		close();
+		return false;
+	}
+
+	records = reinterpret_cast<const CookedMesh::MeshRecord*>(file.data() + sizeof(CookedMesh::FileHeader));
+	textureRecords = reinterpret_cast<const CookedMesh::TextureRecord*>(records + header->meshCount);
+	lodRecords = reinterpret_cast<const CookedMesh::LodRecord*>(textureRecords + header->textureCount);
+	nodeRecords = reinterpret_cast<const CookedMesh::NodeRecord*>(lodRecords + header->lodCount);
+	strings = reinterpret_cast<const char*>(file.data() + header->stringTableOffset);
+	return true;
+}
+
+void MeshCache::close()
+{
+	file.close();
+	header = nullptr;
+	records = nullptr;
+	textureRecords = nullptr;
+	lodRecords = nullptr;
+	nodeRecords = nullptr;
+	strings = nullptr;
+}
+
+unsigned int MeshCache::meshCount() const
+{
+	return header ? header->meshCount : 0;
+}
+
+CookedMeshView MeshCache::mesh(unsigned int index) const
+{
+	const CookedMesh::MeshRecord& record = records[index];
+
+	CookedMeshView view;
+	view.vertices = file.data() + record.vertexOffset;
+	view.vertexCount = record.vertexCount;
+	view.vertexLayout = (VertexLayout)record.vertexLayout;
+	view.indices = file.data() + record.indexOffset;
+	view.indexCount = record.indexCount;
+	view.indexType = record.indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	view.node = record.node;
+
+	for (uint32_t i = 0; i < record.textureCount; i++)
+	{
+		const CookedMesh::TextureRecord& texture = textureRecords[record.firstTexture + i];
+		view.textures.push_back({
+			std::string(strings + texture.typeOffset, texture.typeLength),
+			std::string(strings + texture.pathOffset, texture.pathLength) });
+	}
+
+	for (uint32_t i = 0; i < record.lodCount; i++)
+	{
+		const CookedMesh::LodRecord& lod = lodRecords[record.firstLod + i];
+		view.lods.push_back({ lod.indexOffset, lod.indexCount, lod.error });
+	}
+	return view;
+}
+
+void MeshCache::loadNodes(SceneGraph& nodes) const
+{
+	nodes.clear();
+	for (uint32_t i = 0; header && i < header->nodeCount; i++)
+	{
+		const CookedMesh::NodeRecord& record = nodeRecords[i];
+		glm::mat4 local;
+		memcpy(&local[0][0], record.local, sizeof(record.local));
+		nodes.addNode(record.parent, local, std::string(strings + record.nameOffset, record.nameLength));
+	}
+}
+
+// Bounds-check every table entry so a truncated file is rejected instead of read past the end
+bool MeshCache::validate() const
+{
+	using namespace CookedMesh;
+
+	const uint64_t size = file.size();
+	uint64_t tablesEnd = sizeof(FileHeader) + (uint64_t)header->meshCount * sizeof(MeshRecord) + (uint64_t)header->textureCount * sizeof(TextureRecord) + (uint64_t)header->lodCount * sizeof(LodRecord) + (uint64_t)header->nodeCount * sizeof(NodeRecord);
+	if (tablesEnd > size || header->stringTableOffset < tablesEnd || header->stringTableOffset + header->stringTableSize > size)
+		return false;
+
+	const MeshRecord* meshRecords = reinterpret_cast<const MeshRecord*>(file.data() + sizeof(FileHeader));
+	const TextureRecord* texRecords = reinterpret_cast<const TextureRecord*>(meshRecords + header->meshCount);
+	const LodRecord* lods = reinterpret_cast<const LodRecord*>(texRecords + header->textureCount);
+	const NodeRecord* nodes = reinterpret_cast<const NodeRecord*>(lods + header->lodCount);
+
+	for (uint32_t i = 0; i < header->meshCount; i++)
+	{
+		const MeshRecord& record = meshRecords[i];
+		if (record.vertexOffset % 16 != 0 || record.indexOffset % 16 != 0)
+			return false;
+		if (record.vertexLayout > (uint32_t)VertexLayout::Packed || record.vertexStride != VertexStride((VertexLayout)record.vertexLayout))
+			return false;
+		if (record.vertexOffset + (uint64_t)record.vertexCount * record.vertexStride > size)
+			return false;
+		if (record.indexSize != IndexSize(IndexType(record.vertexCount)))
+			return false;
+		if (record.indexOffset + (uint64_t)record.indexCount * record.indexSize > size)
+			return false;
+		if ((uint64_t)record.firstTexture + record.textureCount > header->textureCount)
+			return false;
+		if ((uint64_t)record.firstLod + record.lodCount > header->lodCount)
+			return false;
+		if (record.node != NO_NODE && record.node >= header->nodeCount)
+			return false;
+		for (uint32_t j = 0; j < record.lodCount; j++)
+		{
+			if ((uint64_t)lods[record.firstLod + j].indexOffset + lods[record.firstLod + j].indexCount > record.indexCount)
+				return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < header->textureCount; i++)
+	{
+		const TextureRecord& record = texRecords[i];
+		if ((uint64_t)record.typeOffset + record.typeLength > header->stringTableSize ||
+			(uint64_t)record.pathOffset + record.pathLength > header->stringTableSize)
+			return false;
+	}
+
+	// Parents have to come before their children
+	for (uint32_t i = 0; i < header->nodeCount; i++)
+	{
+		const NodeRecord& record = nodes[i];
+		if (record.parent != NO_NODE && record.parent >= i)
+			return false;
+		if ((uint64_t)record.nameOffset + record.nameLength > header->stringTableSize)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,338 @@
+#include "Graphics/MeshOptimizer.h"
+#include "Graphics/Hash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+// FIFO post-transform cache simulation, flush() empties it without clearing the timestamps
+struct VertexCacheSim
+{
+	std::vector<unsigned int> timestamps;
+	unsigned int cacheSize;
+	unsigned int time;
+
+	VertexCacheSim(size_t vertexCount, unsigned int cacheSize)
+		: timestamps(vertexCount, 0), cacheSize(cacheSize), time(cacheSize + 1) {}
+
+	// Returns true on a miss
+	bool access(unsigned int vertex)
+	{
+		if (time - timestamps[vertex] <= cacheSize)
+			return false;
+		timestamps[vertex] = time++;
+		return true;
+	}
+
+	void flush()
+	{
+		time += cacheSize + 1;
+	}
+};
+
+struct VertexBytesHash
+{
+	size_t operator()(const Vertex& v) const { return (size_t)HashBytes(&v, sizeof(Vertex)); }
+};
+
+struct VertexBytesEqual
+{
+	bool operator()(const Vertex& a, const Vertex& b) const { return std::memcmp(&a, &b, sizeof(Vertex)) == 0; }
+};
+
+MeshOptimizeStats OptimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+	MeshOptimizeStats stats;
+	stats.verticesBefore = (unsigned int)vertices.size();
+	stats.triangleCount = (unsigned int)(indices.size() / 3);
+
+	WeldVertices(vertices, indices);
+	stats.verticesAfter = (unsigned int)vertices.size();
+	stats.acmrBefore = ComputeACMR(indices.data(), indices.size(), vertices.size());
+
+	std::vector<unsigned int> clusters;
+	OptimizeVertexCache(indices, vertices.size(), &clusters);
+	OptimizeOverdraw(indices, vertices, clusters);
+	OptimizeVertexFetch(vertices, indices);
+
+	stats.acmrAfter = ComputeACMR(indices.data(), indices.size(), vertices.size());
+	return stats;
+}
+
+void WeldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+	// Importer vertices are zero-initialized, so comparing the bytes compares every attribute
+	std::unordered_map<Vertex, unsigned int, VertexBytesHash, VertexBytesEqual> unique;
+	unique.reserve(vertices.size());
+
+	std::vector<unsigned int> remap(vertices.size());
+	std::vector<Vertex> welded;
+	welded.reserve(vertices.size());
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		auto inserted = unique.emplace(vertices[i], (unsigned int)welded.size());
+		if (inserted.second)
+			welded.push_back(vertices[i]);
+		remap[i] = inserted.first->second;
+	}
+
+	for (unsigned int& index : indices)
+		index = remap[index];
+
+	welded.shrink_to_fit();
+	vertices.swap(welded);
+}
+
+// Sander et al. 2007, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"
+void OptimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, std::vector<unsigned int>* clusters, unsigned int cacheSize)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (clusters)
+		clusters->clear();
+	if (triangleCount == 0 || vertexCount == 0)
+		return;
+
+	// Vertex -> triangle adjacency
+	std::vector<unsigned int> liveTriangles(vertexCount, 0);
+	for (unsigned int index : indices)
+		liveTriangles[index]++;
+
+	std::vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+
+	std::vector<unsigned int> adjacency(indices.size());
+	std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+			adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+	}
+
+	std::vector<unsigned int> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<unsigned int> deadEnd;
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> result;
+	result.reserve(indices.size());
+
+	unsigned int time = cacheSize + 1;
+	unsigned int cursor = 0;
+	int fanning = 0;
+
+	if (clusters)
+		clusters->push_back(0);
+
+	while (fanning >= 0)
+	{
+		// Emit every live triangle around the fanning vertex
+		candidates.clear();
+		for (unsigned int a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a++)
+		{
+			unsigned int t = adjacency[a];
+			if (emitted[t])
+				continue;
+
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v = indices[t * 3 + k];
+				result.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (time - cacheTime[v] > cacheSize)
+					cacheTime[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		// Next fanning vertex: the candidate that stays in the cache longest while its triangles are emitted
+		int best = -1;
+		int bestPriority = -1;
+		for (unsigned int v : candidates)
+		{
+			if (liveTriangles[v] == 0)
+				continue;
+
+			int priority = 0;
+			if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+				priority = (int)(time - cacheTime[v]);
+			if (priority > bestPriority)
+			{
+				best = (int)v;
+				bestPriority = priority;
+			}
+		}
+
+		if (best < 0)
+		{
+			// Dead end, a new cluster starts with the most recent vertex that still has triangles
+			while (!deadEnd.empty() && best < 0)
+			{
+				unsigned int v = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveTriangles[v] > 0)
+					best = (int)v;
+			}
+			while (best < 0 && cursor < vertexCount)
+			{
+				if (liveTriangles[cursor] > 0)
+					best = (int)cursor;
+				cursor++;
+			}
+			if (best >= 0 && clusters)
+				clusters->push_back((unsigned int)(result.size() / 3));
+		}
+		fanning = best;
+	}
+
+	indices.swap(result);
+}
+
+void OptimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& clusters, float threshold, unsigned int cacheSize)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0 || clusters.empty())
+		return;
+
+	// Split the hard clusters wherever the running ACMR is already close to the cluster's own
+	VertexCacheSim cache(vertices.size(), cacheSize);
+	std::vector<unsigned int> boundaries;
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		unsigned int begin = clusters[c];
+		unsigned int end = c + 1 < clusters.size() ? clusters[c + 1] : (unsigned int)triangleCount;
+		if (begin >= end)
+			continue;
+
+		cache.flush();
+		unsigned int clusterMisses = 0;
+		for (unsigned int t = begin; t < end; t++)
+		{
+			for (int k = 0; k < 3; k++)
+				clusterMisses += cache.access(indices[t * 3 + k]);
+		}
+		float clusterACMR = (float)clusterMisses / (float)(end - begin);
+
+		boundaries.push_back(begin);
+		cache.flush();
+		unsigned int misses = 0;
+		unsigned int count = 0;
+		for (unsigned int t = begin; t < end; t++)
+		{
+			for (int k = 0; k < 3; k++)
+				misses += cache.access(indices[t * 3 + k]);
+			count++;
+
+			if (t + 1 < end && (float)misses / (float)count <= clusterACMR * threshold)
+			{
+				boundaries.push_back(t + 1);
+				cache.flush();
+				misses = 0;
+				count = 0;
+			}
+		}
+	}
+
+	// Mesh centroid
+	glm::vec3 meshCenter(0.0f);
+	float meshArea = 0.0f;
+	std::vector<glm::vec3> triangleNormal(triangleCount);
+	std::vector<glm::vec3> triangleCenter(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const glm::vec3& p0 = vertices[indices[t * 3 + 0]].Position;
+		const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+		const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+
+		// Length of the unnormalized normal is twice the area, used as the weight
+		triangleNormal[t] = glm::cross(p1 - p0, p2 - p0);
+		triangleCenter[t] = (p0 + p1 + p2) / 3.0f;
+
+		float area = glm::length(triangleNormal[t]);
+		meshCenter += triangleCenter[t] * area;
+		meshArea += area;
+	}
+	if (meshArea > 0.0f)
+		meshCenter /= meshArea;
+
+	// Clusters facing away from the center occlude the rest, draw them first
+	struct ClusterSort
+	{
+		unsigned int begin;
+		unsigned int end;
+		float sortKey;
+	};
+	std::vector<ClusterSort> order(boundaries.size());
+	for (size_t c = 0; c < boundaries.size(); c++)
+	{
+		order[c].begin = boundaries[c];
+		order[c].end = c + 1 < boundaries.size() ? boundaries[c + 1] : (unsigned int)triangleCount;
+
+		glm::vec3 center(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+		for (unsigned int t = order[c].begin; t < order[c].end; t++)
+		{
+			float triangleArea = glm::length(triangleNormal[t]);
+			center += triangleCenter[t] * triangleArea;
+			normal += triangleNormal[t];
+			area += triangleArea;
+		}
+
+		float normalLength = glm::length(normal);
+		if (area > 0.0f && normalLength > 0.0f)
+			order[c].sortKey = glm::dot(center / area - meshCenter, normal / normalLength);
+		else
+			order[c].sortKey = 0.0f;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [](const ClusterSort& a, const ClusterSort& b)
+	{
+		return a.sortKey > b.sortKey;
+	});
+
+	std::vector<unsigned int> result;
+	result.reserve(indices.size());
+	for (const ClusterSort& cluster : order)
+		result.insert(result.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+
+	// Indices past the last full triangle are kept as they were
+	result.insert(result.end(), indices.begin() + triangleCount * 3, indices.end());
+	indices.swap(result);
+}
+
+void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+	const unsigned int unused = ~0u;
+	std::vector<unsigned int> remap(vertices.size(), unused);
+	std::vector<Vertex> ordered;
+	ordered.reserve(vertices.size());
+
+	for (unsigned int& index : indices)
+	{
+		if (remap[index] == unused)
+		{
+			remap[index] = (unsigned int)ordered.size();
+			ordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	ordered.shrink_to_fit();
+	vertices.swap(ordered);
+}
+
+float ComputeACMR(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize)
+{
+	if (indexCount < 3)
+		return 0.0f;
+
+	VertexCacheSim cache(vertexCount, cacheSize);
+	size_t misses = 0;
+	for (size_t i = 0; i < indexCount; i++)
+		misses += cache.access(indices[i]);
+
+	return (float)misses / (float)(indexCount / 3);
+}
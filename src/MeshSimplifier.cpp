@@ -0,0 +1,276 @@
+#include "Graphics/MeshSimplifier.h"
+#include "Graphics/Hash.h"
+#include "Graphics/MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+// Symmetric 4x4 plane quadric, error(p) = sum of squared distances to the accumulated planes
+struct Quadric
+{
+	double a2 = 0, ab = 0, ac = 0, ad = 0;
+	double b2 = 0, bc = 0, bd = 0;
+	double c2 = 0, cd = 0;
+	double d2 = 0;
+
+	void addPlane(const glm::vec3& n, float d)
+	{
+		a2 += n.x * n.x; ab += n.x * n.y; ac += n.x * n.z; ad += n.x * d;
+		b2 += n.y * n.y; bc += n.y * n.z; bd += n.y * d;
+		c2 += n.z * n.z; cd += n.z * d;
+		d2 += (double)d * d;
+	}
+
+	void add(const Quadric& q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+	}
+
+	double error(const glm::vec3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+				 + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+				 + c2 * z * z + 2 * cd * z
+				 + d2;
+		return e > 0.0 ? e : 0.0;
+	}
+};
+
+struct PositionHash
+{
+	size_t operator()(const glm::vec3& p) const { return (size_t)HashBytes(&p, sizeof(p)); }
+};
+
+struct PositionEqual
+{
+	bool operator()(const glm::vec3& a, const glm::vec3& b) const { return std::memcmp(&a, &b, sizeof(a)) == 0; }
+};
+
+struct Collapse
+{
+	unsigned int from;
+	unsigned int to;
+	double cost;
+};
+
+float SimplifyMesh(const std::vector<Vertex>& vertices, const unsigned int* indices, size_t indexCount, size_t targetIndexCount, std::vector<unsigned int>& result)
+{
+	const size_t vertexCount = vertices.size();
+	result.assign(indices, indices + indexCount - indexCount % 3);
+	if (result.size() <= targetIndexCount || vertexCount == 0)
+		return 0.0f;
+
+	// Vertices that only differ in attributes share a position id
+	std::unordered_map<glm::vec3, unsigned int, PositionHash, PositionEqual> positionIds;
+	std::vector<unsigned int> positionId(vertexCount);
+	std::vector<unsigned int> positionUsers;
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		auto inserted = positionIds.emplace(vertices[v].Position, (unsigned int)positionUsers.size());
+		if (inserted.second)
+			positionUsers.push_back(0);
+		positionId[v] = inserted.first->second;
+		positionUsers[positionId[v]]++;
+	}
+
+	// Seam vertices are locked, so are border and non-manifold edges of the position mesh
+	std::vector<bool> locked(vertexCount, false);
+	for (size_t v = 0; v < vertexCount; v++)
+		locked[v] = positionUsers[positionId[v]] > 1;
+
+	std::unordered_map<uint64_t, unsigned int> edgeUses;
+	edgeUses.reserve(result.size());
+	auto edgeKey = [&](unsigned int a, unsigned int b)
+	{
+		uint64_t pa = positionId[a], pb = positionId[b];
+		return pa < pb ? (pa << 32) | pb : (pb << 32) | pa;
+	};
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		for (int k = 0; k < 3; k++)
+			edgeUses[edgeKey(result[i + k], result[i + (k + 1) % 3])]++;
+	}
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+			if (edgeUses[edgeKey(a, b)] != 2)
+				locked[a] = locked[b] = true;
+		}
+	}
+
+	std::vector<Quadric> quadrics(positionUsers.size());
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		const glm::vec3& p0 = vertices[result[i + 0]].Position;
+		const glm::vec3& p1 = vertices[result[i + 1]].Position;
+		const glm::vec3& p2 = vertices[result[i + 2]].Position;
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length == 0.0f)
+			continue;
+		normal /= length;
+
+		Quadric plane;
+		plane.addPlane(normal, -glm::dot(normal, p0));
+		quadrics[positionId[result[i + 0]]].add(plane);
+		quadrics[positionId[result[i + 1]]].add(plane);
+		quadrics[positionId[result[i + 2]]].add(plane);
+	}
+
+	std::vector<unsigned int> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	std::vector<unsigned int> adjacencyOffset(vertexCount + 1);
+	std::vector<unsigned int> adjacency;
+	std::vector<Collapse> collapses;
+	double maxError = 0.0;
+
+	// Collapse the cheapest independent edges each pass until the target is reached
+	while (result.size() > targetIndexCount)
+	{
+		// Vertex -> triangle adjacency of the current mesh
+		std::fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0);
+		for (unsigned int index : result)
+			adjacencyOffset[index + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			adjacencyOffset[v + 1] += adjacencyOffset[v];
+
+		adjacency.resize(result.size());
+		std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+			adjacency[fill[result[i]]++] = (unsigned int)(i / 3);
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+				Quadric q = quadrics[positionId[a]];
+				q.add(quadrics[positionId[b]]);
+
+				if (!locked[a])
+					collapses.push_back({ a, b, q.error(vertices[b].Position) });
+				if (!locked[b])
+					collapses.push_back({ b, a, q.error(vertices[a].Position) });
+			}
+		}
+		if (collapses.empty())
+			break;
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y)
+		{
+			return x.cost < y.cost;
+		});
+
+		for (size_t v = 0; v < vertexCount; v++)
+			remap[v] = (unsigned int)v;
+		std::fill(touched.begin(), touched.end(), false);
+
+		size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+		size_t removed = 0;
+		for (const Collapse& collapse : collapses)
+		{
+			if (removed >= trianglesToRemove)
+				break;
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			// Reject collapses that flip a remaining triangle around the removed vertex
+			const glm::vec3& target = vertices[collapse.to].Position;
+			bool flips = false;
+			size_t degenerate = 0;
+			for (unsigned int a = adjacencyOffset[collapse.from]; a < adjacencyOffset[collapse.from + 1] && !flips; a++)
+			{
+				const unsigned int* tri = &result[adjacency[a] * 3];
+				if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)
+				{
+					degenerate++;
+					continue;
+				}
+
+				glm::vec3 p[3], q[3];
+				for (int k = 0; k < 3; k++)
+				{
+					p[k] = vertices[tri[k]].Position;
+					q[k] = tri[k] == collapse.from ? target : p[k];
+				}
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flips = glm::dot(before, after) <= 0.0f;
+			}
+			if (flips)
+				continue;
+
+			// Neighbours of both ends stay untouched this pass so the flip test above remains valid
+			for (unsigned int end : { collapse.from, collapse.to })
+			{
+				for (unsigned int a = adjacencyOffset[end]; a < adjacencyOffset[end + 1]; a++)
+				{
+					const unsigned int* tri = &result[adjacency[a] * 3];
+					touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+				}
+			}
+
+			remap[collapse.from] = collapse.to;
+			quadrics[positionId[collapse.to]].add(quadrics[positionId[collapse.from]]);
+			maxError = std::max(maxError, collapse.cost);
+			removed += degenerate;
+		}
+		if (removed == 0)
+			break;
+
+		// Apply the collapses and drop the triangles that became degenerate
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			unsigned int a = remap[result[i + 0]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	return (float)std::sqrt(maxError);
+}
+
+void GenerateLods(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, std::vector<MeshLod>& lods)
+{
+	const unsigned int baseCount = (unsigned int)indices.size();
+	lods.clear();
+	lods.push_back({ 0, baseCount, 0.0f });
+
+	// Every level starts from level 0, so its error is measured against the full mesh
+	std::vector<unsigned int> simplified;
+	float ratio = 1.0f;
+	for (unsigned int level = 1; level < MAX_LOD_LEVELS; level++)
+	{
+		const MeshLod previous = lods.back();
+		ratio *= LOD_REDUCTION;
+		size_t target = (size_t)(baseCount * ratio) / 3 * 3;
+
+		float error = SimplifyMesh(vertices, indices.data(), baseCount, target, simplified);
+
+		// Not worth a level of its own if it saves less than 10% over the previous one
+		if (simplified.empty() || simplified.size() * 10 > (size_t)previous.indexCount * 9)
+		{
+			lods.push_back(previous);
+			continue;
+		}
+
+		OptimizeVertexCache(simplified, vertices.size());
+		lods.push_back({ (unsigned int)indices.size(), (unsigned int)simplified.size(), std::max(error, previous.error) });
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+	}
+}
@@ -1,17 +1,21 @@
 #include "Graphics/Model.h"
+#include "Graphics/AssetManager.h"
+#include "Graphics/GLState.h"
+
+#include <glm/glm/gtc/type_ptr.hpp>
 
 // Function to load a texture from file
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma);
 
 // Constructor
-Model::Model(std::string const& path, bool gamma)
-    : gammaCorrection(gamma)
+Model::Model(std::string const& path, bool gamma, AssetManager* assets, VertexLayout layout)
+    : gammaCorrection(gamma), vertexLayout(layout), assets(assets)
 {
     loadModel(path);
 }
 
 // Draw the model
-void Model::Draw(Shader shader)
+void Model::Draw(Shader& shader)
 {
     for (unsigned int i = 0; i < meshes.size(); i++)
     {
@@ -19,48 +23,339 @@ void Model::Draw(Shader shader)
     }
 }
 
-void Model::loadModel(string const& path)
+void Model::Submit(RenderQueue& queue, ShaderPermutations& shaders, ShaderPermutation permutation, const RenderView& view, const glm::mat4& transform, unsigned int& lod, const unsigned char* visible, RenderPass pass)
+{
+    nodes.update();
+    releaseCopiedTextures();
+    lod = SelectLod(view, transform, lod);
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        if (visible && !visible[i])
+            continue;
+
+        queue.submit(pass, variantFor(shaders, permutation, i), meshes[i], lod, transform * meshTransform(i));
+    }
+}
+
+void Model::SubmitInstanced(RenderQueue& queue, ShaderPermutations& shaders, ShaderPermutation permutation, const InstanceBuffer& instances, unsigned int lod, float depth, RenderPass pass)
+{
+    if (instances.empty())
+        return;
+
+    nodes.update();
+    releaseCopiedTextures();
+    for (unsigned int i = 0; i < meshes.size(); i++)
+        queue.submitInstanced(pass, variantFor(shaders, permutation, i), meshes[i], lod, instances, meshTransform(i), depth);
+}
+
+Shader& Model::variantFor(ShaderPermutations& shaders, ShaderPermutation& permutation, unsigned int mesh)
+{
+    permutation.features = meshes[mesh].features;
+    return shaders.get(permutation);
+}
+
+unsigned int Model::AddToCuller(FrustumCuller& culler, const glm::mat4& transform)
+{
+    nodes.update();
+    unsigned int first = (unsigned int)culler.size();
+    for (unsigned int i = 0; i < meshes.size(); i++)
+        culler.add(meshes[i].boundsMin, meshes[i].boundsMax, transform * meshTransform(i));
+    return first;
+}
+
+const glm::mat4& Model::meshTransform(unsigned int mesh) const
+{
+    static const glm::mat4 identity(1.0f);
+    unsigned int node = mesh < meshNodes.size() ? meshNodes[mesh] : NO_NODE;
+    return node < nodes.size() ? nodes.world(node) : identity;
+}
+
+unsigned int Model::SelectLod(const RenderView& view, const glm::mat4& transform, unsigned int currentLod) const
 {
-    Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+    glm::vec3 center = glm::vec3(transform * glm::vec4(boundsCenter, 1.0f));
+    float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+    // Full detail while the camera is inside the bounds
+    float distance = glm::length(center - view.position) - boundsRadius * scale;
+    if (distance <= 0.0f)
+        return 0;
+
+    // Coarser levels need a clear margin below the threshold, the current and finer ones a margin above it
+    float pixelsPerUnit = view.pixelsPerUnit(distance) * scale * view.lodBias;
+    unsigned int lod = 0;
+    for (unsigned int i = 1; i < lodErrors.size(); i++)
+    {
+        float threshold = LOD_PIXEL_ERROR * (i > currentLod ? 1.0f - LOD_HYSTERESIS : 1.0f + LOD_HYSTERESIS);
+        if (lodErrors[i] * pixelsPerUnit > threshold)
+            break;
+        lod = i;
+    }
+    return lod;
+}
 
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+void Model::Delete()
+{
+    for (Mesh& mesh : meshes)
     {
-        cout << "ERROR::ASSIMP::" << importer.GetErrorString() << endl;
+        MaterialLibrary::Shared().release(mesh.material);
+        mesh.Delete();
+    }
+    meshes.clear();
+    releaseSourceTextures();
+}
+
+void Model::SetColor(const glm::vec3& color)
+{
+    for (const Mesh& mesh : meshes)
+        MaterialLibrary::Shared().setColor(mesh.material, color);
+}
+
+void Model::releaseCopiedTextures()
+{
+    if (texturesReleased)
         return;
+    for (const Mesh& mesh : meshes)
+    {
+        if (mesh.material != NO_MATERIAL && !MaterialLibrary::Shared().isResident(mesh.material))
+            return;
+    }
+    releaseSourceTextures();
+}
+
+void Model::releaseSourceTextures()
+{
+    // Shared textures are unloaded by the asset manager once nobody references them
+    if (!texturesReleased && textureHandles.empty())
+    {
+        for (auto& loaded : textures_loaded)
+            loaded.second.Delete();
     }
+    textures_loaded.clear();
+    textureHandles.clear();
+    texturesReleased = true;
+}
+
+// Milliseconds since a given time point
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
+void Model::loadModel(string const& path)
+{
     directory = path.substr(0, path.find_last_of('/'));
+    auto phaseStart = std::chrono::steady_clock::now();
+
+    // Warm start: map the cooked meshes if they were built from this exact source with the same flags
+    string cachePath = MeshCache::CachePath(path);
+    uint64_t sourceHash = MeshCache::HashFile(path);
+
+    MeshCache cache;
+    bool cacheHit = cache.open(cachePath, sourceHash, importFlags, vertexLayout);
+    loadStats.cacheMs = millisecondsSince(phaseStart);
+
+    if (cacheHit)
+    {
+        loadCooked(cache);
+    }
+    else
+    {
+        phaseStart = std::chrono::steady_clock::now();
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, importFlags);
+        loadStats.importMs = millisecondsSince(phaseStart);
+
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+        {
+            cout << "ERROR::ASSIMP::" << importer.GetErrorString() << endl;
+            return;
+        }
+
+        // Convert every aiMesh on the worker pool, results keep the node traversal order
+        phaseStart = std::chrono::steady_clock::now();
+        vector<const aiMesh*> sceneMeshes;
+        processNode(scene->mRootNode, scene, sceneMeshes, NO_NODE);
+
+        vector<MeshData> meshData(sceneMeshes.size());
+        vector<MeshOptimizeStats> optimizeStats(sceneMeshes.size());
+        ThreadPool& pool = ThreadPool::Shared();
+        pool.parallelFor(sceneMeshes.size(), [&](size_t i)
+        {
+            meshData[i] = processMesh(sceneMeshes[i], scene, vertexLayout);
+            optimizeStats[i] = OptimizeMesh(meshData[i].vertices, meshData[i].indices);
+            GenerateLods(meshData[i].vertices, meshData[i].indices, meshData[i].lods);
+        });
+        loadStats.convertMs = millisecondsSince(phaseStart);
+        loadStats.workerCount = pool.size() + 1;
+
+        MeshOptimizeStats& total = loadStats.optimize;
+        for (const MeshOptimizeStats& stats : optimizeStats)
+        {
+            total.verticesBefore += stats.verticesBefore;
+            total.verticesAfter += stats.verticesAfter;
+            total.triangleCount += stats.triangleCount;
+            total.acmrBefore += stats.acmrBefore * stats.triangleCount;
+            total.acmrAfter += stats.acmrAfter * stats.triangleCount;
+        }
+        if (total.triangleCount > 0)
+        {
+            total.acmrBefore /= total.triangleCount;
+            total.acmrAfter /= total.triangleCount;
+        }
+
+        uploadMeshes(meshData);
+
+        if (sourceHash != 0)
+        {
+            phaseStart = std::chrono::steady_clock::now();
+            MeshCache::Write(cachePath, sourceHash, importFlags, vertexLayout, meshes, nodes, meshNodes);
+            loadStats.cacheWriteMs = millisecondsSince(phaseStart);
+        }
+    }
+
+    nodes.update();
+    computeLodInfo();
+    loadStats.meshCount = (unsigned int)meshes.size();
+    loadStats.fromCache = cacheHit;
+
+    cout << "Model loaded: " << path << " (" << loadStats.meshCount << " meshes, " << (cacheHit ? "cooked cache" : "assimp") << ")\n"
+         << "  cache lookup " << loadStats.cacheMs << " ms\n";
+    if (!cacheHit)
+    {
+        cout << "  import       " << loadStats.importMs << " ms\n"
+             << "  convert      " << loadStats.convertMs << " ms on " << loadStats.workerCount << " threads\n"
+             << "  optimize     " << loadStats.optimize.verticesBefore << " -> " << loadStats.optimize.verticesAfter << " vertices, ACMR "
+             << loadStats.optimize.acmrBefore << " -> " << loadStats.optimize.acmrAfter << "\n";
+    }
+    cout << "  textures     " << loadStats.textureMs << " ms\n"
+         << "  gpu upload   " << loadStats.uploadMs << " ms\n";
+    if (!cacheHit)
+        cout << "  cache write  " << loadStats.cacheWriteMs << " ms\n";
+
+    cout << "  lod triangles";
+    for (unsigned int level = 0; level < lodErrors.size(); level++)
+    {
+        size_t triangles = 0;
+        for (const Mesh& mesh : meshes)
+            triangles += mesh.lods[std::min(level, (unsigned int)mesh.lods.size() - 1)].indexCount / 3;
+        cout << (level == 0 ? " " : " / ") << triangles;
+    }
+    cout << "\n";
+    cout << flush;
+}
+
+// Builds the meshes from a mapped cache file, the blobs go to the GPU without being copied
+void Model::loadCooked(const MeshCache& cache)
+{
+    meshes.reserve(cache.meshCount());
+    cache.loadNodes(nodes);
+
+    for (unsigned int i = 0; i < cache.meshCount(); i++)
+    {
+        CookedMeshView view = cache.mesh(i);
+        meshNodes.push_back(view.node);
+
+        auto phaseStart = std::chrono::steady_clock::now();
+        vector<Texture> textures;
+        for (const TextureRef& ref : view.textures)
+            textures.push_back(loadTexture(ref.path, ref.textureType));
+        loadStats.textureMs += millisecondsSince(phaseStart);
+
+        phaseStart = std::chrono::steady_clock::now();
+        meshes.emplace_back(view.vertices, view.vertexCount, view.vertexLayout, view.indices, view.indexCount, view.indexType, std::move(textures), std::move(view.lods));
+        meshes.back().material = MaterialLibrary::Shared().acquire(meshes.back().textures, directory, gammaCorrection);
+        loadStats.uploadMs += millisecondsSince(phaseStart);
+    }
+}
+
+void Model::computeLodInfo()
+{
+    boundsMin = boundsMax = boundsCenter = glm::vec3(0.0f);
+    boundsRadius = 0.0f;
+    lodErrors.assign(1, 0.0f);
+    if (meshes.empty())
+        return;
 
-    processNode(scene->mRootNode, scene);
+    // Mesh bounds are in node space
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        glm::vec3 meshMin, meshMax;
+        TransformBounds(meshes[i].boundsMin, meshes[i].boundsMax, meshTransform(i), meshMin, meshMax);
+        boundsMin = i == 0 ? meshMin : glm::min(boundsMin, meshMin);
+        boundsMax = i == 0 ? meshMax : glm::max(boundsMax, meshMax);
+    }
+    boundsCenter = (boundsMin + boundsMax) * 0.5f;
+
+    // A level is only as good as its worst mesh
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        const Mesh& mesh = meshes[i];
+        const glm::mat4& transform = meshTransform(i);
+        float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+        glm::vec3 center = glm::vec3(transform * glm::vec4(mesh.boundsCenter, 1.0f));
+        boundsRadius = std::max(boundsRadius, glm::length(center - boundsCenter) + mesh.boundsRadius * scale);
+        if (mesh.lods.size() > lodErrors.size())
+            lodErrors.resize(mesh.lods.size(), 0.0f);
+        for (size_t level = 0; level < mesh.lods.size(); level++)
+            lodErrors[level] = std::max(lodErrors[level], mesh.lods[level].error * scale);
+    }
 }
 
-// Processes a node recursively
-void Model::processNode(aiNode* node, const aiScene* scene)
+// Creates the GL meshes in order, the only part of an import that has to run on the GL thread
+void Model::uploadMeshes(vector<MeshData>& meshData)
 {
+    meshes.reserve(meshData.size());
+
+    for (MeshData& data : meshData)
+    {
+        auto phaseStart = std::chrono::steady_clock::now();
+        vector<Texture> textures;
+        for (const TextureRef& ref : data.textures)
+            textures.push_back(loadTexture(ref.path, ref.textureType));
+        loadStats.textureMs += millisecondsSince(phaseStart);
+
+        phaseStart = std::chrono::steady_clock::now();
+        meshes.emplace_back(std::move(data.vertices), std::move(data.indices), std::move(textures), data.layout, std::move(data.lods));
+        meshes.back().material = MaterialLibrary::Shared().acquire(meshes.back().textures, directory, gammaCorrection);
+        loadStats.uploadMs += millisecondsSince(phaseStart);
+    }
+}
+
+// Processes a node recursively, nodes are added before their children
+void Model::processNode(aiNode* node, const aiScene* scene, vector<const aiMesh*>& sceneMeshes, unsigned int parent)
+{
+    // Assimp matrices are row major
+    glm::mat4 local = glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+    unsigned int index = nodes.addNode(parent, local, node->mName.C_Str());
+
     for (unsigned int i = 0; i < node->mNumMeshes; i++)
     {
-        aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(processMesh(mesh, scene));
+        sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+        meshNodes.push_back(index);
     }
 
     for (unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        processNode(node->mChildren[i], scene);
+        processNode(node->mChildren[i], scene, sceneMeshes, index);
     }
 }
 
-// Processes a mesh recursively
-Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
+// Converts one mesh into engine vertices, indices and texture references
+MeshData Model::processMesh(const aiMesh* mesh, const aiScene* scene, VertexLayout layout)
 {
-    vector<Vertex> vertices;
-    vector<unsigned int> indices;
-    vector<Texture> textures;
+    MeshData data;
+    // Only skinned meshes pay for bone data
+    data.layout = mesh->HasBones() ? VertexLayout::Skinned : layout;
+    vector<Vertex>& vertices = data.vertices;
+    vector<unsigned int>& indices = data.indices;
 
+    vertices.reserve(mesh->mNumVertices);
     for (unsigned int i = 0; i < mesh->mNumVertices; i++)
     {
-        Vertex vertex;
+        Vertex vertex = {};
         glm::vec3 vector;
+        for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+            vertex.m_BoneIDs[j] = -1;
 
         // Positions
         vector.x = mesh->mVertices[i].x;
@@ -105,10 +400,17 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
         vertices.push_back(vertex);
     }
 
+    if (mesh->HasBones())
+        processBones(mesh, vertices);
+
     // Process indices
+    indices.reserve(mesh->mNumFaces * 3);
     for (unsigned int i = 0; i < mesh->mNumFaces; i++)
     {
-        aiFace face = mesh->mFaces[i];
+        // Points and lines survive aiProcess_Triangulate, only triangles are drawn
+        const aiFace& face = mesh->mFaces[i];
+        if (face.mNumIndices != 3)
+            continue;
         for (unsigned int j = 0; j < face.mNumIndices; j++)
         {
             indices.push_back(face.mIndices[j]);
@@ -116,53 +418,85 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
     }
 
     // Process material
-    aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-    vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-    textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-
-    vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-    textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+    const aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+    loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
+    loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data.textures);
+    loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", data.textures);
+    loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", data.textures);
 
-    vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-    textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+    return data;
+}
 
-    vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-    textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+void Model::processBones(const aiMesh* mesh, vector<Vertex>& vertices)
+{
+    for (unsigned int boneIndex = 0; boneIndex < mesh->mNumBones; boneIndex++)
+    {
+        const aiBone* bone = mesh->mBones[boneIndex];
+        for (unsigned int i = 0; i < bone->mNumWeights; i++)
+        {
+            const aiVertexWeight& weight = bone->mWeights[i];
+            if (weight.mVertexId >= vertices.size())
+                continue;
+
+            // Take a free slot, otherwise replace the weakest influence if this one is stronger
+            Vertex& vertex = vertices[weight.mVertexId];
+            int slot = 0;
+            for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+            {
+                if (vertex.m_BoneIDs[j] < 0)
+                {
+                    slot = j;
+                    break;
+                }
+                if (vertex.m_Weights[j] < vertex.m_Weights[slot])
+                    slot = j;
+            }
+            if (vertex.m_BoneIDs[slot] >= 0 && vertex.m_Weights[slot] >= weight.mWeight)
+                continue;
 
-    return Mesh(vertices, indices, textures);
+            vertex.m_BoneIDs[slot] = (int)boneIndex;
+            vertex.m_Weights[slot] = weight.mWeight;
+        }
+    }
 }
 
-vector<Texture> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+void Model::loadMaterialTextures(const aiMaterial* mat, aiTextureType type, const string& typeName, vector<TextureRef>& textures)
 {
-    vector<Texture> textures;
     for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
     {
         aiString str;
         mat->GetTexture(type, i, &str);
-        bool skip = false;
+        textures.push_back({ typeName, str.C_Str() });
+    }
+}
 
-        for (unsigned int j = 0; j < textures_loaded.size(); j++)
-        {
-            if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-            {
-                textures.push_back(textures_loaded[j]);
-                skip = true;
-                break;
-            }
-        }
+// Loads a texture once per model, shared across models when an asset manager is used
+Texture Model::loadTexture(const string& path, const string& typeName)
+{
+    auto loaded = textures_loaded.find(path);
+    if (loaded != textures_loaded.end())
+    {
+        Texture texture = loaded->second;
+        texture.textureType = typeName;
+        return texture;
+    }
 
-        if (!skip)
-        {
-            Texture texture;
-            texture.ID = TextureFromFile(str.C_Str(), this->directory, this->gammaCorrection);
-            texture.type = GL_TEXTURE_2D;
-            texture.textureType = typeName;
-            texture.path = str.C_Str();
-            textures.push_back(texture);
-            textures_loaded.push_back(texture);
-        }
+    Texture texture;
+    if (assets)
+    {
+        TextureHandle handle = assets->loadTexture(this->directory + '/' + path, typeName, this->gammaCorrection);
+        texture.ID = handle->ID;
+        textureHandles.push_back(std::move(handle));
+    }
+    else
+    {
+        texture.ID = TextureFromFile(path.c_str(), this->directory, this->gammaCorrection);
     }
-    return textures;
+    texture.type = GL_TEXTURE_2D;
+    texture.textureType = typeName;
+    texture.path = path;
+    textures_loaded[path] = texture;
+    return texture;
 }
 
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
@@ -185,7 +519,7 @@ unsigned int TextureFromFile(const char* path, const string& directory, bool gam
         else if (nrComponents == 4)
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        GLState::bindTexture(GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -0,0 +1,118 @@
+#include "Graphics/ProgramCache.h"
+#include "Graphics/GLState.h"
+#include "Graphics/Hash.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+std::string ProgramCache::CachePath(const std::string& vertexPath, const std::string& fragmentPath, const std::string& defines)
+{
+	uint64_t id = HashString(defines, HashString(fragmentPath, HashString(vertexPath)));
+
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)id);
+	return vertexPath + "." + hex + ".fprog";
+}
+
+uint64_t ProgramCache::Key(const std::string& vertexCode, const std::string& fragmentCode, const std::string& defines)
+{
+	uint64_t key = HashString(vertexCode);
+	key = HashString(fragmentCode, key);
+	key = HashString(defines, key);
+
+	const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (GLenum name : driverStrings)
+	{
+		const char* value = reinterpret_cast<const char*>(glGetString(name));
+		if (value)
+			key = HashString(value, key);
+	}
+	return key;
+}
+
+bool ProgramCache::Supported()
+{
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+GLuint ProgramCache::Load(const std::string& cachePath, uint64_t key, double& compileMs)
+{
+	using namespace CookedProgram;
+
+	std::ifstream in(cachePath, std::ios::binary);
+	if (!in)
+		return 0;
+
+	FileHeader header;
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		header.magic != MAGIC || header.version != VERSION || header.key != key || header.binarySize == 0)
+		return 0;
+
+	std::vector<char> binary(header.binarySize);
+	if (!in.read(binary.data(), (std::streamsize)binary.size()))
+		return 0;
+
+	// The driver may still reject a binary with a matching key, e.g. after an update that kept the version string
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		std::cout << "WARNING::PROGRAM_CACHE::BINARY_REJECTED: " << cachePath << std::endl;
+		GLState::deleteProgram(program);
+		return 0;
+	}
+
+	compileMs = header.compileMs;
+	return program;
+}
+
+bool ProgramCache::Write(const std::string& cachePath, uint64_t key, GLuint program, double compileMs)
+{
+	using namespace CookedProgram;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return false;
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+	if (length <= 0)
+		return false;
+
+	FileHeader header = {};
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.key = key;
+	header.binaryFormat = format;
+	header.binarySize = (uint32_t)length;
+	header.compileMs = compileMs;
+
+	// Write to a temporary file first so a crash never leaves a half-written cache behind
+	std::string tempPath = cachePath + ".tmp";
+	std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cout << "ERROR::PROGRAM_CACHE::CANNOT_WRITE: " << cachePath << std::endl;
+		return false;
+	}
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(binary.data(), length);
+	out.close();
+	if (!out)
+	{
+		std::remove(tempPath.c_str());
+		return false;
+	}
+
+	std::remove(cachePath.c_str());
+	return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
@@ -0,0 +1,349 @@
+#include "Graphics/RenderQueue.h"
+#include "Graphics/GLState.h"
+
+#include <algorithm>
+
+// Uniform name hashes, computed at compile time
+static constexpr uint64_t MODEL_UNIFORM = HashLiteral("model");
+static constexpr uint64_t INSTANCED_UNIFORM = HashLiteral("instanced");
+static constexpr uint64_t NODE_TRANSFORM_UNIFORM = HashLiteral("nodeTransform");
+static constexpr uint64_t NODE_NORMAL_MATRIX_UNIFORM = HashLiteral("nodeNormalMatrix");
+static constexpr uint64_t MULTI_DRAW_UNIFORM = HashLiteral("multiDraw");
+
+// Above any instance count, so every instance of a multi-draw command reads the draw index at its baseInstance
+static const GLuint DRAW_INDEX_DIVISOR = 1u << 30;
+
+static const unsigned int PASS_SHIFT = RenderKey::SHADER_BITS + RenderKey::MATERIAL_BITS + RenderKey::VERTEX_ARRAY_BITS + RenderKey::DEPTH_BITS;
+
+uint64_t RenderKey::Make(RenderPass pass, unsigned int program, unsigned int material, unsigned int vertexArray, float depth)
+{
+	const uint64_t depthMax = (1ull << DEPTH_BITS) - 1;
+	uint64_t quantized = (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * depthMax);
+
+	uint64_t key = (uint64_t)pass & ((1ull << PASS_BITS) - 1);
+	key = (key << SHADER_BITS) | (program & ((1u << SHADER_BITS) - 1));
+	key = (key << MATERIAL_BITS) | (material & ((1u << MATERIAL_BITS) - 1));
+	key = (key << VERTEX_ARRAY_BITS) | (vertexArray & ((1u << VERTEX_ARRAY_BITS) - 1));
+	key = (key << DEPTH_BITS) | quantized;
+	return key;
+}
+
+// LSD radix sort on 8-bit digits, passes where every key has the same digit are skipped
+void RenderQueue::sortItems()
+{
+	scratch.resize(items.size());
+	for (unsigned int shift = 0; shift < 64; shift += 8)
+	{
+		size_t counts[256] = {};
+		for (const auto& item : items)
+			counts[(item.key >> shift) & 0xFF]++;
+		if (counts[(items[0].key >> shift) & 0xFF] == items.size())
+			continue;
+
+		size_t offset = 0;
+		for (size_t& count : counts)
+		{
+			size_t digitCount = count;
+			count = offset;
+			offset += digitCount;
+		}
+		for (const auto& item : items)
+			scratch[counts[(item.key >> shift) & 0xFF]++] = item;
+		items.swap(scratch);
+	}
+}
+
+void RenderQueue::begin(const RenderView& view)
+{
+	clear();
+
+	viewPosition = view.position;
+	viewForward = -glm::vec3(view.view[0][2], view.view[1][2], view.view[2][2]);
+
+	// Far plane of a perspective projection
+	const glm::mat4& p = view.projection;
+	depthRange = p[3][2] / (p[2][2] + 1.0f);
+	if (!(depthRange > 0.0f))
+		depthRange = 1.0f;
+}
+
+float RenderQueue::viewDepth(const glm::vec3& position) const
+{
+	return glm::dot(position - viewPosition, viewForward);
+}
+
+void RenderQueue::clear()
+{
+	commands.clear();
+	customDraws.clear();
+	items.clear();
+	prepared = false;
+}
+
+void RenderQueue::submit(RenderPass pass, Shader& shader, Mesh& mesh, unsigned int lod, const glm::mat4& transform)
+{
+	float depth = viewDepth(glm::vec3(transform * glm::vec4(mesh.boundsCenter, 1.0f))) / depthRange;
+	items.push_back({ RenderKey::Make(pass, shader.ID, mesh.material, mesh.VAO, depth), (unsigned int)commands.size() });
+	commands.push_back({ &shader, &mesh, lod, transform, nullptr, -1 });
+}
+
+void RenderQueue::submitInstanced(RenderPass pass, Shader& shader, Mesh& mesh, unsigned int lod, const InstanceBuffer& instances, const glm::mat4& nodeTransform, float depth)
+{
+	if (instances.empty())
+		return;
+	items.push_back({ RenderKey::Make(pass, shader.ID, mesh.material, mesh.VAO, depth / depthRange), (unsigned int)commands.size() });
+	commands.push_back({ &shader, &mesh, lod, nodeTransform, &instances, -1 });
+}
+
+void RenderQueue::submitCustom(RenderPass pass, Shader& shader, float depth, std::function<void(Shader&)> draw)
+{
+	items.push_back({ RenderKey::Make(pass, shader.ID, 0, 0, depth / depthRange), (unsigned int)commands.size() });
+	commands.push_back({ &shader, nullptr, 0, glm::mat4(1.0f), nullptr, (int)customDraws.size() });
+	customDraws.push_back(std::move(draw));
+}
+
+void RenderQueue::setPassState(RenderPass pass)
+{
+	// The opaque pass only shades the surfaces the prepass left in the depth buffer
+	bool afterPrepass = pass == RenderPass::Opaque && depthPrepass;
+	GLState::colorMask(pass != RenderPass::DepthPrepass);
+	GLState::depthMask(!afterPrepass);
+	GLState::depthFunc(pass == RenderPass::Sky || afterPrepass ? GL_LEQUAL : GL_LESS);
+}
+
+void RenderQueue::prepare()
+{
+	if (prepared)
+		return;
+	sortItems();
+	buildBatches();
+	depthPrepass = !items.empty() && (RenderPass)(items.front().key >> PASS_SHIFT) == RenderPass::DepthPrepass;
+	prepared = true;
+}
+
+void RenderQueue::execute()
+{
+	executePasses(RenderPass::DepthPrepass, RenderPass::Sky);
+	clear();
+}
+
+void RenderQueue::executePasses(RenderPass first, RenderPass last)
+{
+	if (!prepared)
+		queueStats = RenderQueueStats();
+	if (items.empty())
+		return;
+
+	prepare();
+
+	unsigned int currentPass = ~0u;
+	Shader* currentShader = nullptr;
+	size_t nextBatch = 0;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const DrawCommand& command = commands[items[i].command];
+
+		unsigned int pass = (unsigned int)(items[i].key >> PASS_SHIFT);
+		if (pass < (unsigned int)first || pass > (unsigned int)last)
+		{
+			if (nextBatch < batches.size() && batches[nextBatch].firstItem == i)
+				i += batches[nextBatch++].itemCount - 1;
+			continue;
+		}
+		queueStats.commands++;
+
+		if (pass != currentPass)
+		{
+			setPassState((RenderPass)pass);
+			currentPass = pass;
+		}
+
+		Shader& shader = *command.shader;
+		if (&shader != currentShader)
+		{
+			shader.use();
+			currentShader = &shader;
+			queueStats.programChanges++;
+		}
+
+		if (nextBatch < batches.size() && batches[nextBatch].firstItem == i)
+		{
+			const Batch& batch = batches[nextBatch++];
+			drawBatch(batch, shader);
+			queueStats.commands += (unsigned int)batch.itemCount - 1;
+			i += batch.itemCount - 1;
+			continue;
+		}
+		drawCommand(command, shader);
+	}
+
+	// Back to the defaults for code drawing outside the queue
+	GLState::colorMask(GL_TRUE);
+	GLState::depthMask(GL_TRUE);
+	GLState::depthFunc(GL_LESS);
+}
+
+bool RenderQueue::batchable(const SortItem& item) const
+{
+	const DrawCommand& command = commands[item.command];
+	return command.custom < 0 && command.mesh->pooled;
+}
+
+void RenderQueue::buildBatches()
+{
+	batches.clear();
+	indirectCommands.clear();
+	drawData.clear();
+	frameInstances.clear();
+	if (!multiDraw)
+		return;
+
+	// Runs of pooled meshes with the same state are adjacent after sorting
+	for (size_t i = 0; i < items.size();)
+	{
+		if (!batchable(items[i]))
+		{
+			i++;
+			continue;
+		}
+
+		const DrawCommand& first = commands[items[i].command];
+		Batch batch = { i, 0, indirectCommands.size() };
+		size_t end = i;
+		for (; end < items.size() && batchable(items[end]); end++)
+		{
+			const DrawCommand& command = commands[items[end].command];
+			if (command.shader != first.shader || command.mesh->material != first.mesh->material || command.mesh->VAO != first.mesh->VAO ||
+				(items[end].key >> PASS_SHIFT) != (items[i].key >> PASS_SHIFT))
+				break;
+
+			DrawData data;
+			data.model = command.transform;
+			data.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(command.transform))));
+			DrawElementsIndirectCommand indirect;
+			if (command.instances)
+			{
+				data.params = glm::uvec4((unsigned int)frameInstances.size(), 1, 0, 0);
+				frameInstances.insert(frameInstances.end(), command.instances->data(), command.instances->data() + command.instances->size());
+				indirect = command.mesh->IndirectCommand(command.lod, (unsigned int)command.instances->size());
+			}
+			else
+			{
+				data.params = glm::uvec4(0);
+				indirect = command.mesh->IndirectCommand(command.lod);
+			}
+
+			// Index over the whole frame, so later batches do not read the first batch's data
+			indirect.baseInstance = (GLuint)drawData.size();
+			indirectCommands.push_back(indirect);
+			drawData.push_back(data);
+		}
+		batch.itemCount = end - i;
+		batches.push_back(batch);
+		i = end;
+	}
+
+	if (batches.empty())
+		return;
+	indirectBuffer.upload(GL_DRAW_INDIRECT_BUFFER, indirectCommands.data(), indirectCommands.size() * sizeof(DrawElementsIndirectCommand));
+	drawDataBuffer.upload(GL_SHADER_STORAGE_BUFFER, drawData.data(), drawData.size() * sizeof(DrawData));
+	instanceBuffer.upload(GL_SHADER_STORAGE_BUFFER, frameInstances.data(), frameInstances.size() * sizeof(InstanceData));
+
+	// The draw indices never change, the buffer is only rebuilt when it is too short
+	if (drawData.size() > drawIndexCapacity)
+	{
+		drawIndexCapacity = std::max(drawData.size(), drawIndexCapacity * 2);
+		std::vector<GLuint> indices(drawIndexCapacity);
+		for (size_t i = 0; i < indices.size(); i++)
+			indices[i] = (GLuint)i;
+
+		GLState::deleteBuffer(drawIndexBuffer);
+		glGenBuffers(1, &drawIndexBuffer);
+		GLState::bindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	}
+}
+
+void RenderQueue::drawBatch(const Batch& batch, Shader& shader)
+{
+	// Every mesh of the batch shares the material and the pool
+	Mesh& mesh = *commands[items[batch.firstItem].command].mesh;
+	mesh.bindMaterial(shader);
+
+	UniformHandle multiDrawUniform = shader.uniform(MULTI_DRAW_UNIFORM);
+	shader.setBool(multiDrawUniform, true);
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer.id);
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BUFFER_BINDING, instanceBuffer.id);
+	GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer.id);
+
+	// Only enabled for the batch, the pool's vertex array is shared with the single draws
+	GLState::bindVertexArray(mesh.VAO);
+	glVertexAttribIFormat(DRAW_INDEX_ATTRIBUTE, 1, GL_UNSIGNED_INT, 0);
+	glVertexAttribBinding(DRAW_INDEX_ATTRIBUTE, DRAW_INDEX_ATTRIBUTE);
+	glVertexBindingDivisor(DRAW_INDEX_ATTRIBUTE, DRAW_INDEX_DIVISOR);
+	glBindVertexBuffer(DRAW_INDEX_ATTRIBUTE, drawIndexBuffer, 0, sizeof(GLuint));
+	glEnableVertexAttribArray(DRAW_INDEX_ATTRIBUTE);
+
+	glMultiDrawElementsIndirect(GL_TRIANGLES, mesh.indexType, (void*)(batch.firstCommand * sizeof(DrawElementsIndirectCommand)), (GLsizei)batch.itemCount, 0);
+
+	glDisableVertexAttribArray(DRAW_INDEX_ATTRIBUTE);
+	shader.setBool(multiDrawUniform, false);
+	queueStats.drawCalls++;
+}
+
+void RenderQueue::drawCommand(const DrawCommand& command, Shader& shader)
+{
+	queueStats.drawCalls++;
+	if (command.custom >= 0)
+	{
+		customDraws[command.custom](shader);
+	}
+	else if (command.instances)
+	{
+		// The node transform sits between the instance transform and the mesh
+		UniformHandle instancedUniform = shader.uniform(INSTANCED_UNIFORM);
+		command.instances->bind();
+		shader.setBool(instancedUniform, true);
+		shader.setMat4(shader.uniform(NODE_TRANSFORM_UNIFORM), command.transform);
+		shader.setMat3(shader.uniform(NODE_NORMAL_MATRIX_UNIFORM), glm::transpose(glm::inverse(glm::mat3(command.transform))));
+		command.mesh->DrawInstanced(shader, (unsigned int)command.instances->size(), command.lod);
+		shader.setBool(instancedUniform, false);
+	}
+	else
+	{
+		shader.setMat4(shader.uniform(MODEL_UNIFORM), command.transform);
+		command.mesh->Draw(shader, command.lod);
+	}
+}
+
+void RenderQueue::Delete()
+{
+	indirectBuffer.Delete();
+	drawDataBuffer.Delete();
+	instanceBuffer.Delete();
+	GLState::deleteBuffer(drawIndexBuffer);
+	drawIndexBuffer = 0;
+	drawIndexCapacity = 0;
+}
+
+void RenderQueue::StreamBuffer::upload(GLenum target, const void* data, size_t size)
+{
+	if (!id)
+		glGenBuffers(1, &id);
+
+	// Grow geometrically, otherwise re-specify the same size to orphan the old storage
+	GLState::bindBuffer(target, id);
+	size_t required = std::max<size_t>(size, 16);
+	if (required > capacity)
+		capacity = std::max(required, capacity * 2);
+	glBufferData(target, capacity, nullptr, GL_STREAM_DRAW);
+	if (size)
+		glBufferSubData(target, 0, size, data);
+}
+
+void RenderQueue::StreamBuffer::Delete()
+{
+	GLState::deleteBuffer(id);
+	id = 0;
+	capacity = 0;
+}
@@ -0,0 +1,103 @@
+#include "Graphics/SceneGraph.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCENE_GRAPH_SSE 1
+#endif
+
+void MultiplyMatrices(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+{
+#if defined(SCENE_GRAPH_SSE)
+	// Column j of the result is a's columns weighted by column j of b
+	__m128 a0 = _mm_loadu_ps(&a[0][0]);
+	__m128 a1 = _mm_loadu_ps(&a[1][0]);
+	__m128 a2 = _mm_loadu_ps(&a[2][0]);
+	__m128 a3 = _mm_loadu_ps(&a[3][0]);
+
+	for (int j = 0; j < 4; j++)
+	{
+		__m128 column = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(b[j][0])), _mm_mul_ps(a1, _mm_set1_ps(b[j][1]))),
+			_mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(b[j][2])), _mm_mul_ps(a3, _mm_set1_ps(b[j][3]))));
+		_mm_storeu_ps(&out[j][0], column);
+	}
+#else
+	out = a * b;
+#endif
+}
+
+unsigned int SceneGraph::addNode(unsigned int parent, const glm::mat4& local, const std::string& name)
+{
+	unsigned int index = (unsigned int)parents.size();
+	parents.push_back(parent < index ? parent : NO_NODE);
+	locals.push_back(local);
+	worlds.push_back(local);
+	dirty.push_back(1);
+	names.push_back(name);
+
+	if (firstDirty > index)
+		firstDirty = index;
+	return index;
+}
+
+void SceneGraph::clear()
+{
+	parents.clear();
+	locals.clear();
+	worlds.clear();
+	dirty.clear();
+	names.clear();
+	firstDirty = 0;
+}
+
+void SceneGraph::setLocal(unsigned int node, const glm::mat4& local)
+{
+	locals[node] = local;
+	dirty[node] = 1;
+	if (firstDirty > node)
+		firstDirty = node;
+}
+
+void SceneGraph::update()
+{
+	updatedCount = 0;
+	if (firstDirty >= parents.size())
+		return;
+
+	// Parents come first, so one pass spreads the flags down every changed subtree
+	batch.clear();
+	for (size_t i = firstDirty; i < parents.size(); i++)
+	{
+		unsigned int parent = parents[i];
+		if (parent != NO_NODE && dirty[parent])
+			dirty[i] = 1;
+		if (dirty[i])
+			batch.push_back((unsigned int)i);
+	}
+
+	// The batch is in parent-before-child order as well, so parents are always final when read
+	for (unsigned int node : batch)
+	{
+		unsigned int parent = parents[node];
+		if (parent == NO_NODE)
+			worlds[node] = locals[node];
+		else
+			MultiplyMatrices(worlds[parent], locals[node], worlds[node]);
+	}
+
+	for (unsigned int node : batch)
+		dirty[node] = 0;
+
+	updatedCount = (unsigned int)batch.size();
+	firstDirty = parents.size();
+}
+
+unsigned int SceneGraph::find(const std::string& name) const
+{
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		if (names[i] == name)
+			return (unsigned int)i;
+	}
+	return NO_NODE;
+}
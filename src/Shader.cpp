@@ -1,11 +1,122 @@
 #include "Graphics/Shader.h"
+#include "Graphics/GLState.h"
+#include "Graphics/ProgramCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// GL_KHR_parallel_shader_compile lets compile and link return before the driver is done
+static bool parallelCompileSupported()
+{
+	static int supported = -1;
+	if (supported < 0)
+	{
+		supported = 0;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count && !supported; i++)
+		{
+			const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, (GLuint)i));
+			supported = name && (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0);
+		}
+	}
+	return supported == 1;
+}
 
 // Constructor
-Shader::Shader(const char* vertexPath, const char* fragmentPath)
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines)
+	: ID(0), vertexPath(vertexPath), fragmentPath(fragmentPath), defines(defines)
+{
+	load();
+}
+
+bool Shader::load()
 {
-	// 1. Retrieve the vertex/fragment source code from filePath
+	// 1. Retrieve the source code from filePath
 	std::string vertexCode;
 	std::string fragmentCode;
+	readSources(vertexCode, fragmentCode);
+
+	// 2. Linked binary from a previous run, if this driver still accepts it
+	auto start = std::chrono::steady_clock::now();
+	std::string path = cachePath();
+	uint64_t cacheKey = ProgramCache::Key(vertexCode, fragmentCode, defines);
+	double compileMs = 0.0;
+
+	ID = ProgramCache::Supported() ? ProgramCache::Load(path, cacheKey, compileMs) : 0;
+	if (ID)
+	{
+		loadMs = millisecondsSince(start);
+		fromBinaryCache = true;
+		reflect();
+		std::cout << "Shader loaded: " << sourceName() << " from binary cache in " << loadMs
+				  << " ms (compile took " << compileMs << " ms)" << std::endl;
+		return true;
+	}
+
+	// 3. Compile shaders
+	GLuint vertex, fragment;
+	ID = startCompile(vertexCode, fragmentCode, vertex, fragment);
+	bool linked = finishCompile(ID, vertex, fragment);
+	reflect();
+
+	loadMs = millisecondsSince(start);
+	fromBinaryCache = false;
+	std::cout << "Shader loaded: " << sourceName() << " compiled in " << loadMs << " ms" << std::endl;
+
+	if (linked && ProgramCache::Supported())
+		ProgramCache::Write(path, cacheKey, ID, loadMs);
+	return linked;
+}
+
+std::string Shader::sourceName() const
+{
+	return compute() ? computePath : vertexPath + " + " + fragmentPath;
+}
+
+std::string Shader::cachePath() const
+{
+	return compute() ? ProgramCache::CachePath(computePath, std::string(), defines) : ProgramCache::CachePath(vertexPath, fragmentPath, defines);
+}
+
+// Reads both stages with the defines injected
+// ------------------------------------------------------------------------
+bool Shader::readSources(std::string& vertexCode, std::string& fragmentCode) const
+{
+	if (compute())
+	{
+		std::ifstream cShaderFile;
+		cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			cShaderFile.open(computePath);
+			std::stringstream cShaderStream;
+			cShaderStream << cShaderFile.rdbuf();
+			cShaderFile.close();
+			vertexCode = cShaderStream.str();
+		}
+		catch (std::ifstream::failure& e)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << computePath << " " << e.what() << std::endl;
+			return false;
+		}
+
+		fragmentCode.clear();
+		if (!defines.empty())
+			vertexCode = injectDefines(vertexCode, defines);
+		return true;
+	}
+
 	std::ifstream vShaderFile;
 	std::ifstream fShaderFile;
 
@@ -35,113 +146,403 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath)
     catch (std::ifstream::failure& e)
     {
 		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+		return false;
 	}
 
+	if (!defines.empty())
+	{
+		vertexCode = injectDefines(vertexCode, defines);
+		fragmentCode = injectDefines(fragmentCode, defines);
+	}
+	return true;
+}
+
+// Issues compile and link, with parallel compilation they return before the driver is done
+// ------------------------------------------------------------------------
+GLuint Shader::startCompile(const std::string& vertexCode, const std::string& fragmentCode, GLuint& vertex, GLuint& fragment) const
+{
 	const char* vShaderCode = vertexCode.c_str();
 	const char* fShaderCode = fragmentCode.c_str();
 
-	// 2. Compile shaders
-	unsigned int vertex, fragment;
-
-	// Vertex shader
-	vertex = glCreateShader(GL_VERTEX_SHADER);
+	// Vertex shader, or the compute shader
+	vertex = glCreateShader(compute() ? GL_COMPUTE_SHADER : GL_VERTEX_SHADER);
 	glShaderSource(vertex, 1, &vShaderCode, NULL);
 	glCompileShader(vertex);
-	checkCompileErrors(vertex, "VERTEX");
 
 	// Fragment shader
-	fragment = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment, 1, &fShaderCode, NULL);
-	glCompileShader(fragment);
-	checkCompileErrors(fragment, "FRAGMENT");
+	fragment = 0;
+	if (!compute())
+	{
+		fragment = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragment, 1, &fShaderCode, NULL);
+		glCompileShader(fragment);
+	}
 
 	// Shader program
-	ID = glCreateProgram();
-	glAttachShader(ID, vertex);
-	glAttachShader(ID, fragment);
-	glLinkProgram(ID);
-	checkCompileErrors(ID, "PROGRAM");
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertex);
+	if (fragment)
+		glAttachShader(program, fragment);
+	if (ProgramCache::Supported())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+	return program;
+}
+
+// Reports errors and deletes the stage objects, returns whether the program linked
+// ------------------------------------------------------------------------
+bool Shader::finishCompile(GLuint program, GLuint vertex, GLuint fragment)
+{
+	checkCompileErrors(vertex, compute() ? "COMPUTE" : "VERTEX");
+	if (fragment)
+		checkCompileErrors(fragment, "FRAGMENT");
+	checkCompileErrors(program, "PROGRAM");
 
 	// Delete the shaders as they're linked into our program now and no longer necessary
 	glDeleteShader(vertex);
 	glDeleteShader(fragment);
+
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	return linked == GL_TRUE;
+}
+
+// hot reload
+// ------------------------------------------------------------------------
+void Shader::beginReload()
+{
+	cancelReload();
+
+	std::string vertexCode, fragmentCode;
+	if (!readSources(vertexCode, fragmentCode))
+		return;
+
+	pending.start = std::chrono::steady_clock::now();
+	pending.cacheKey = ProgramCache::Key(vertexCode, fragmentCode, defines);
+	pending.program = startCompile(vertexCode, fragmentCode, pending.vertex, pending.fragment);
 }
+
+bool Shader::pollReload()
+{
+	if (!pending.program)
+		return false;
+
+	// Without the extension the link status query below waits for the driver
+	if (parallelCompileSupported())
+	{
+		GLint done = GL_FALSE;
+		glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &done);
+		if (!done)
+			return false;
+	}
+
+	GLuint program = pending.program;
+	pending.program = 0;
+	if (!finishCompile(program, pending.vertex, pending.fragment))
+	{
+		std::cout << "ERROR::SHADER::RELOAD_FAILED: " << sourceName() << ", keeping the previous program" << std::endl;
+		GLState::deleteProgram(program);
+		return false;
+	}
+
+	GLState::deleteProgram(ID);
+	ID = program;
+	reflect();
+	loadMs = millisecondsSince(pending.start);
+	fromBinaryCache = false;
+	std::cout << "Shader reloaded: " << sourceName() << " compiled in " << loadMs << " ms"
+			  << (parallelCompileSupported() ? " (parallel)" : "") << std::endl;
+
+	if (ProgramCache::Supported())
+		ProgramCache::Write(cachePath(), pending.cacheKey, ID, loadMs);
+	return true;
+}
+
+void Shader::cancelReload()
+{
+	if (!pending.program)
+		return;
+
+	glDeleteShader(pending.vertex);
+	glDeleteShader(pending.fragment);
+	GLState::deleteProgram(pending.program);
+	pending.program = 0;
+}
+
 // activate the shader
 // ------------------------------------------------------------------------
 void Shader::use() const
 {
-	glUseProgram(ID);
+	GLState::useProgram(ID);
 }
 
+// delete the program
+// ------------------------------------------------------------------------
+void Shader::Delete()
+{
+	cancelReload();
+	GLState::deleteProgram(ID);
+	ID = 0;
+	uniformTable.clear();
+	uniformHashes.clear();
+	blockTable.clear();
+}
+
+// uniform reflection
+// ------------------------------------------------------------------------
+void Shader::reflect()
+{
+	uniformTable.clear();
+	uniformHashes.clear();
+	blockTable.clear();
+
+	GLint linked = GL_FALSE;
+	glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+	if (!linked)
+		return;
+
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<GLchar> nameBuffer(std::max(maxLength, 1));
+
+	for (GLint i = 0; i < count; i++)
+	{
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(ID, (GLuint)i, (GLsizei)nameBuffer.size(), &length, &size, &type, nameBuffer.data());
+
+		// Members of uniform blocks have no location, they are set through their buffer
+		GLint location = glGetUniformLocation(ID, nameBuffer.data());
+		if (location < 0)
+			continue;
+
+		std::string name(nameBuffer.data(), length);
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			name.resize(name.size() - 3);
+		uniformTable.push_back({ name, HashString(name), location, type, size });
+	}
+
+	std::sort(uniformTable.begin(), uniformTable.end(), [](const ShaderUniform& a, const ShaderUniform& b)
+	{
+		return a.hash < b.hash;
+	});
+	for (const ShaderUniform& uniform : uniformTable)
+		uniformHashes.push_back(uniform.hash);
+
+	// Uniform and shader storage blocks, through program interface queries
+	const GLenum interfaces[] = { GL_UNIFORM_BLOCK, GL_SHADER_STORAGE_BLOCK };
+	const GLenum properties[] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+	for (GLenum blockInterface : interfaces)
+	{
+		GLint blockCount = 0, maxNameLength = 0;
+		glGetProgramInterfaceiv(ID, blockInterface, GL_ACTIVE_RESOURCES, &blockCount);
+		glGetProgramInterfaceiv(ID, blockInterface, GL_MAX_NAME_LENGTH, &maxNameLength);
+		std::vector<GLchar> blockName(std::max(maxNameLength, 1));
+
+		for (GLint i = 0; i < blockCount; i++)
+		{
+			GLsizei length = 0;
+			glGetProgramResourceName(ID, blockInterface, (GLuint)i, (GLsizei)blockName.size(), &length, blockName.data());
+
+			GLint values[2] = { 0, 0 };
+			glGetProgramResourceiv(ID, blockInterface, (GLuint)i, 2, properties, 2, nullptr, values);
+
+			std::string name(blockName.data(), length);
+			blockTable.push_back({ name, HashString(name), blockInterface, values[0], values[1] });
+		}
+	}
+}
+
+UniformHandle Shader::uniform(uint64_t nameHash) const
+{
+	UniformHandle handle;
+	auto it = std::lower_bound(uniformHashes.begin(), uniformHashes.end(), nameHash);
+	if (it != uniformHashes.end() && *it == nameHash)
+		handle.index = (int)(it - uniformHashes.begin());
+#ifdef SHADER_REPORT_INACTIVE_UNIFORMS
+	else
+		reportInactive(nameHash, std::string());
+#endif
+	return handle;
+}
+
+UniformHandle Shader::uniform(const std::string& name) const
+{
+	uint64_t nameHash = HashString(name);
+#ifdef SHADER_REPORT_INACTIVE_UNIFORMS
+	// Report with the name here, the hash lookup would only know the hash
+	if (!std::binary_search(uniformHashes.begin(), uniformHashes.end(), nameHash))
+		reportInactive(nameHash, name);
+#endif
+	return uniform(nameHash);
+}
+
+#ifdef SHADER_REPORT_INACTIVE_UNIFORMS
+void Shader::reportInactive(uint64_t nameHash, const std::string& name) const
+{
+	if (std::find(reportedInactive.begin(), reportedInactive.end(), nameHash) != reportedInactive.end())
+		return;
+	reportedInactive.push_back(nameHash);
+
+	if (name.empty())
+		std::cout << "WARNING::SHADER::UNIFORM_NOT_ACTIVE: hash 0x" << std::hex << nameHash << std::dec << " in program " << ID << std::endl;
+	else
+		std::cout << "WARNING::SHADER::UNIFORM_NOT_ACTIVE: " << name << " in program " << ID << std::endl;
+}
+#endif
+
 // utility uniform functions
 // ------------------------------------------------------------------------
+void Shader::setBool(UniformHandle handle, bool value) const
+{
+	if (handle.valid())
+		glUniform1i(uniformTable[handle.index].location, (int)value);
+}
+void Shader::setInt(UniformHandle handle, int value) const
+{
+	if (handle.valid())
+		glUniform1i(uniformTable[handle.index].location, value);
+}
+void Shader::setIntArray(UniformHandle handle, const int* values, int count) const
+{
+	if (handle.valid())
+		glUniform1iv(uniformTable[handle.index].location, count, values);
+}
+void Shader::setUInt(UniformHandle handle, unsigned int value) const
+{
+	if (handle.valid())
+		glUniform1ui(uniformTable[handle.index].location, value);
+}
+void Shader::setFloat(UniformHandle handle, float value) const
+{
+	if (handle.valid())
+		glUniform1f(uniformTable[handle.index].location, value);
+}
+void Shader::setFloatArray(UniformHandle handle, const float* values, int count) const
+{
+	if (handle.valid())
+		glUniform1fv(uniformTable[handle.index].location, count, values);
+}
+void Shader::setIVec2(UniformHandle handle, const glm::ivec2& value) const
+{
+	if (handle.valid())
+		glUniform2iv(uniformTable[handle.index].location, 1, &value[0]);
+}
+void Shader::setVec2(UniformHandle handle, const glm::vec2& value) const
+{
+	if (handle.valid())
+		glUniform2fv(uniformTable[handle.index].location, 1, &value[0]);
+}
+void Shader::setVec3(UniformHandle handle, const glm::vec3& value) const
+{
+	if (handle.valid())
+		glUniform3fv(uniformTable[handle.index].location, 1, &value[0]);
+}
+void Shader::setVec4(UniformHandle handle, const glm::vec4& value) const
+{
+	if (handle.valid())
+		glUniform4fv(uniformTable[handle.index].location, 1, &value[0]);
+}
+void Shader::setVec4Array(UniformHandle handle, const glm::vec4* values, int count) const
+{
+	if (handle.valid())
+		glUniform4fv(uniformTable[handle.index].location, count, &values[0][0]);
+}
+void Shader::setMat2(UniformHandle handle, const glm::mat2& mat) const
+{
+	if (handle.valid())
+		glUniformMatrix2fv(uniformTable[handle.index].location, 1, GL_FALSE, &mat[0][0]);
+}
+void Shader::setMat3(UniformHandle handle, const glm::mat3& mat) const
+{
+	if (handle.valid())
+		glUniformMatrix3fv(uniformTable[handle.index].location, 1, GL_FALSE, &mat[0][0]);
+}
+void Shader::setMat4(UniformHandle handle, const glm::mat4& mat) const
+{
+	if (handle.valid())
+		glUniformMatrix4fv(uniformTable[handle.index].location, 1, GL_FALSE, &mat[0][0]);
+}
+// ------------------------------------------------------------------------
 void Shader::setBool(const std::string& name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    setBool(uniform(name), value);
 }
 // ------------------------------------------------------------------------
 void Shader::setInt(const std::string& name, int value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    setInt(uniform(name), value);
 }
 // ------------------------------------------------------------------------
 void Shader::setFloat(const std::string& name, float value) const
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    setFloat(uniform(name), value);
 }
 // ------------------------------------------------------------------------
 void Shader::setVec2(const std::string& name, const glm::vec2& value) const
 {
-    glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    setVec2(uniform(name), value);
 }
 void Shader::setVec2(const std::string& name, float x, float y) const
 {
-    glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+    setVec2(uniform(name), glm::vec2(x, y));
 }
 // ------------------------------------------------------------------------
 void Shader::setVec3(const std::string& name, const glm::vec3& value) const
 {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    setVec3(uniform(name), value);
 }
 void Shader::setVec3(const std::string& name, float x, float y, float z) const
 {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+    setVec3(uniform(name), glm::vec3(x, y, z));
 }
 // ------------------------------------------------------------------------
 void Shader::setVec4(const std::string& name, const glm::vec4& value) const
 {
-    glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    setVec4(uniform(name), value);
 }
 void Shader::setVec4(const std::string& name, float x, float y, float z, float w) const
 {
-    glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+    setVec4(uniform(name), glm::vec4(x, y, z, w));
 }
 // ------------------------------------------------------------------------
 void Shader::setMat2(const std::string& name, const glm::mat2& mat) const
 {
-    glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    setMat2(uniform(name), mat);
 }
 // ------------------------------------------------------------------------
 void Shader::setMat3(const std::string& name, const glm::mat3& mat) const
 {
-    glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    setMat3(uniform(name), mat);
 }
 // ------------------------------------------------------------------------
 void Shader::setMat4(const std::string& name, const glm::mat4& mat) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    setMat4(uniform(name), mat);
 }
 
 // ------------------------------------------------------------------------
-int Shader::getUniformLocation(const std::string& name) {
-		if (uniformLocationCache.find(name) == uniformLocationCache.end())
-		{
-			uniformLocationCache[name] = glGetUniformLocation(ID, name.c_str());
-		}
-		return uniformLocationCache[name];
+int Shader::getUniformLocation(const std::string& name) const {
+		UniformHandle handle = uniform(name);
+		return handle.valid() ? uniformTable[handle.index].location : -1;
 }
 
 
+// ------------------------------------------------------------------------
+std::string Shader::injectDefines(const std::string& code, const std::string& defines)
+{
+	// #version has to stay the first statement, #line keeps compiler errors on the file's line numbers
+	size_t version = code.find("#version");
+	size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+	if (lineEnd == std::string::npos)
+		return defines + code;
+
+	size_t line = (size_t)std::count(code.begin(), code.begin() + lineEnd, '\n') + 2;
+	return code.substr(0, lineEnd + 1) + defines + "#line " + std::to_string(line) + "\n" + code.substr(lineEnd + 1);
+}
+
 // ------------------------------------------------------------------------
 void Shader::checkCompileErrors(GLuint shader, std::string type)
 {
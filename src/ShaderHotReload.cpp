@@ -0,0 +1,58 @@
+#include "Graphics/ShaderHotReload.h"
+#include "Graphics/AssetManager.h"
+
+#include <algorithm>
+
+ShaderHotReload::ShaderHotReload(const std::string& directory)
+	: watcher(directory)
+{
+}
+
+void ShaderHotReload::watch(Shader* shader)
+{
+	shaders.push_back(shader);
+}
+
+void ShaderHotReload::watch(ShaderPermutations* shaderPermutations)
+{
+	permutations.push_back(shaderPermutations);
+}
+
+void ShaderHotReload::unwatch(Shader* shader)
+{
+	shaders.erase(std::remove(shaders.begin(), shaders.end(), shader), shaders.end());
+}
+
+void ShaderHotReload::unwatch(ShaderPermutations* shaderPermutations)
+{
+	permutations.erase(std::remove(permutations.begin(), permutations.end(), shaderPermutations), permutations.end());
+}
+
+void ShaderHotReload::update()
+{
+	for (const std::string& file : watcher.poll())
+	{
+		std::string changed = AssetManager::NormalizePath(file);
+		auto uses = [&](const std::string& vertexPath, const std::string& fragmentPath)
+		{
+			return AssetManager::NormalizePath(vertexPath) == changed || AssetManager::NormalizePath(fragmentPath) == changed;
+		};
+
+		for (Shader* shader : shaders)
+		{
+			bool changedCompute = !shader->computePath.empty() && AssetManager::NormalizePath(shader->computePath) == changed;
+			if (changedCompute || uses(shader->vertexPath, shader->fragmentPath))
+				shader->beginReload();
+		}
+		for (ShaderPermutations* shaderPermutations : permutations)
+		{
+			if (uses(shaderPermutations->vertexFile(), shaderPermutations->fragmentFile()))
+				shaderPermutations->beginReload();
+		}
+	}
+
+	for (Shader* shader : shaders)
+		shader->pollReload();
+	for (ShaderPermutations* shaderPermutations : permutations)
+		shaderPermutations->pollReload();
+}
@@ -0,0 +1,121 @@
+#include "Graphics/ShaderPermutations.h"
+
+#include <algorithm>
+
+unsigned int ShaderFeaturesFromTextures(const std::vector<Texture>& textures)
+{
+	unsigned int features = 0;
+	for (const Texture& texture : textures)
+	{
+		if (texture.textureType == "texture_diffuse")
+			features |= SHADER_FEATURE_DIFFUSE_MAP;
+		else if (texture.textureType == "texture_specular")
+			features |= SHADER_FEATURE_SPECULAR_MAP;
+		else if (texture.textureType == "texture_normal")
+			features |= SHADER_FEATURE_NORMAL_MAP;
+		else if (texture.textureType == "texture_ambientOcclusion")
+			features |= SHADER_FEATURE_AO_MAP;
+	}
+	return features;
+}
+
+uint64_t ShaderPermutation::key() const
+{
+	// 16 bits each, far above any light count a forward pass can afford; clustered variants share one key for any local light count
+	if (gbuffer)
+		return (uint64_t)features | 1u << 14;
+	uint64_t flags = (uint64_t)features | (uint64_t)localShadows << 12 | (uint64_t)shadows << 13;
+	if (clustered)
+		return flags | 1u << 15 | (uint64_t)std::min(dirLights, 0xFFFFu) << 16;
+	return flags | (uint64_t)std::min(dirLights, 0xFFFFu) << 16 |
+		(uint64_t)std::min(pointLights, 0xFFFFu) << 32 | (uint64_t)std::min(spotLights, 0xFFFFu) << 48;
+}
+
+std::string ShaderPermutation::defines() const
+{
+	std::string result;
+	if (features & SHADER_FEATURE_DIFFUSE_MAP)
+		result += "#define HAS_DIFFUSE_MAP\n";
+	if (features & SHADER_FEATURE_SPECULAR_MAP)
+		result += "#define HAS_SPECULAR_MAP\n";
+	if (features & SHADER_FEATURE_NORMAL_MAP)
+		result += "#define HAS_NORMAL_MAP\n";
+	if (features & SHADER_FEATURE_AO_MAP)
+		result += "#define HAS_AO_MAP\n";
+	if (gbuffer)
+		return result + "#define GBUFFER_OUTPUT\n#define NUM_DIR_LIGHTS 0\n#define NUM_POINT_LIGHTS 0\n#define NUM_SPOT_LIGHTS 0\n";
+	if (shadows)
+		result += "#define SHADOWS\n";
+	if (localShadows)
+		result += "#define LOCAL_SHADOWS\n";
+	result += "#define NUM_DIR_LIGHTS " + std::to_string(dirLights) + "\n";
+	if (clustered)
+		return result + "#define CLUSTERED_LIGHTING\n";
+	result += "#define NUM_POINT_LIGHTS " + std::to_string(pointLights) + "\n";
+	result += "#define NUM_SPOT_LIGHTS " + std::to_string(spotLights) + "\n";
+	return result;
+}
+
+ShaderPermutation ShaderPermutation::vertexStage() const
+{
+	return ShaderPermutation();
+}
+
+ShaderPermutations::ShaderPermutations(const std::string& vertexPath, const std::string& fragmentPath, bool vertexStageOnly)
+	: vertexPath(vertexPath), fragmentPath(fragmentPath), vertexStageOnly(vertexStageOnly), lastKey(0), lastShader(nullptr)
+{
+}
+
+ShaderPermutations::~ShaderPermutations()
+{
+	Delete();
+}
+
+Shader& ShaderPermutations::get(const ShaderPermutation& requested)
+{
+	const ShaderPermutation permutation = vertexStageOnly ? requested.vertexStage() : requested;
+	uint64_t key = permutation.key();
+	if (lastShader && key == lastKey)
+		return *lastShader;
+
+	std::unique_ptr<Shader>& variant = variants[key];
+	if (!variant)
+	{
+		variant.reset(new Shader(vertexPath.c_str(), fragmentPath.c_str(), permutation.defines()));
+		if (setup)
+		{
+			variant->use();
+			setup(*variant);
+		}
+	}
+
+	lastKey = key;
+	lastShader = variant.get();
+	return *variant;
+}
+
+void ShaderPermutations::beginReload()
+{
+	for (auto& variant : variants)
+		variant.second->beginReload();
+}
+
+void ShaderPermutations::pollReload()
+{
+	for (auto& variant : variants)
+	{
+		if (variant.second->pollReload() && setup)
+		{
+			variant.second->use();
+			setup(*variant.second);
+		}
+	}
+}
+
+void ShaderPermutations::Delete()
+{
+	for (auto& variant : variants)
+		variant.second->Delete();
+	variants.clear();
+	lastShader = nullptr;
+}
@@ -0,0 +1,480 @@
+#include "Graphics/ShadowAtlas.h"
+#include "Graphics/GLState.h"
+
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Tiles never get smaller than this, whatever minTileSize says
+static const int SMALLEST_TILE_SIZE = 16;
+
+// Light ranges are clipped to this, lights with linear or no attenuation reach infinitely far
+static const float MAX_SHADOW_RANGE = 200.0f;
+static const float SHADOW_NEAR_PLANE = 0.05f;
+
+// Depth slope bias while drawing tiles, perspective depth gets steep at grazing angles
+static const float SLOPE_BIAS = 2.0f;
+static const float CONSTANT_BIAS = 2.0f;
+
+// Uniform name hashes, computed at compile time
+static constexpr uint64_t LIGHT_VIEW_PROJECTION_UNIFORM = HashLiteral("lightViewProjection");
+
+// Cube face directions and up vectors in tile order
+static const glm::vec3 FACE_DIRECTIONS[SHADOW_TILES_PER_LIGHT] = {
+	glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+	glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+};
+static const glm::vec3 FACE_UPS[SHADOW_TILES_PER_LIGHT] = {
+	glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+	glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+};
+
+// The fields a shadow depends on, color and the shadow tile are not part of it
+static bool SameShadow(const GpuLight& a, const GpuLight& b)
+{
+	return a.position == b.position && glm::vec3(a.direction) == glm::vec3(b.direction) && a.params == b.params;
+}
+
+static float ShadowRange(const GpuLight& light)
+{
+	return std::min(light.params.w, MAX_SHADOW_RANGE);
+}
+
+ShadowAtlas::ShadowAtlas(LightManager& lights, int size, const char* vertexPath, const char* fragmentPath)
+	: lights(lights), size(size), shader(vertexPath, fragmentPath), tiles(MAX_SHADOWED_LIGHTS * SHADOW_TILES_PER_LIGHT), slots(MAX_SHADOWED_LIGHTS)
+{
+	// Hardware 2x2 PCF, the shader keeps its taps inside the tile
+	glGenTextures(1, &depthAtlas);
+	GLState::bindTexture(GL_TEXTURE_2D, depthAtlas);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, size, size);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthAtlas, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "ERROR::SHADOW_ATLAS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenBuffers(1, &tileBuffer);
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, tileBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, tiles.size() * sizeof(GpuShadowTile), nullptr, GL_DYNAMIC_DRAW);
+
+	// The whole atlas starts as one free block
+	freeBlocks.resize(levelOf(SMALLEST_TILE_SIZE) + 1);
+	freeBlocks[0].push_back(glm::ivec2(0));
+}
+
+ShadowAtlas::~ShadowAtlas()
+{
+	Delete();
+}
+
+bool ShadowAtlas::addLight(LightHandle light)
+{
+	if (lights.type(light) == LightType::Directional)
+		return false;
+
+	for (unsigned int slot = 0; slot < slots.size(); slot++)
+	{
+		if (slots[slot].light == light)
+			return true;
+	}
+	for (unsigned int slot = 0; slot < slots.size(); slot++)
+	{
+		if (slots[slot].light != NO_LIGHT)
+			continue;
+
+		slots[slot] = ShadowedLight();
+		slots[slot].light = light;
+		lights.setShadowTile(light, (int)(slot * SHADOW_TILES_PER_LIGHT));
+		return true;
+	}
+	return false;
+}
+
+void ShadowAtlas::removeLight(LightHandle light)
+{
+	for (ShadowedLight& shadowed : slots)
+	{
+		if (shadowed.light != light)
+			continue;
+
+		release(shadowed);
+		lights.setShadowTile(light, -1);
+		shadowed.light = NO_LIGHT;
+	}
+}
+
+void ShadowAtlas::invalidate()
+{
+	for (ShadowedLight& shadowed : slots)
+		shadowed.dirtyTiles = (1u << SHADOW_TILES_PER_LIGHT) - 1;
+}
+
+void ShadowAtlas::render(const ShadowCasters& casters, const RenderView& view, GLuint target, int viewportWidth, int viewportHeight)
+{
+	atlasStats.shadowedLights = atlasStats.tiles = atlasStats.renderedTiles = atlasStats.pendingTiles = atlasStats.reallocatedLights = 0;
+	if (!depthAtlas || !shader.ID)
+		return;
+
+	// Every tile holds the static casters as they were when it was drawn
+	if (casters.staticHash() != lastStaticHash)
+		invalidate();
+	lastStaticHash = casters.staticHash();
+
+	// Tile sizes from the lights' size on screen. Growing happens at once, shrinking only at a quarter
+	// of the size, so a light near the threshold does not bounce between two allocations.
+	std::vector<unsigned int> resized;
+	std::vector<int> resizedTo(slots.size(), 0);
+	for (unsigned int slot = 0; slot < slots.size(); slot++)
+	{
+		ShadowedLight& shadowed = slots[slot];
+		if (shadowed.light == NO_LIGHT)
+			continue;
+		atlasStats.shadowedLights++;
+
+		const GpuLight& light = lights.get(shadowed.light);
+		if (!SameShadow(light, shadowed.rendered))
+		{
+			shadowed.rendered = light;
+			shadowed.dirtyTiles = (1u << SHADOW_TILES_PER_LIGHT) - 1;
+			if (shadowed.tileSize)
+				updateMatrices(shadowed, light);
+		}
+
+		// A light still moving its tiles to the last size finishes that first
+		int tileSize = targetTileSize(light, view, shadowed.importance);
+		if (shadowed.retiringTiles)
+			continue;
+		if (!shadowed.tileSize || tileSize > shadowed.tileSize || tileSize * 4 <= shadowed.tileSize)
+		{
+			resized.push_back(slot);
+			resizedTo[slot] = tileSize;
+		}
+	}
+
+	// Placed from the most important light down, the old blocks are freed tile by tile as the new ones are drawn
+	std::sort(resized.begin(), resized.end(), [&](unsigned int a, unsigned int b) { return slots[a].importance > slots[b].importance; });
+	for (unsigned int slot : resized)
+	{
+		ShadowedLight& shadowed = slots[slot];
+		if (resize(shadowed, resizedTo[slot]))
+		{
+			updateMatrices(shadowed, shadowed.rendered);
+			atlasStats.reallocatedLights++;
+		}
+	}
+
+	// Out of date tiles: light or static casters changed, or a dynamic caster is or was in the tile
+	std::vector<TileUpdate> updates;
+	for (unsigned int slot = 0; slot < slots.size(); slot++)
+	{
+		ShadowedLight& shadowed = slots[slot];
+		if (shadowed.light == NO_LIGHT || !shadowed.tileSize)
+			continue;
+
+		unsigned int count = tileCount(shadowed);
+		atlasStats.tiles += count;
+		for (unsigned int tile = 0; tile < count; tile++)
+		{
+			unsigned int bit = 1u << tile;
+			if (!(shadowed.dirtyTiles & bit) && !casters.dynamicBounds().empty())
+			{
+				Frustum frustum = Frustum::FromMatrix(shadowed.viewProjection[tile]);
+				for (const CasterBounds& bounds : casters.dynamicBounds())
+				{
+					if (frustum.intersects(bounds.min, bounds.max))
+					{
+						shadowed.dirtyTiles |= bit;
+						break;
+					}
+				}
+			}
+			if (shadowed.dynamicTiles & bit)
+				shadowed.dirtyTiles |= bit;
+			if (!(shadowed.dirtyTiles & bit))
+				continue;
+
+			// Tiles never drawn first, then tiles still shown from their retiring block, then by screen size
+			// weighted with the frames they waited
+			bool drawn = tiles[slot * SHADOW_TILES_PER_LIGHT + tile].rect.z > 0.0f;
+			bool retiring = (shadowed.retiringTiles & bit) != 0;
+			float priority = (shadowed.importance + 1.0f) * (shadowed.waitingFrames[tile] + 1) + (drawn ? 0.0f : 1e9f) + (retiring ? 1e6f : 0.0f);
+			updates.push_back({ slot, tile, priority });
+		}
+	}
+
+	size_t budget = std::min<size_t>(tileBudget, updates.size());
+	std::partial_sort(updates.begin(), updates.begin() + budget, updates.end(),
+		[](const TileUpdate& a, const TileUpdate& b) { return a.priority > b.priority; });
+	for (size_t i = budget; i < updates.size(); i++)
+		slots[updates[i].slot].waitingFrames[updates[i].tile]++;
+	atlasStats.pendingTiles = (unsigned int)(updates.size() - budget);
+
+	// Time of a frame a few frames back, an unfinished one keeps the older time
+	timers.beginFrame();
+	atlasStats.ms = timers.times().ms[0];
+
+	if (budget)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		GLState::depthMask(GL_TRUE);
+		GLState::depthFunc(GL_LESS);
+		glEnable(GL_SCISSOR_TEST);
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(SLOPE_BIAS, CONSTANT_BIAS);
+		timers.begin(0);
+
+		shader.use();
+		UniformHandle lightViewProjectionUniform = shader.uniform(LIGHT_VIEW_PROJECTION_UNIFORM);
+		for (size_t i = 0; i < budget; i++)
+		{
+			ShadowedLight& shadowed = slots[updates[i].slot];
+			unsigned int tile = updates[i].tile;
+			glm::ivec2 origin = shadowed.origins[tile];
+
+			// The scissor keeps the clear inside the tile
+			glViewport(origin.x, origin.y, shadowed.tileSize, shadowed.tileSize);
+			glScissor(origin.x, origin.y, shadowed.tileSize, shadowed.tileSize);
+			glClear(GL_DEPTH_BUFFER_BIT);
+
+			Frustum frustum = Frustum::FromMatrix(shadowed.viewProjection[tile]);
+			shader.setMat4(lightViewProjectionUniform, shadowed.viewProjection[tile]);
+			casters.draw(shader, 1, &frustum);
+
+			bool dynamicInside = false;
+			for (const CasterBounds& bounds : casters.dynamicBounds())
+				dynamicInside = dynamicInside || frustum.intersects(bounds.min, bounds.max);
+
+			// Receivers switch to the new matrix only now that the tile matches it
+			GpuShadowTile& record = tiles[updates[i].slot * SHADOW_TILES_PER_LIGHT + tile];
+			record.viewProjection = shadowed.viewProjection[tile];
+			record.rect = glm::vec4(glm::vec2(origin), glm::vec2((float)shadowed.tileSize)) / (float)size;
+			record.params = glm::vec4(2.0f * std::tan(0.5f * shadowed.fieldOfView) / shadowed.tileSize, normalOffset, 1.0f / shadowed.tileSize, 0.0f);
+			tilesDirty = true;
+
+			// Nothing reads the tile's old block any more
+			unsigned int bit = 1u << tile;
+			if (shadowed.retiringTiles & bit)
+			{
+				freeBlock(levelOf(shadowed.retiringSize), shadowed.retiringOrigins[tile]);
+				shadowed.retiringTiles &= ~bit;
+			}
+			shadowed.dirtyTiles &= ~bit;
+			shadowed.dynamicTiles = dynamicInside ? shadowed.dynamicTiles | bit : shadowed.dynamicTiles & ~bit;
+			shadowed.waitingFrames[tile] = 0;
+		}
+		atlasStats.renderedTiles = (unsigned int)budget;
+
+		timers.end();
+		glDisable(GL_POLYGON_OFFSET_FILL);
+		glDisable(GL_SCISSOR_TEST);
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+		glViewport(0, 0, viewportWidth, viewportHeight);
+	}
+
+	// 36 KB at most, one call is cheaper than tracking the changed records
+	GLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, tileBuffer);
+	if (tilesDirty)
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, tiles.size() * sizeof(GpuShadowTile), tiles.data());
+	tilesDirty = false;
+	GLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, SHADOW_TILE_BUFFER_BINDING, tileBuffer);
+	GLState::bindTexture(SHADOW_ATLAS_UNIT, GL_TEXTURE_2D, depthAtlas);
+}
+
+int ShadowAtlas::levelOf(int tileSize) const
+{
+	int level = 0;
+	while ((size >> (level + 1)) >= tileSize)
+		level++;
+	return level;
+}
+
+bool ShadowAtlas::allocateBlock(int level, glm::ivec2& origin)
+{
+	std::vector<glm::ivec2>& free = freeBlocks[level];
+	if (!free.empty())
+	{
+		origin = free.back();
+		free.pop_back();
+		return true;
+	}
+
+	// Split a block of the next larger size, keep its first quarter
+	glm::ivec2 parent;
+	if (level == 0 || !allocateBlock(level - 1, parent))
+		return false;
+	int half = size >> level;
+	free.push_back(parent + glm::ivec2(half, half));
+	free.push_back(parent + glm::ivec2(0, half));
+	free.push_back(parent + glm::ivec2(half, 0));
+	origin = parent;
+	return true;
+}
+
+void ShadowAtlas::freeBlock(int level, glm::ivec2 origin)
+{
+	std::vector<glm::ivec2>& free = freeBlocks[level];
+	if (level > 0)
+	{
+		// Merge with the other three quarters of the parent if they are all free
+		int blockSize = size >> level;
+		glm::ivec2 parent = origin / (2 * blockSize) * (2 * blockSize);
+		std::vector<size_t> siblings;
+		for (size_t i = 0; i < free.size() && siblings.size() < 3; i++)
+		{
+			if (free[i] / (2 * blockSize) * (2 * blockSize) == parent)
+				siblings.push_back(i);
+		}
+		if (siblings.size() == 3)
+		{
+			for (size_t i = 3; i-- > 0;)
+			{
+				free[siblings[i]] = free.back();
+				free.pop_back();
+			}
+			freeBlock(level - 1, parent);
+			return;
+		}
+	}
+	free.push_back(origin);
+}
+
+bool ShadowAtlas::allocate(ShadowedLight& shadowed, int tileSize)
+{
+	// Smaller tiles when the atlas is too full for the wanted size
+	unsigned int count = tileCount(shadowed);
+	for (int level = levelOf(tileSize); level < (int)freeBlocks.size() && (size >> level) >= std::max(SMALLEST_TILE_SIZE, std::min(minTileSize, tileSize)); level++)
+	{
+		unsigned int placed = 0;
+		while (placed < count && allocateBlock(level, shadowed.origins[placed]))
+			placed++;
+		if (placed == count)
+		{
+			shadowed.tileSize = size >> level;
+			shadowed.dirtyTiles = (1u << SHADOW_TILES_PER_LIGHT) - 1;
+			return true;
+		}
+		while (placed-- > 0)
+			freeBlock(level, shadowed.origins[placed]);
+	}
+	return false;
+}
+
+bool ShadowAtlas::resize(ShadowedLight& shadowed, int tileSize)
+{
+	if (!shadowed.tileSize)
+		return allocate(shadowed, tileSize);
+
+	// The new blocks are taken while the old ones are still in use. A full atlas may only offer the old size
+	// or one further from the target, the light then keeps its tiles and tries again next frame.
+	int oldSize = shadowed.tileSize;
+	unsigned int oldDirtyTiles = shadowed.dirtyTiles;
+	glm::ivec2 oldOrigins[SHADOW_TILES_PER_LIGHT];
+	std::copy(shadowed.origins, shadowed.origins + SHADOW_TILES_PER_LIGHT, oldOrigins);
+	if (allocate(shadowed, tileSize))
+	{
+		if (tileSize > oldSize ? shadowed.tileSize > oldSize : shadowed.tileSize < oldSize)
+		{
+			shadowed.retiringSize = oldSize;
+			std::copy(oldOrigins, oldOrigins + SHADOW_TILES_PER_LIGHT, shadowed.retiringOrigins);
+			shadowed.retiringTiles = (1u << tileCount(shadowed)) - 1;
+			return true;
+		}
+		for (unsigned int tile = 0; tile < tileCount(shadowed); tile++)
+			freeBlock(levelOf(shadowed.tileSize), shadowed.origins[tile]);
+	}
+	shadowed.tileSize = oldSize;
+	shadowed.dirtyTiles = oldDirtyTiles;
+	std::copy(oldOrigins, oldOrigins + SHADOW_TILES_PER_LIGHT, shadowed.origins);
+	return false;
+}
+
+void ShadowAtlas::release(ShadowedLight& shadowed)
+{
+	if (!shadowed.tileSize)
+		return;
+
+	int level = levelOf(shadowed.tileSize);
+	unsigned int slot = (unsigned int)(&shadowed - slots.data());
+	for (unsigned int tile = 0; tile < tileCount(shadowed); tile++)
+	{
+		freeBlock(level, shadowed.origins[tile]);
+		if (shadowed.retiringTiles >> tile & 1)
+			freeBlock(levelOf(shadowed.retiringSize), shadowed.retiringOrigins[tile]);
+		tiles[slot * SHADOW_TILES_PER_LIGHT + tile].rect = glm::vec4(0.0f);
+	}
+	shadowed.retiringTiles = 0;
+	shadowed.tileSize = 0;
+	shadowed.dynamicTiles = 0;
+	tilesDirty = true;
+}
+
+unsigned int ShadowAtlas::tileCount(const ShadowedLight& shadowed) const
+{
+	return lights.type(shadowed.light) == LightType::Point ? SHADOW_TILES_PER_LIGHT : 1;
+}
+
+int ShadowAtlas::targetTileSize(const GpuLight& light, const RenderView& view, float& importance) const
+{
+	// Lights whose range is off screen only shadow what the camera may turn to, at the smallest size
+	float range = ShadowRange(light);
+	glm::vec3 position = glm::vec3(light.position);
+	importance = 0.0f;
+	if (!view.frustum.intersects(position - glm::vec3(range), position + glm::vec3(range)))
+		return minTileSize;
+
+	float distance = glm::length(position - view.position);
+	importance = distance > range ? 2.0f * range * view.pixelsPerUnit(distance) : view.viewportHeight;
+
+	int tileSize = minTileSize;
+	while (tileSize < maxTileSize && tileSize < importance * tileDetail)
+		tileSize *= 2;
+	return std::min(tileSize, size);
+}
+
+void ShadowAtlas::updateMatrices(ShadowedLight& shadowed, const GpuLight& light) const
+{
+	float range = std::max(ShadowRange(light), 2.0f * SHADOW_NEAR_PLANE);
+	glm::vec3 position = glm::vec3(light.position);
+	if (light.color.w == (float)LightType::Point)
+	{
+		shadowed.fieldOfView = glm::radians(90.0f);
+		glm::mat4 projection = glm::perspective(shadowed.fieldOfView, 1.0f, SHADOW_NEAR_PLANE, range);
+		for (unsigned int face = 0; face < SHADOW_TILES_PER_LIGHT; face++)
+			shadowed.viewProjection[face] = projection * glm::lookAt(position, position + FACE_DIRECTIONS[face], FACE_UPS[face]);
+		return;
+	}
+
+	// The outer cone plus a margin for the filter taps at its edge
+	glm::vec3 direction = glm::normalize(glm::vec3(light.direction));
+	glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	shadowed.fieldOfView = std::min(2.0f * std::acos(glm::clamp(light.params.y, -1.0f, 1.0f)) + glm::radians(2.0f), glm::radians(170.0f));
+	shadowed.viewProjection[0] = glm::perspective(shadowed.fieldOfView, 1.0f, SHADOW_NEAR_PLANE, range) * glm::lookAt(position, position + direction, up);
+}
+
+void ShadowAtlas::Delete()
+{
+	shader.Delete();
+	GLState::deleteTexture(depthAtlas);
+	depthAtlas = 0;
+	if (framebuffer)
+		glDeleteFramebuffers(1, &framebuffer);
+	framebuffer = 0;
+	if (tileBuffer)
+		GLState::deleteBuffer(tileBuffer);
+	tileBuffer = 0;
+	timers.Delete();
+}
@@ -0,0 +1,133 @@
+#include "Graphics/ShadowCasters.h"
+#include "Graphics/GLState.h"
+#include "Graphics/Hash.h"
+#include "Graphics/Model.h"
+
+#include <algorithm>
+#include <cfloat>
+
+// Uniform name hashes, computed at compile time
+static constexpr uint64_t INSTANCED_UNIFORM = HashLiteral("instanced");
+static constexpr uint64_t NODE_TRANSFORM_UNIFORM = HashLiteral("nodeTransform");
+static constexpr uint64_t MODEL_UNIFORM = HashLiteral("model");
+static constexpr uint64_t FIRST_INSTANCE_UNIFORM = HashLiteral("firstInstance");
+
+// Instances per group of an instanced caster. Scenes add neighbouring instances one after another,
+// so consecutive ones make compact bounds; smaller groups cull tighter but split the draws more.
+static const size_t INSTANCE_GROUP_SIZE = 8;
+
+void ShadowCasters::clear()
+{
+	casters.clear();
+	groups.clear();
+	dynamic.clear();
+	hash = HASH_SEED;
+}
+
+void ShadowCasters::add(Model& model, const glm::mat4& transform, bool isDynamic)
+{
+	Caster caster = { &model, transform, nullptr, CasterBounds(), 0, 0 };
+	TransformBounds(model.boundsMin, model.boundsMax, transform, caster.bounds.min, caster.bounds.max);
+	casters.push_back(caster);
+
+	if (isDynamic)
+		dynamic.push_back(caster.bounds);
+	else
+		hash = HashValue(transform, HashValue(&model, hash));
+}
+
+void ShadowCasters::add(Model& model, const InstanceBuffer& instances, bool isDynamic)
+{
+	if (instances.empty())
+		return;
+
+	Caster caster = { &model, glm::mat4(1.0f), &instances, CasterBounds(), groups.size(), 0 };
+	caster.bounds.min = glm::vec3(FLT_MAX);
+	caster.bounds.max = glm::vec3(-FLT_MAX);
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		if (i % INSTANCE_GROUP_SIZE == 0)
+		{
+			InstanceGroup group = { { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) }, (GLint)i, 0 };
+			groups.push_back(group);
+			caster.groupCount++;
+		}
+
+		CasterBounds instance;
+		TransformBounds(model.boundsMin, model.boundsMax, instances.data()[i].model, instance.min, instance.max);
+		InstanceGroup& group = groups.back();
+		group.bounds.min = glm::min(group.bounds.min, instance.min);
+		group.bounds.max = glm::max(group.bounds.max, instance.max);
+		group.instanceCount++;
+		caster.bounds.min = glm::min(caster.bounds.min, instance.min);
+		caster.bounds.max = glm::max(caster.bounds.max, instance.max);
+		if (isDynamic)
+			dynamic.push_back(instance);
+	}
+	casters.push_back(caster);
+
+	if (!isDynamic)
+		hash = HashBytes(instances.data(), instances.size() * sizeof(InstanceData), HashValue(&model, hash));
+}
+
+void ShadowCasters::draw(Shader& shader, int instanceRepeat, const Frustum* frustum) const
+{
+	UniformHandle instancedUniform = shader.uniform(INSTANCED_UNIFORM);
+	UniformHandle nodeTransformUniform = shader.uniform(NODE_TRANSFORM_UNIFORM);
+	UniformHandle modelUniform = shader.uniform(MODEL_UNIFORM);
+	UniformHandle firstInstanceUniform = shader.uniform(FIRST_INSTANCE_UNIFORM);
+	for (const Caster& caster : casters)
+	{
+		if (frustum && !frustum->intersects(caster.bounds.min, caster.bounds.max))
+			continue;
+
+		caster.model->nodes.update();
+		shader.setBool(instancedUniform, caster.instances != nullptr);
+		if (!caster.instances)
+		{
+			drawMeshes(shader, caster, (GLsizei)instanceRepeat, nodeTransformUniform, modelUniform);
+			continue;
+		}
+
+		// Every run of consecutive groups inside the frustum is one draw
+		caster.instances->bind();
+		GLint firstInstance = 0;
+		GLsizei instanceCount = 0;
+		size_t end = caster.firstGroup + caster.groupCount;
+		for (size_t group = caster.firstGroup; group < end; group++)
+		{
+			bool inside = !frustum || frustum->intersects(groups[group].bounds.min, groups[group].bounds.max);
+			if (inside)
+			{
+				if (!instanceCount)
+					firstInstance = groups[group].firstInstance;
+				instanceCount += groups[group].instanceCount;
+			}
+			if (instanceCount && (!inside || group + 1 == end))
+			{
+				shader.setInt(firstInstanceUniform, firstInstance);
+				drawMeshes(shader, caster, instanceCount * instanceRepeat, nodeTransformUniform, modelUniform);
+				instanceCount = 0;
+			}
+		}
+	}
+}
+
+void ShadowCasters::drawMeshes(Shader& shader, const Caster& caster, GLsizei instanceCount, UniformHandle nodeTransformUniform, UniformHandle modelUniform) const
+{
+	Model& model = *caster.model;
+	for (unsigned int i = 0; i < model.meshes.size(); i++)
+	{
+		const Mesh& mesh = model.meshes[i];
+		if (caster.instances)
+			shader.setMat4(nodeTransformUniform, model.meshTransform(i));
+		else
+			shader.setMat4(modelUniform, caster.transform * model.meshTransform(i));
+
+		// Finest level, so receivers shadow themselves with the surface they were drawn with
+		const MeshLod& level = mesh.lods[0];
+		GLState::bindVertexArray(mesh.positionVAO);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, level.indexCount, mesh.indexType,
+			(void*)((size_t)(mesh.firstIndex + level.indexOffset) * IndexSize(mesh.indexType)), instanceCount, mesh.baseVertex);
+	}
+}
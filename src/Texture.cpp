@@ -1,4 +1,6 @@
 #include "Graphics/Texture.h"
+#include "Graphics/GLState.h"
+#include "Graphics/TextureStreamer.h"
 
 Texture::Texture(const char* image, GLenum texType, GLenum slot, GLenum format, GLenum pixelType)
 	: type(texType), path(image) {
@@ -9,8 +11,7 @@ Texture::Texture(const char* image, GLenum texType, GLenum slot, GLenum format,
 
 	// Generate texture object
 	glGenTextures(1, &ID);
-	glActiveTexture(slot);
-	glBindTexture(texType, ID);
+	GLState::bindTexture(slot - GL_TEXTURE0, texType, ID);
 
 	// Scaling options
 	glTexParameteri(texType, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
@@ -26,7 +27,12 @@ Texture::Texture(const char* image, GLenum texType, GLenum slot, GLenum format,
 
 	// Free resources
 	stbi_image_free(bytes);
-	glBindTexture(texType, 0);
+	GLState::bindTexture(slot - GL_TEXTURE0, texType, 0);
+}
+
+Texture::Texture(const char* image, const std::string& textureType, TextureStreamer& streamer)
+	: type(GL_TEXTURE_2D), textureType(textureType), path(image), unit(0) {
+	ID = streamer.request(image, textureType);
 }
 
 Texture::Texture()
@@ -41,23 +47,22 @@ void Texture::texUnit(Shader& shader, const char* uniform, GLuint unit) {
 }
 
 void Texture::Bind() {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(type, ID);
+	GLState::bindTexture(0, type, ID);
 }
 
 void Texture::Unbind() {
-	glBindTexture(type, 0);
+	GLState::bindTexture(0, type, 0);
 }
 
 void Texture::Delete() {
-	glDeleteTextures(1, &ID);
+	GLState::deleteTexture(ID);
 }
 
 // Loader with vector containing the the paths to the cubemap faces
 unsigned int Texture::loadCubemap(std::vector<std::string> faces) {
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	GLState::bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
 	int width, height, numChannels;
 	stbi_set_flip_vertically_on_load(false); // Temporarily disable vertical flipping
@@ -99,7 +104,7 @@ unsigned int Texture::loadCubemap(std::string path, std::string pictureType) {
 
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	GLState::bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
 	int width, height, numChannels;
 	stbi_set_flip_vertically_on_load(false); // Temporarily disable vertical flipping
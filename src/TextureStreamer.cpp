@@ -0,0 +1,327 @@
+#include "Graphics/TextureStreamer.h"
+#include "Graphics/GLState.h"
+#include <Graphics/stb_image.h>
+
+#include <algorithm>
+#include <iostream>
+
+// Spare PBOs kept around for reuse
+const size_t MAX_FREE_PIXEL_BUFFERS = 4;
+
+TextureStreamer::TextureStreamer(size_t uploadBudgetBytes, ThreadPool& pool)
+	: uploadBudget(uploadBudgetBytes), pool(pool), decoding(0), hasCurrent(false), nextRequest(1) {}
+
+TextureStreamer::~TextureStreamer()
+{
+	// Decode tasks point back at us, let them finish first
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		decodeFinished.wait(lock, [this]() { return decoding == 0; });
+	}
+
+	for (DecodedImage& image : decoded)
+		stbi_image_free(image.pixels);
+	if (hasCurrent)
+	{
+		stbi_image_free(current.image.pixels);
+		GLState::deleteBuffer(current.pbo);
+	}
+
+	for (InFlightUpload& upload : inFlight)
+	{
+		glDeleteSync(upload.fence);
+		GLState::deleteBuffer(upload.pbo);
+	}
+	for (PixelBuffer& buffer : freeBuffers)
+		GLState::deleteBuffer(buffer.id);
+}
+
+GLuint TextureStreamer::request(const std::string& path, const std::string& textureType, bool gamma, bool flipVertically)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	setPlaceholder(texture, textureType);
+
+	uint64_t request = nextRequest++;
+	pending[texture] = request;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		decoding++;
+	}
+
+	pool.submit([this, path, request, texture, gamma, flipVertically]()
+	{
+		DecodedImage image;
+		image.request = request;
+		image.texture = texture;
+		image.gamma = gamma;
+
+		// stb keeps the flip flag per thread once this is set
+		stbi_set_flip_vertically_on_load_thread(flipVertically);
+		image.pixels = stbi_load(path.c_str(), &image.width, &image.height, &image.channels, 0);
+		if (image.pixels)
+			image.size = (size_t)image.width * image.height * image.channels;
+		else
+			std::cout << "Texture failed to load at path: " << path << std::endl;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		decoded.push_back(image);
+		decoding--;
+		decodeFinished.notify_all();
+	});
+
+	return texture;
+}
+
+void TextureStreamer::update()
+{
+	frameStats = TextureStreamerStats();
+
+	retireUploads(false);
+
+	size_t budget = uploadBudget;
+	while (stageNext(budget, false)) {}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	frameStats.decoding = decoding;
+	frameStats.queued = (unsigned int)decoded.size() + (hasCurrent ? 1 : 0);
+	frameStats.inFlight = (unsigned int)inFlight.size();
+}
+
+void TextureStreamer::flush()
+{
+	for (;;)
+	{
+		size_t budget = 0;
+		while (stageNext(budget, true)) {}
+		retireUploads(true);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		if (decoding == 0 && decoded.empty() && !hasCurrent && inFlight.empty())
+			break;
+		decodeFinished.wait(lock, [this]() { return !decoded.empty() || decoding == 0; });
+	}
+}
+
+void TextureStreamer::cancel(GLuint texture)
+{
+	auto it = pending.find(texture);
+	if (it == pending.end())
+		return;
+
+	uint64_t request = it->second;
+	pending.erase(it);
+
+	if (hasCurrent && current.image.request == request)
+	{
+		stbi_image_free(current.image.pixels);
+		freeBuffers.push_back({ current.pbo, current.pboSize });
+		current = Staging();
+		hasCurrent = false;
+		return;
+	}
+
+	// Already uploaded, only the fence is outstanding
+	for (const InFlightUpload& upload : inFlight)
+	{
+		if (upload.request == request)
+			return;
+	}
+
+	// Still decoding or queued, dropped when it comes up for staging
+	cancelled.insert(request);
+}
+
+bool TextureStreamer::isResident(GLuint texture) const
+{
+	return texture != 0 && pending.find(texture) == pending.end();
+}
+
+bool TextureStreamer::isIdle() const
+{
+	return pending.empty();
+}
+
+// Recycles the PBOs of uploads the GPU has finished reading
+void TextureStreamer::retireUploads(bool wait)
+{
+	for (size_t i = 0; i < inFlight.size();)
+	{
+		InFlightUpload& upload = inFlight[i];
+		GLenum status = glClientWaitSync(upload.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+		{
+			i++;
+			continue;
+		}
+
+		glDeleteSync(upload.fence);
+		completeRequest(upload.texture, upload.request);
+
+		if (freeBuffers.size() < MAX_FREE_PIXEL_BUFFERS)
+			freeBuffers.push_back({ upload.pbo, upload.pboSize });
+		else
+			GLState::deleteBuffer(upload.pbo);
+
+		inFlight[i] = inFlight.back();
+		inFlight.pop_back();
+	}
+}
+
+// Clears the pending state unless the texture was cancelled and its name reused meanwhile
+void TextureStreamer::completeRequest(GLuint texture, uint64_t request)
+{
+	auto it = pending.find(texture);
+	if (it != pending.end() && it->second == request)
+		pending.erase(it);
+}
+
+// Copies the next slice of decoded pixels into a PBO, returns false once the budget is spent or nothing is left
+bool TextureStreamer::stageNext(size_t& budget, bool unlimited)
+{
+	if (!hasCurrent)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (decoded.empty())
+				return false;
+			current = Staging();
+			current.image = decoded.front();
+			decoded.pop_front();
+		}
+
+		// Failed decode: the placeholder stays
+		if (!current.image.pixels || cancelled.erase(current.image.request) > 0)
+		{
+			completeRequest(current.image.texture, current.image.request);
+			stbi_image_free(current.image.pixels);
+			current = Staging();
+			return true;
+		}
+
+		current.pbo = acquirePixelBuffer(current.image.size, current.pboSize);
+		hasCurrent = true;
+	}
+
+	if (!unlimited && budget == 0)
+		return false;
+
+	size_t remaining = current.image.size - current.copied;
+	size_t chunk = unlimited ? remaining : std::min(remaining, budget);
+
+	GLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, current.pbo);
+	glBufferSubData(GL_PIXEL_UNPACK_BUFFER, current.copied, chunk, current.image.pixels + current.copied);
+	GLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	current.copied += chunk;
+	frameStats.bytesStaged += chunk;
+	if (!unlimited)
+		budget -= chunk;
+
+	if (current.copied < current.image.size)
+		return false;
+
+	finishUpload();
+	return true;
+}
+
+// Specifies the texture from the fully staged PBO, the transfer itself runs asynchronously
+void TextureStreamer::finishUpload()
+{
+	const DecodedImage& image = current.image;
+
+	GLenum format = GL_RGBA;
+	GLenum internalFormat = image.gamma ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+	if (image.channels == 1)
+	{
+		format = GL_RED;
+		internalFormat = GL_R8;
+	}
+	else if (image.channels == 2)
+	{
+		format = GL_RG;
+		internalFormat = GL_RG8;
+	}
+	else if (image.channels == 3)
+	{
+		format = GL_RGB;
+		internalFormat = image.gamma ? GL_SRGB8 : GL_RGB8;
+	}
+
+	GLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, current.pbo);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	GLState::bindTexture(GL_TEXTURE_2D, image.texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, (void*)0);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	GLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	InFlightUpload upload;
+	upload.request = image.request;
+	upload.texture = image.texture;
+	upload.pbo = current.pbo;
+	upload.pboSize = current.pboSize;
+	upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	inFlight.push_back(upload);
+
+	stbi_image_free(current.image.pixels);
+	current = Staging();
+	hasCurrent = false;
+	frameStats.texturesUploaded++;
+}
+
+// Smallest free PBO that fits, or a new one
+GLuint TextureStreamer::acquirePixelBuffer(size_t size, size_t& bufferSize)
+{
+	size_t best = freeBuffers.size();
+	for (size_t i = 0; i < freeBuffers.size(); i++)
+	{
+		if (freeBuffers[i].size >= size && (best == freeBuffers.size() || freeBuffers[i].size < freeBuffers[best].size))
+			best = i;
+	}
+
+	if (best != freeBuffers.size())
+	{
+		GLuint id = freeBuffers[best].id;
+		bufferSize = freeBuffers[best].size;
+		freeBuffers.erase(freeBuffers.begin() + best);
+		return id;
+	}
+
+	GLuint id;
+	glGenBuffers(1, &id);
+	GLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, id);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	GLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	bufferSize = size;
+	return id;
+}
+
+// 1x1 texel that is neutral for the slot it will be sampled from
+void TextureStreamer::setPlaceholder(GLuint texture, const std::string& textureType)
+{
+	unsigned char texel[4] = { 255, 255, 255, 255 };
+	if (textureType == "texture_normal")
+	{
+		texel[0] = 128;
+		texel[1] = 128;
+	}
+	else if (textureType == "texture_specular" || textureType == "texture_height" ||
+		textureType == "texture_metallic" || textureType == "texture_emission")
+	{
+		texel[0] = texel[1] = texel[2] = 0;
+	}
+
+	GLState::bindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
@@ -5,15 +5,30 @@
 #include <glm/glm/gtc/type_ptr.hpp>
 
 #include "Graphics/Camera.h"
+#include "Graphics/CascadedShadowMaps.h"
+#include "Graphics/ClusteredLighting.h"
+#include "Graphics/DeferredRenderer.h"
+#include "Graphics/GpuPassTimers.h"
 #include "Graphics/Shader.h"
 #include "Graphics/Texture.h"
 #include "Graphics/Model.h"
 #include "Graphics/Light.h"
+#include "Graphics/FrameConstants.h"
+#include "Graphics/GLState.h"
+#include "Graphics/GpuCuller.h"
+#include "Graphics/ShaderHotReload.h"
+#include "Graphics/ShadowAtlas.h"
+#include "Graphics/TextureStreamer.h"
+#include "Graphics/AssetManager.h"
 
 #include <reusable/Cube.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <stdio.h>
+#include <string>
 
 // Function prototypes
 void processInput(GLFWwindow* window);
@@ -40,27 +55,96 @@ float lastFrame = 0.0f;
 // State keepers
 bool isWireframe = false;
 bool pKeyWasPressed = false;
+bool useMultiDraw = true;
+bool mKeyWasPressed = false;
+bool gpuLightAssignment = true;
+bool lKeyWasPressed = false;
+bool profileShadowCascades = false;
+bool kKeyWasPressed = false;
+
+// Instanced backpack grid (gridSize x gridSize copies)
+const int backpackGridSize = 10;
+const float backpackGridSpacing = 4.0f;
+
+// Field of small point lights over the backpack grid (lightFieldSize x lightFieldSize), shaded through the light clusters
+const int lightFieldSize = 32;
+const float lightFieldSpacing = 1.25f;
+
+// Every shadowedLightStride-th light of the field casts shadows through the shadow atlas
+const int shadowedLightStride = 8;
+
+// Meshes whose bounds project to fewer pixels are not drawn
+const float minCullPixelSize = 2.0f;
+
+// Frames a headless run draws when --frames is not given
+const int defaultHeadlessFrames = 300;
+
+// Texture streaming budget per frame (bytes)
+const size_t textureUploadBudget = 8 * 1024 * 1024;
 
 // Global ambient light
 glm::vec3 globalAmbientColor = glm::vec3(1.0f, 1.0f, 1.0f);
 float globalAmbientStrength = 0.05;
 
-int main()
+int main(int argc, char** argv)
 {
-    glfwInit();
+    // Render path, fixed at startup: --deferred shades a G-buffer instead of the forward pass, --prepass lays down depth first.
+    // --headless draws offscreen without a window system (CI on Mesa llvmpipe), --frames N quits after N frames.
+    // --benchmark turns vsync off, so the frame and pass times of the two paths can be compared.
+    bool deferredShading = false;
+    bool depthPrepass = false;
+    bool headless = false;
+    bool benchmark = false;
+    int frameLimit = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--deferred")
+            deferredShading = true;
+        else if (arg == "--prepass")
+            depthPrepass = true;
+        else if (arg == "--headless")
+            headless = true;
+        else if (arg == "--benchmark")
+            benchmark = true;
+        else if (arg == "--frames" && i + 1 < argc)
+            frameLimit = std::atoi(argv[++i]);
+        else
+            std::cout << "Unknown option " << arg << ", expected --deferred, --prepass, --headless, --benchmark or --frames N" << std::endl;
+    }
+    if (headless && frameLimit <= 0)
+        frameLimit = defaultHeadlessFrames;
+
+    // Headless: GLFW's null platform with a surfaceless EGL context, Mesa creates one without a display
+    if (headless)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    if (!glfwInit())
+    {
+        std::cout << "Failed to initialize GLFW" << std::endl;
+        return -1;
+    }
+
+    // The renderer only needs 4.5, which is as far as llvmpipe goes; drivers with 4.6 still create a 4.6 context
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (headless)
+    {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
 
     /* Window creation */
-    GLFWwindow* window = glfwCreateWindow(800, 600, "The Fusion Engine", NULL, NULL);
+    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "The Fusion Engine", NULL, NULL);
     if (window == NULL)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
+        std::cout << "Failed to create GLFW window" << (headless ? " (headless needs EGL with EGL_MESA_platform_surfaceless)" : "") << std::endl;
         glfwTerminate();
         return -1;
     }
     glfwMakeContextCurrent(window); // On the calling thread, make the context of the specified window current
+    if (benchmark)
+        glfwSwapInterval(0);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -72,6 +156,32 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    std::cout << "OpenGL " << glGetString(GL_VERSION) << ", " << glGetString(GL_RENDERER) << std::endl;
+
+    // Everything is drawn into targetFramebuffer. Headless contexts have no default framebuffer, so it is an offscreen one
+    // with the default framebuffer's depth format, the depth pyramid and the deferred path blit depth out of it.
+    GLuint targetFramebuffer = 0;
+    GLuint offscreenColor = 0, offscreenDepth = 0;
+    if (headless)
+    {
+        glGenRenderbuffers(1, &offscreenColor);
+        glBindRenderbuffer(GL_RENDERBUFFER, offscreenColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, SCR_WIDTH, SCR_HEIGHT);
+        glGenRenderbuffers(1, &offscreenDepth);
+        glBindRenderbuffer(GL_RENDERBUFFER, offscreenDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, SCR_WIDTH, SCR_HEIGHT);
+
+        glGenFramebuffers(1, &targetFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, offscreenDepth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "Failed to create the offscreen framebuffer" << std::endl;
+            return -1;
+        }
+        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+    }
 
     stbi_set_flip_vertically_on_load(true);
 
@@ -82,9 +192,24 @@ int main()
     glEnable(GL_DEPTH_TEST);
 
 
+    // Texture streaming, model textures show placeholders until they are resident
+    TextureStreamer* textureStreamer = new TextureStreamer(textureUploadBudget);
+
+    // Asset manager, shares models, textures and shaders across the scene
+    AssetManager* assetManager = new AssetManager(textureStreamer);
+
     // Shaders
-    Shader shader("shaders/default.vert", "shaders/default.frag");
-    Shader skyboxShader("shaders/skybox.vert", "shaders/skybox.frag");
+    // Default shader variants are compiled on first use for each texture set and light count
+    ShaderPermutations defaultShaders("shaders/default.vert", "shaders/default.frag");
+    // Same vertex stage with an empty fragment stage for the depth prepass, one variant serves every permutation
+    ShaderPermutations depthShaders("shaders/default.vert", "shaders/depth_only.frag", true);
+    ShaderHandle skyboxShader = assetManager->loadShader("shaders/skybox.vert", "shaders/skybox.frag");
+
+    // Shaders recompile in the background when their files in shaders/ are saved
+    ShaderHotReload shaderHotReload("shaders");
+    shaderHotReload.watch(&defaultShaders);
+    shaderHotReload.watch(&depthShaders);
+    shaderHotReload.watch(skyboxShader.get());
 
 
     // LightManager
@@ -93,14 +218,39 @@ int main()
     // PointLight params:   glm::vec3 color, glm::vec3 position, float constant, float linear, float quadratic
     // SpotLight params:    glm::vec3 color, glm::vec3 position, glm::vec3 direction, float cutOff, float outerCutOff
      
-    lightManager.addLight(std::make_shared<DirectionalLight>(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-0.2f, -1.0f, -0.3f)));
+    LightHandle sun = lightManager.addLight(DirectionalLight(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(-0.2f, -1.0f, -0.3f)));
     
-    lightManager.addLight(std::make_shared<PointLight>(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(5.0f, 2.0f, -2.0f),    1.0f, 0.09f, 0.032f));
-    lightManager.addLight(std::make_shared<PointLight>(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(2.5f, 3.0f, -6.0f),    1.0f, 0.09f, 0.032f));
-    lightManager.addLight(std::make_shared<PointLight>(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(10.0f, -1.0f, -10.0f), 1.0f, 0.09f, 0.032f));
-    lightManager.addLight(std::make_shared<PointLight>(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.0f, 0.0f, -3.0f),   1.0f, 0.09f, 0.032f));
+    // Point and spot lights with shadows from the shadow atlas
+    std::vector<LightHandle> shadowedLights;
+    shadowedLights.push_back(lightManager.addLight(PointLight(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(5.0f, 2.0f, -2.0f),    1.0f, 0.09f, 0.032f)));
+    shadowedLights.push_back(lightManager.addLight(PointLight(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(2.5f, 3.0f, -6.0f),    1.0f, 0.09f, 0.032f)));
+    shadowedLights.push_back(lightManager.addLight(PointLight(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(10.0f, -1.0f, -10.0f), 1.0f, 0.09f, 0.032f)));
+    shadowedLights.push_back(lightManager.addLight(PointLight(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.0f, 0.0f, -3.0f),   1.0f, 0.09f, 0.032f)));
     
-    lightManager.addLight(std::make_shared<SpotLight>(glm::vec3(1.0f, 1.0f, 1.0f), camera.Position, camera.Front, glm::cos(glm::radians(12.5f)), glm::cos(glm::radians(15.0f))));
+    shadowedLights.push_back(lightManager.addLight(SpotLight(glm::vec3(1.0f, 1.0f, 1.0f), camera.Position, camera.Front, glm::cos(glm::radians(12.5f)), glm::cos(glm::radians(15.0f)))));
+
+    // Small colored lights with a short range, each fragment only shades the few its cluster lists
+    for (int x = 0; x < lightFieldSize; x++)
+    {
+        for (int z = 0; z < lightFieldSize; z++)
+        {
+            glm::vec3 position = glm::vec3((x - lightFieldSize / 2) * lightFieldSpacing, -1.5f, -13.0f - z * lightFieldSpacing);
+            glm::vec3 color = glm::vec3(0.5f + 0.5f * std::sin(x * 0.7f), 0.5f + 0.5f * std::sin(z * 0.9f + 2.0f), 0.5f + 0.5f * std::sin((x + z) * 0.5f + 4.0f));
+            LightHandle light = lightManager.addLight(PointLight(color, position, 1.0f, 1.4f, 7.2f));
+            if (x % shadowedLightStride == 0 && z % shadowedLightStride == 0)
+                shadowedLights.push_back(light);
+        }
+    }
+
+    // Assigns the point and spot lights to froxels every frame
+    ClusteredLighting clusteredLighting;
+    clusteredLighting.watch(shaderHotReload);
+
+    // G-buffer and lighting pass, only created for the deferred path
+    DeferredRenderer* deferredRenderer = deferredShading ? new DeferredRenderer() : nullptr;
+
+    // GPU time of the forward pass, or of the G-buffer and lighting passes
+    GpuPassTimers passTimers;
 
 
     // Skybox
@@ -109,99 +259,274 @@ int main()
     unsigned int skyboxTexture = Texture::loadCubemap(pathToSkybox, "jpg");
 
     // Models
-    Model model_Backpack("assets/backpack/backpack.obj", false);
+    ModelHandle model_Backpack = assetManager->loadModel("assets/backpack/backpack.obj", false, VertexLayout::Packed);
+    unsigned int backpackLod = 0;
+    model_Backpack->SetColor(glm::vec3(1.0f, 0.5f, 0.5f));
 
-    while (!glfwWindowShouldClose(window))
+    // Backpack grid, culled and given its detail levels on the GPU, the CPU never touches the instances again
+    std::vector<glm::mat4> backpackGrid;
+    for (int x = 0; x < backpackGridSize; x++)
     {
+        for (int z = 0; z < backpackGridSize; z++)
+        {
+            glm::vec3 offset = glm::vec3((x - backpackGridSize / 2) * backpackGridSpacing, 0.0f, -15.0f - z * backpackGridSpacing);
+            backpackGrid.push_back(glm::translate(glm::mat4(1.0f), offset));
+        }
+    }
+    GpuCuller gridCuller;
+    gridCuller.setInstances(*model_Backpack, backpackGrid);
+    gridCuller.watch(shaderHotReload);
+
+    // Sun shadows, the grid never moves so the far cascades stay cached
+    CascadedShadowMaps shadowMaps;
+
+    // Point and spot light shadows, only tiles whose light or casters changed are drawn again
+    ShadowAtlas shadowAtlas(lightManager);
+    for (LightHandle light : shadowedLights)
+        shadowAtlas.addLight(light);
+
+    // Casters of both shadow passes, re-added every frame
+    ShadowCasters shadowCasters;
+    InstanceBuffer gridShadowCasters;
+    for (const glm::mat4& transform : backpackGrid)
+        gridShadowCasters.add(transform);
+    gridShadowCasters.upload();
+
+    // Camera and ambient constants shared by every shader
+    FrameConstantsBuffer frameConstantsBuffer;
+
+    // Draws of a frame, sorted before they are issued
+    RenderQueue renderQueue;
+
+    // Culling, boxes are re-added every frame
+    FrustumCuller culler;
+    culler.minPixelSize = minCullPixelSize;
+    float cullStatsTime = 0.0f;
+
+    // Average frame time over the title's interval, to compare the render paths on the same scene
+    float frameTimeSum = 0.0f;
+    unsigned int frameTimeCount = 0;
+
+    int frameCount = 0;
+    while (!glfwWindowShouldClose(window) && (frameLimit <= 0 || frameCount < frameLimit))
+    {
+        frameCount++;
+
         // Time
         GLfloat currentFrameTime = glfwGetTime();
         deltaTime = currentFrameTime - lastFrame;
         lastFrame = currentFrameTime;
+        frameTimeSum += deltaTime;
+        frameTimeCount++;
+
+        // State cache counters cover one frame
+        GLState::resetStats();
+        passTimers.beginFrame();
 
         // Process Input
         processInput(window);
 
-        glClearColor(0.15f, 0.25f, 0.55f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Stream in textures within this frame's upload budget
+        textureStreamer->update();
 
-        // Camera and transformations
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 1000.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 viewSkybox = glm::mat4(glm::mat3(camera.GetViewMatrix()));
+        // Copy streamed textures into the material arrays, bind the material table and arrays
+        MaterialLibrary::Shared().update(textureStreamer);
 
+        // Swap in shaders that were edited and have finished compiling
+        shaderHotReload.update();
 
-        // Skybox
-        // Activate skybox shader
-        glDepthFunc(GL_LEQUAL);
-        skyboxShader.use();
-        skyboxShader.setInt("skybox", 0);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-
-        skyboxShader.setMat4("projection", projection);
-        skyboxShader.setMat4("view", viewSkybox);
-        skyboxCube->Draw();
-
-        
-        // Back to default depth function
-        glDepthFunc(GL_LESS);
-
-        // Activate default shader
-        shader.use();
-        shader.setMat4("projection", projection);
-        shader.setMat4("view", view);
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+        glClearColor(0.15f, 0.25f, 0.55f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Camera position
-        shader.setVec3("viewPos", camera.Position);
+        // Framebuffer pixels, the light clusters and the depth pyramid work in them
+        int framebufferWidth = SCR_WIDTH, framebufferHeight = SCR_HEIGHT;
+        if (!headless)
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        // A minimized window reports zero
+        framebufferWidth = std::max(framebufferWidth, 1);
+        framebufferHeight = std::max(framebufferHeight, 1);
 
-        // Draw objects
-        // Backpack model
-        shader.setVec3("objectColor", 1.0f, 0.5f, 0.5f);
+        // Camera and transformations, sized to the framebuffer so LOD, culling and shadow tiles follow resizes and HiDPI
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)framebufferWidth / (float)framebufferHeight, 0.1f, 1000.0f);
+        glm::mat4 view = camera.GetViewMatrix();
+        glm::mat4 viewSkybox = glm::mat4(glm::mat3(camera.GetViewMatrix()));
+        RenderView renderView(camera.Position, view, projection, (float)framebufferHeight);
+
+        // Frame constants and lights, one upload each
+        FrameConstants frameConstants;
+        frameConstants.projection = projection;
+        frameConstants.view = view;
+        frameConstants.viewRotation = viewSkybox;
+        frameConstants.viewPos = glm::vec4(camera.Position, 1.0f);
+        frameConstants.ambient = glm::vec4(globalAmbientColor, globalAmbientStrength);
+        frameConstants.clusterScale = ClusteredLighting::ClusterScale(renderView, (float)framebufferWidth, (float)framebufferHeight);
+        frameConstantsBuffer.update(frameConstants);
+
+        // Object transforms
         glm::mat4 modelBackpack = glm::mat4(1.0f);
         modelBackpack = glm::translate(modelBackpack, glm::vec3(0.0f, 0.0f, -5.0f));
         modelBackpack = glm::scale(modelBackpack, glm::vec3(1.0f, 1.0f, 1.0f));
-        shader.setMat4("model", modelBackpack);
-        model_Backpack.Draw(shader);
-
-        // Lights
-        int dirLightCount = 0;
-        int pointLightCount = 0;
-        int spotLightCount = 0;
-
-        // Global ambient light
-        shader.setVec3("globalAmbientColor", globalAmbientColor);
-        shader.setFloat("globalAmbientStrength", globalAmbientStrength);
-
-        // For each light in the lightManager, check if it is a DirectionalLight, PointLight or SpotLight
-        for (auto& light : lightManager.lights) {
-            if (auto dl = std::dynamic_pointer_cast<DirectionalLight>(light)) {
-                dl->SendToShader(shader, "dirLights[" + std::to_string(dirLightCount++) + "]");
-            }
-            else if (auto pl = std::dynamic_pointer_cast<PointLight>(light)) {
-                pl->SendToShader(shader, "pointLights[" + std::to_string(pointLightCount++) + "]");
-            }
-            else if (auto sl = std::dynamic_pointer_cast<SpotLight>(light)) {
-                sl->SendToShader(shader, "spotLights[" + std::to_string(spotLightCount++) + "]");
-            }
-        }
 
-        shader.setInt("numDirLights", dirLightCount);
-        shader.setInt("numPointLights", pointLightCount);
-        shader.setInt("numSpotLights", spotLightCount);
+        // Shadows before the queue binds its framebuffer. The atlas writes the lights' tiles, so it runs before their upload.
+        shadowCasters.clear();
+        shadowCasters.add(*model_Backpack, modelBackpack);
+        shadowCasters.add(*model_Backpack, gridShadowCasters);
+        shadowMaps.profileCascades = profileShadowCascades;
+        shadowMaps.render(shadowCasters, renderView, glm::vec3(lightManager.get(sun).direction), targetFramebuffer, framebufferWidth, framebufferHeight);
+        shadowAtlas.render(shadowCasters, renderView, targetFramebuffer, framebufferWidth, framebufferHeight);
+
+        lightManager.upload();
+        clusteredLighting.gpuAssignment = gpuLightAssignment;
+        clusteredLighting.update(lightManager, renderView);
+        renderQueue.begin(renderView);
+        renderQueue.multiDraw = useMultiDraw;
+
+        // Culling
+        culler.clear();
+        unsigned int backpackCullIndex = model_Backpack->AddToCuller(culler, modelBackpack);
+        culler.cull(renderView);
+
+        // Grid: frustum, occlusion against last frame's depth and detail levels in one compute pass
+        gridCuller.cull(renderView);
+
+        // Directional light count is compiled into the default shader variants, point and spot lights come from the clusters
+        ShaderPermutation lighting;
+        lighting.dirLights = lightManager.count(LightType::Directional);
+        lighting.clustered = true;
+        lighting.shadows = true;
+        lighting.localShadows = true;
+        // The deferred path writes surfaces to the G-buffer, DeferredRenderer::light does the shading
+        lighting.gbuffer = deferredShading;
+
+        // Queue objects, the queue sorts them by state and front to back
+        // Depth prepass, the opaque pass after it only shades the visible surface of each pixel
+        if (depthPrepass)
+        {
+            model_Backpack->Submit(renderQueue, depthShaders, lighting, renderView, modelBackpack, backpackLod, culler.visibleFlags() + backpackCullIndex, RenderPass::DepthPrepass);
+            gridCuller.submit(renderQueue, depthShaders, lighting, RenderPass::DepthPrepass);
+        }
 
+        // Backpack model
+        model_Backpack->Submit(renderQueue, defaultShaders, lighting, renderView, modelBackpack, backpackLod, culler.visibleFlags() + backpackCullIndex);
+
+        // Backpack grid, drawn from the commands the compute pass wrote
+        gridCuller.submit(renderQueue, defaultShaders, lighting);
+
+        // Skybox last, depth test GL_LEQUAL only shades the pixels no object covered
+        // skybox.frag samples unit 0 through its binding layout
+        renderQueue.submitCustom(RenderPass::Sky, *skyboxShader, 0.0f, [&](Shader& shader) {
+            GLState::bindTexture(0, GL_TEXTURE_CUBE_MAP, skyboxTexture);
+            skyboxCube->Draw();
+        });
+
+        if (deferredRenderer)
+        {
+            // Prepass and surfaces into the G-buffer, one lighting pass, then the sky over the pixels left empty
+            passTimers.begin(TimedPass::Geometry);
+            deferredRenderer->beginGeometry(framebufferWidth, framebufferHeight);
+            renderQueue.executePasses(RenderPass::DepthPrepass, RenderPass::Opaque);
+            passTimers.end();
+            passTimers.begin(TimedPass::Lighting);
+            deferredRenderer->light(targetFramebuffer, renderView, lighting.dirLights, true, true);
+            passTimers.end();
+            renderQueue.executePasses(RenderPass::Sky, RenderPass::Sky);
+        }
+        else
+        {
+            passTimers.begin(TimedPass::Forward);
+            renderQueue.execute();
+            passTimers.end();
+        }
 
+        // Next frame's occlusion test runs against this frame's depth
+        gridCuller.buildDepthPyramid(targetFramebuffer, framebufferWidth, framebufferHeight);
+
+        // Culling and state cache counters in the title, once per second
+        if (currentFrameTime - cullStatsTime >= 1.0f)
+        {
+            const CullStats& cullStats = culler.stats();
+            const GpuCullStats& gpuCullStats = gridCuller.stats();
+            const GLStateStats& stateStats = GLState::stats();
+            const ShadowStats& shadowStats = shadowMaps.stats();
+            const ShadowAtlasStats& atlasStats = shadowAtlas.stats();
+            const GpuPassTimes& passTimes = passTimers.times();
+            std::string gpuTimes = deferredRenderer
+                ? "G-buffer " + std::to_string(passTimes.ms[(int)TimedPass::Geometry]) + " ms, lighting " + std::to_string(passTimes.ms[(int)TimedPass::Lighting]) + " ms"
+                : "forward " + std::to_string(passTimes.ms[(int)TimedPass::Forward]) + " ms";
+            std::string shadowTimes = std::to_string(shadowStats.totalMs) + " ms";
+            if (profileShadowCascades)
+            {
+                shadowTimes += " (";
+                for (unsigned int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+                    shadowTimes += (i ? ", " : "") + ((shadowStats.renderedCascades >> i & 1) ? std::to_string(shadowStats.cascadeMs[i]) : std::string("cached"));
+                shadowTimes += ")";
+            }
+            std::string title = std::string("The Fusion Engine | ") + (deferredRenderer ? "deferred" : "forward") + (depthPrepass ? " + prepass" : "")
+                + ", " + std::to_string(1000.0f * frameTimeSum / frameTimeCount) + " ms" + (benchmark ? " (no vsync)" : "") + ", GPU " + gpuTimes
+                + " | visible " + std::to_string(cullStats.drawn) + ", frustum culled " + std::to_string(cullStats.frustumCulled) + ", small culled " + std::to_string(cullStats.smallCulled)
+                + " | grid visible " + std::to_string(gpuCullStats.visible) + ", frustum culled " + std::to_string(gpuCullStats.frustumCulled) + ", occluded " + std::to_string(gpuCullStats.occlusionCulled)
+                + " | state calls " + std::to_string(stateStats.issued) + ", skipped " + std::to_string(stateStats.skipped)
+                + " | draws " + std::to_string(renderQueue.stats().commands) + ", GL calls " + std::to_string(renderQueue.stats().drawCalls) + (useMultiDraw ? " (MDI)" : "")
+                + ", program changes " + std::to_string(renderQueue.stats().programChanges)
+                + " | lights " + std::to_string(lightManager.size()) + ", uploaded " + std::to_string(lightManager.lastUploadCount()) + (clusteredLighting.assignedOnGpu() ? " (GPU clusters)" : " (CPU clusters)")
+                + " | shadows " + shadowTimes + (shadowMaps.layered() && !profileShadowCascades ? " layered" : "")
+                + " | atlas " + std::to_string(atlasStats.shadowedLights) + " lights, " + std::to_string(atlasStats.tiles) + " tiles, drawn " + std::to_string(atlasStats.renderedTiles)
+                + ", pending " + std::to_string(atlasStats.pendingTiles) + ", " + std::to_string(atlasStats.ms) + " ms";
+            glfwSetWindowTitle(window, title.c_str());
+            if (headless)
+                std::cout << title << std::endl;
+            cullStatsTime = currentFrameTime;
+            frameTimeSum = 0.0f;
+            frameTimeCount = 0;
+        }
 
-        // Swap buffers and poll IO events
-        glfwSwapBuffers(window);
+        // Swap buffers and poll IO events, headless frames have nothing to present
+        if (headless)
+            glFlush();
+        else
+            glfwSwapBuffers(window);
         glfwPollEvents();
     }
     // De-allocate resources
     delete skyboxCube;
 
+    gridCuller.Delete();
+    frameConstantsBuffer.Delete();
+    lightManager.Delete();
+    clusteredLighting.Delete();
+    delete deferredRenderer;
+    passTimers.Delete();
+    shadowMaps.Delete();
+    shadowAtlas.Delete();
+    gridShadowCasters.Delete();
+    renderQueue.Delete();
+
+    // Release the handles before their manager goes away
+    model_Backpack.reset();
+    MaterialLibrary::Shared().Delete();
+    defaultShaders.Delete();
+    depthShaders.Delete();
+    skyboxShader.reset();
+    delete assetManager;
+    delete textureStreamer;
+    GeometryPool::DeleteAll();
+
+
+    // A headless run fails when the frames left a GL error behind
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR)
+        std::cout << "GL error 0x" << std::hex << error << std::dec << " after " << frameCount << " frames" << std::endl;
+    if (targetFramebuffer)
+    {
+        glDeleteFramebuffers(1, &targetFramebuffer);
+        glDeleteRenderbuffers(1, &offscreenColor);
+        glDeleteRenderbuffers(1, &offscreenDepth);
+    }
 
     glfwDestroyWindow(window);
     glfwTerminate();
-    return 0;
+    return headless && error != GL_NO_ERROR ? 1 : 0;
 }
 
 /* Function definitions */
@@ -232,9 +557,27 @@ void processInput(GLFWwindow* window)
     if (pKeyPressed && !pKeyWasPressed)
     {
 		isWireframe = !isWireframe;
-		glPolygonMode(GL_FRONT_AND_BACK, isWireframe ? GL_LINE : GL_FILL);
+		GLState::polygonMode(isWireframe ? GL_LINE : GL_FILL);
 	}
 	pKeyWasPressed = pKeyPressed;
+
+    // Toggle multi-draw indirect batching (M)
+    bool mKeyPressed = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+    if (mKeyPressed && !mKeyWasPressed)
+        useMultiDraw = !useMultiDraw;
+    mKeyWasPressed = mKeyPressed;
+
+    // Toggle between compute and CPU light cluster assignment (L)
+    bool lKeyPressed = glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS;
+    if (lKeyPressed && !lKeyWasPressed)
+        gpuLightAssignment = !gpuLightAssignment;
+    lKeyWasPressed = lKeyPressed;
+
+    // Toggle one timed pass per shadow cascade instead of the single layered pass (K)
+    bool kKeyPressed = glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS;
+    if (kKeyPressed && !kKeyWasPressed)
+        profileShadowCascades = !profileShadowCascades;
+    kKeyWasPressed = kKeyPressed;
 }
 
 //-----------------------------------------------------------
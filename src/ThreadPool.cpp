@@ -0,0 +1,107 @@
+#include "Graphics/ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+	: stopping(false)
+{
+	if (threadCount == 0)
+	{
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	for (unsigned int i = 0; i < threadCount; i++)
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push(std::move(task));
+	}
+	wakeUp.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+	if (count == 0)
+		return;
+
+	// Shared so helpers that only start after we returned still find valid (empty) work
+	struct Batch
+	{
+		std::function<void(size_t)> body;
+		size_t count;
+		std::atomic<size_t> next;
+		std::atomic<size_t> done;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+	auto batch = std::make_shared<Batch>();
+	batch->body = body;
+	batch->count = count;
+	batch->next = 0;
+	batch->done = 0;
+
+	auto drain = [](Batch& b)
+	{
+		for (size_t i = b.next++; i < b.count; i = b.next++)
+		{
+			b.body(i);
+			if (++b.done == b.count)
+			{
+				std::lock_guard<std::mutex> lock(b.mutex);
+				b.finished.notify_all();
+			}
+		}
+	};
+
+	size_t helpers = std::min<size_t>(workers.size(), count - 1);
+	for (size_t i = 0; i < helpers; i++)
+		submit([batch, drain]() { drain(*batch); });
+
+	drain(*batch);
+
+	// Wait for indices still running on workers, not for the helper tasks themselves
+	std::unique_lock<std::mutex> lock(batch->mutex);
+	batch->finished.wait(lock, [&]() { return batch->done == batch->count; });
+}
+
+ThreadPool& ThreadPool::Shared()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::workerLoop()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty())
+				return;
+
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
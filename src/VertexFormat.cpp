@@ -0,0 +1,180 @@
+#include "Graphics/VertexFormat.h"
+
+#include <glm/glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <cstring>
+
+static_assert(sizeof(Vertex) == 88, "Vertex layout changed, bump CookedMesh::VERSION");
+static_assert(sizeof(StaticVertex) == 56, "StaticVertex layout changed, bump CookedMesh::VERSION");
+static_assert(sizeof(PackedVertex) == 28, "PackedVertex layout changed, bump CookedMesh::VERSION");
+
+size_t VertexStride(VertexLayout layout)
+{
+	switch (layout)
+	{
+	case VertexLayout::Static:
+		return sizeof(StaticVertex);
+	case VertexLayout::Packed:
+		return sizeof(PackedVertex);
+	default:
+		return sizeof(Vertex);
+	}
+}
+
+glm::vec2 OctEncode(const glm::vec3& n)
+{
+	float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (sum == 0.0f)
+		return glm::vec2(0.0f);
+
+	glm::vec2 p = glm::vec2(n.x, n.y) / sum;
+	if (n.z < 0.0f)
+	{
+		glm::vec2 folded = glm::vec2(1.0f - std::abs(p.y), 1.0f - std::abs(p.x));
+		p.x = p.x >= 0.0f ? folded.x : -folded.x;
+		p.y = p.y >= 0.0f ? folded.y : -folded.y;
+	}
+	return p;
+}
+
+glm::vec3 OctDecode(const glm::vec2& e)
+{
+	glm::vec3 n = glm::vec3(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	float t = glm::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+std::vector<unsigned char> PackVertices(const Vertex* vertices, size_t count, VertexLayout layout)
+{
+	std::vector<unsigned char> packed(count * VertexStride(layout));
+
+	if (layout == VertexLayout::Skinned)
+	{
+		if (count > 0)
+			std::memcpy(packed.data(), vertices, packed.size());
+		return packed;
+	}
+
+	if (layout == VertexLayout::Static)
+	{
+		StaticVertex* out = reinterpret_cast<StaticVertex*>(packed.data());
+		for (size_t i = 0; i < count; i++)
+		{
+			out[i].Position = vertices[i].Position;
+			out[i].Normal = vertices[i].Normal;
+			out[i].TexCoords = vertices[i].TexCoords;
+			out[i].Tangent = vertices[i].Tangent;
+			out[i].Bitangent = vertices[i].Bitangent;
+		}
+		return packed;
+	}
+
+	PackedVertex* out = reinterpret_cast<PackedVertex*>(packed.data());
+	for (size_t i = 0; i < count; i++)
+	{
+		const Vertex& v = vertices[i];
+		glm::vec2 normal = OctEncode(v.Normal);
+		glm::vec2 tangent = OctEncode(v.Tangent);
+
+		out[i].Position = v.Position;
+		out[i].Normal[0] = (int16_t)glm::packSnorm1x16(normal.x);
+		out[i].Normal[1] = (int16_t)glm::packSnorm1x16(normal.y);
+		out[i].Tangent[0] = (int16_t)glm::packSnorm1x16(tangent.x);
+		out[i].Tangent[1] = (int16_t)glm::packSnorm1x16(tangent.y);
+		out[i].TexCoords[0] = glm::packHalf1x16(v.TexCoords.x);
+		out[i].TexCoords[1] = glm::packHalf1x16(v.TexCoords.y);
+		out[i].BitangentSign = glm::dot(glm::cross(v.Normal, v.Tangent), v.Bitangent) < 0.0f ? -127 : 127;
+		out[i].Padding[0] = out[i].Padding[1] = out[i].Padding[2] = 0;
+	}
+	return packed;
+}
+
+GLenum IndexType(size_t vertexCount)
+{
+	return vertexCount < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+size_t IndexSize(GLenum indexType)
+{
+	return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+std::vector<unsigned char> PackIndices(const unsigned int* indices, size_t count, GLenum indexType)
+{
+	std::vector<unsigned char> packed(count * IndexSize(indexType));
+
+	if (indexType == GL_UNSIGNED_SHORT)
+	{
+		uint16_t* out = reinterpret_cast<uint16_t*>(packed.data());
+		for (size_t i = 0; i < count; i++)
+			out[i] = (uint16_t)indices[i];
+	}
+	else if (count > 0)
+	{
+		std::memcpy(packed.data(), indices, packed.size());
+	}
+	return packed;
+}
+
+void SetupVertexAttributes(VertexLayout layout)
+{
+	if (layout == VertexLayout::Packed)
+	{
+		GLsizei stride = sizeof(PackedVertex);
+		// Positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex, Position));
+		// Normals (octahedral, decoded in the vertex shader)
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, Normal));
+		// Texture coords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex, TexCoords));
+		// Tangent (octahedral)
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, Tangent));
+		// Bitangent sign
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 1, GL_BYTE, GL_TRUE, stride, (void*)offsetof(PackedVertex, BitangentSign));
+
+		glDisableVertexAttribArray(5);
+		glDisableVertexAttribArray(6);
+		return;
+	}
+
+	// Static and skinned layouts share the leading members
+	GLsizei stride = (GLsizei)VertexStride(layout);
+	// Positions
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Position));
+	// Normals
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Normal));
+	// Texture coords
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, TexCoords));
+	// Tangent
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Tangent));
+	// Bitangent
+	glEnableVertexAttribArray(4);
+	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Bitangent));
+
+	if (layout == VertexLayout::Skinned)
+	{
+		// Ids
+		glEnableVertexAttribArray(5);
+		glVertexAttribIPointer(5, MAX_BONE_INFLUENCE, GL_INT, stride, (void*)offsetof(Vertex, m_BoneIDs));
+		// Weights
+		glEnableVertexAttribArray(6);
+		glVertexAttribPointer(6, MAX_BONE_INFLUENCE, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, m_Weights));
+	}
+	else
+	{
+		glDisableVertexAttribArray(5);
+		glDisableVertexAttribArray(6);
+	}
+}
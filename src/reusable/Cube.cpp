@@ -1,4 +1,5 @@
 #include <reusable/Cube.h>
+#include "Graphics/GLState.h"
 
 Cube::Cube()
 	: scale(1.0f), VAO(0), VBO(0), EBO(0), isSkybox(false)
@@ -20,9 +21,9 @@ Cube::Cube(bool isSkybox)
 
 Cube::~Cube() 
 {
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
+	GLState::deleteVertexArray(VAO);
+	GLState::deleteBuffer(VBO);
+	GLState::deleteBuffer(EBO);
 }
 
 void Cube::setScale(float scale)
@@ -30,16 +31,15 @@ void Cube::setScale(float scale)
 	this->scale = scale;
 	setupCubeVertices(vertices, scale);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void Cube::Draw()
 {
-	glBindVertexArray(VAO);
+	GLState::bindVertexArray(VAO);
 	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
 }
 
 void Cube::setupCube() {
@@ -64,12 +64,12 @@ void Cube::setupCube() {
 	glGenBuffers(1, &VBO);
 	glGenBuffers(1, &EBO);
 
-	glBindVertexArray(VAO);
+	GLState::bindVertexArray(VAO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
 	// Position attribute
@@ -82,8 +82,8 @@ void Cube::setupCube() {
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
 	glEnableVertexAttribArray(2);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+	GLState::bindVertexArray(0);
 }
 
 void Cube::setupSkybox() {
@@ -108,20 +108,20 @@ void Cube::setupSkybox() {
 	glGenBuffers(1, &VBO);
 	glGenBuffers(1, &EBO);
 
-	glBindVertexArray(VAO);
+	GLState::bindVertexArray(VAO);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
 	// Position attribute
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+	GLState::bindVertexArray(0);
 }
 
 void Cube::setupCubeVertices(float* vertices, float scale)